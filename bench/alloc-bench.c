@@ -0,0 +1,170 @@
+// Allocator benchmark for entropy buffers: each thread keeps a set of live
+// buffers and repeatedly replaces a random one with a buffer of a random
+// size (log-uniform between 32 bytes and --max-size), filling it as a reply
+// copy would. Compares malloc + explicit_bzero + free against
+// qrng_buf_alloc/qrng_buf_free. Each variant runs in its own child process
+// so the reported peak RSS is its own.
+//
+// Build: gcc bench/alloc-bench.c qrng.c -o bin/alloc-bench -pthread $(pkg-config --cflags --libs libsystemd)
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../qrng.h"
+
+typedef struct {
+    const char *name;
+    void *(*alloc)(size_t len);
+    void (*release)(void *buf, size_t len);
+} variant_t;
+
+static unsigned n_threads = 4;
+static unsigned long n_ops = 200000;
+static unsigned n_live = 16;
+static size_t max_size = 1024 * 1024;
+static const variant_t *variant;
+
+static void *plain_alloc(size_t len) {
+    return malloc(len);
+}
+
+static void plain_free(void *buf, size_t len) {
+    if (buf) {
+        explicit_bzero(buf, len);
+        free(buf);
+    }
+}
+
+static const variant_t variants[] = {
+    {"malloc", plain_alloc, plain_free},
+    {"qrng_buf", qrng_buf_alloc, qrng_buf_free},
+};
+
+static uint64_t next_u64(uint64_t *state) {
+    // splitmix64
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static size_t random_size(uint64_t *state) {
+    unsigned max_shift = 63 - __builtin_clzll(max_size);
+    uint64_t r = next_u64(state);
+    unsigned shift = 5 + r % (max_shift - 4);
+    size_t size = ((size_t)1 << shift) + (r >> 32) % ((size_t)1 << shift);
+    return size > max_size ? max_size : size;
+}
+
+static void *worker(void *userdata) {
+    uint64_t state = (uintptr_t)userdata;
+    void **bufs = calloc(n_live, sizeof(*bufs));
+    size_t *sizes = calloc(n_live, sizeof(*sizes));
+
+    for (unsigned long i = 0; i < n_ops; i++) {
+        unsigned slot = next_u64(&state) % n_live;
+        variant->release(bufs[slot], sizes[slot]);
+        sizes[slot] = random_size(&state);
+        bufs[slot] = variant->alloc(sizes[slot]);
+        if (!bufs[slot]) {
+            fprintf(stderr, "Failed to allocate %zu bytes\n", sizes[slot]);
+            exit(EXIT_FAILURE);
+        }
+        memset(bufs[slot], (int)i, sizes[slot]);
+    }
+    for (unsigned i = 0; i < n_live; i++) {
+        variant->release(bufs[i], sizes[i]);
+    }
+    free(bufs);
+    free(sizes);
+    return NULL;
+}
+
+static int run_variant(void) {
+    pthread_t *threads = calloc(n_threads, sizeof(*threads));
+    uint64_t start = qrng_now_usec();
+
+    for (unsigned i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, worker, (void *)(uintptr_t)(i + 1));
+    }
+    for (unsigned i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    uint64_t usec = qrng_now_usec() - start;
+    free(threads);
+
+    printf("%-10s %10.1f ns/op", variant->name, usec * 1000.0 / (n_ops * n_threads));
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"threads",  required_argument, 0, 't'},
+        {"ops",      required_argument, 0, 'n'},
+        {"live",     required_argument, 0, 'l'},
+        {"max-size", required_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "t:n:l:s:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 't':
+                n_threads = (unsigned)atoi(optarg);
+                break;
+            case 'n':
+                n_ops = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                n_live = (unsigned)atoi(optarg);
+                break;
+            case 's':
+                max_size = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--threads N] [--ops N] [--live N] [--max-size BYTES]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (n_threads == 0 || n_ops == 0 || n_live == 0 || max_size < 64) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%u threads, %lu ops each, %u live buffers per thread, sizes 32 B to %zu B\n",
+           n_threads, n_ops, n_live, max_size);
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        struct rusage usage;
+        int status;
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (pid == 0) {
+            variant = &variants[i];
+            _exit(run_variant() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s run failed\n", variants[i].name);
+            return EXIT_FAILURE;
+        }
+        printf(", peak RSS %.1f MiB, %ld minor faults\n", usage.ru_maxrss / 1024.0,
+               usage.ru_minflt);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,29 @@
+#! /bin/bash
+#
+# Requests per second and bus messages per request for small requests,
+# sent as single ReadBytes calls and as ReadBytesBatch calls of several
+# sizes, with the same number of requests in flight. Needs
+# bin/sd-bus-client and a service with ReadBytesBatch (e.g. bin/mock-service)
+# on the user bus.
+#
+# Usage: bench/batch-bench.sh [REQUESTS] [CONCURRENT]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+REQUESTS=${1:-20000}
+CONCURRENT=${2:-64}
+
+printf "%8s %6s %12s %12s %14s\n" bytes batch "requests/s" "MiB/s" "messages/KiB"
+for bytes in 16 64 256 1024; do
+    for batch in 1 8 64; do
+        # A long --interval gives one report for the whole run
+        out=$($CLIENT -n $REQUESTS -b $bytes -c $CONCURRENT --batch $batch --interval 3600 -q) || exit 1
+        rate=$(echo "$out" | sed -n 's/.* \([0-9.]*\) calls\/s.*/\1/p')
+        calls=$(echo "$out" | sed -n 's/^Batching: \([0-9]*\) bus calls.*/\1/p')
+        calls=${calls:-$REQUESTS}
+        # Every bus call is a method call and a reply
+        awk -v b=$bytes -v k=$batch -v r=$rate -v c=$calls -v n=$REQUESTS 'BEGIN {
+            printf "%8d %6d %12.0f %12.2f %14.3f\n", b, k, r, r * b / 1048576, 2 * c / (n * b / 1024)
+        }'
+    done
+done
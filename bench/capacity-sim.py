@@ -0,0 +1,244 @@
+#! /usr/bin/env python3
+#
+# Capacity model for the ReadBytes path, calibrated from traces written by
+# `sd-bus-client --trace PATH`. A trace file holds one or more runs, each a
+# "# bytes=B concurrent=C connections=K" line followed by one
+# "issue_usec,reply_usec,bytes,status" record per call.
+#
+# The path (client, broker, service) is modelled as a closed queueing
+# network: every call spends a delay Z that overlaps with other calls
+# (marshalling, socket hops, the client's own dispatch) and a service time
+# S at a single FIFO station that calls queue for (the broker and the
+# service, which each handle one message at a time). Both come from
+# measurements rather than fitted curves:
+#
+#   mean S  mean gap between replies of the most concurrent run, where the
+#           station never idles, so replies leave it back to back
+#   Z + S   round trips of the least concurrent run, where nothing queues;
+#           each is split into Z and S in the ratio of the means, so the
+#           simulated calls keep the measured spread
+#
+# (The reply gaps themselves are not used as S: the client reads replies
+# in batches, so they alternate between near zero and several calls' worth.)
+#
+# A discrete-event simulation then plays clients x window calls in flight
+# (optionally with think time between a client's calls, a faster or slower
+# service, or open-loop Poisson arrivals) and reports throughput and
+# latency percentiles for each configuration.
+#
+# Usage:
+#   bench/capacity-sim.py TRACE [options]
+#     --clients LIST      Clients to predict for (default: 1,2,4,8,16,32,64)
+#     --window LIST       Calls in flight per client (default: 1)
+#     --think-ms MS       Pause between a client's reply and its next call
+#     --service-scale F   Multiply S by F (0.5 = a service twice as fast)
+#     --rate LIST         Open-loop arrival rates in calls/s instead of clients
+#     --validate          Predict every run in TRACE and compare with it
+#     --calls N           Calls simulated per configuration (default: 50000)
+#
+# LIST is comma-separated. Runs of different sizes are not mixed: S and Z
+# come from the runs with the size of the first run.
+
+import argparse
+import heapq
+import random
+import sys
+
+
+class Run:
+    def __init__(self, header):
+        self.config = dict(kv.split("=", 1) for kv in header.lstrip("#").split())
+        self.bytes = int(self.config.get("bytes", 0))
+        self.concurrent = int(self.config.get("concurrent", 1))
+        self.calls = []  # (issue_usec, reply_usec), successful calls only
+
+    def measured(self):
+        # Throughput over the span of the run, latency percentiles per call
+        calls = self.calls
+        span = max(r for _, r in calls) - min(i for i, _ in calls)
+        lat = sorted(r - i for i, r in calls)
+        return len(calls) / (span / 1e6), percentile(lat, 50), percentile(lat, 99)
+
+
+def load_runs(path):
+    runs = []
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            if line.startswith("#"):
+                runs.append(Run(line))
+                continue
+            if not runs:
+                raise SystemExit(f"{path}: records before the first run header")
+            issue, reply, _, status = line.split(",")
+            if int(status) == 0:
+                runs[-1].calls.append((int(issue), int(reply)))
+    return [r for r in runs if len(r.calls) >= 2]
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(len(sorted_values) * p / 100))
+    return sorted_values[k]
+
+
+def calibrate(runs):
+    size = runs[0].bytes
+    same = sorted((r for r in runs if r.bytes == size), key=lambda r: r.concurrent)
+    low, high = same[0], same[-1]
+    if high.concurrent < 4:
+        raise SystemExit("need a run with at least 4 calls in flight to measure the service time")
+
+    # Skip the ramp-up, where the station may still idle between replies
+    replies = sorted(r for _, r in high.calls)
+    replies = replies[len(replies) // 10:]
+    mean_s = (replies[-1] - replies[0]) / (len(replies) - 1)
+
+    # A station that still idles at the highest concurrency shows as calls/s
+    # that keep growing with it; the estimate of S is then an upper bound
+    if len(same) >= 2 and high.measured()[0] > 1.2 * same[-2].measured()[0]:
+        print(f"Warning: -c {high.concurrent} may not saturate the service "
+              f"(calls/s still rising); max calls/s is a lower bound", file=sys.stderr)
+
+    rtt = [r - i for i, r in low.calls]
+    share = min(1.0, mean_s / (sum(rtt) / len(rtt)))
+    return {
+        "bytes": size,
+        "service": [x * share for x in rtt],
+        "delay": [x * (1 - share) for x in rtt],
+        "mean_s": mean_s,
+        "mean_z": sum(rtt) / len(rtt) * (1 - share),
+        "low": low.concurrent,
+        "high": high.concurrent,
+    }
+
+
+def simulate_closed(model, clients, window, think_usec, scale, calls, rng):
+    # One token per call slot; a token cycles issue -> delay/2 -> station ->
+    # delay/2 -> reply -> think -> issue. The station serves in FIFO order.
+    # S and Z are drawn from the same measured call, keeping them correlated.
+    service, delay = model["service"], model["delay"]
+    events = []
+    seq = 0
+    for c in range(clients):
+        for _ in range(window):
+            # Stagger clients slightly so they do not start in lockstep
+            heapq.heappush(events, (rng.random(), seq, "issue", 0.0))
+            seq += 1
+    station_free = 0.0
+    latencies = []
+    done = 0
+    first = None
+    last = 0.0
+    warmup = calls // 10
+
+    while done < calls + warmup:
+        t, _, phase, issued = heapq.heappop(events)
+        if phase == "issue":
+            k = rng.randrange(len(delay))
+            heapq.heappush(events, (t + delay[k] / 2, seq, "arrive", (t, k)))
+            seq += 1
+        elif phase == "arrive":
+            issued, k = issued
+            start = max(t, station_free)
+            station_free = start + service[k] * scale
+            heapq.heappush(events, (station_free + delay[k] / 2, seq, "reply", issued))
+            seq += 1
+        else:
+            done += 1
+            if done == warmup:
+                first = t
+            elif done > warmup:
+                latencies.append(t - issued)
+                last = t
+            heapq.heappush(events, (t + think_usec, seq, "issue", 0.0))
+            seq += 1
+    latencies.sort()
+    return calls / ((last - first) / 1e6), percentile(latencies, 50), percentile(latencies, 99)
+
+
+def simulate_open(model, rate, scale, calls, rng):
+    # Poisson arrivals with no window; the station queue grows without bound
+    # once rate exceeds 1/S, which shows as a latency that keeps rising.
+    service, delay = model["service"], model["delay"]
+    t = 0.0
+    station_free = 0.0
+    latencies = []
+    replies = []
+    for _ in range(calls):
+        t += rng.expovariate(rate / 1e6)
+        k = rng.randrange(len(delay))
+        start = max(t + delay[k] / 2, station_free)
+        station_free = start + service[k] * scale
+        reply = station_free + delay[k] / 2
+        latencies.append(reply - t)
+        replies.append(reply)
+    skip = calls // 10
+    lat = sorted(latencies[skip:])
+    span = max(replies) - sorted(replies)[skip]
+    return (calls - skip) / (span / 1e6), percentile(lat, 50), percentile(lat, 99)
+
+
+def int_list(s):
+    return [int(x) for x in s.split(",") if x]
+
+
+def float_list(s):
+    return [float(x) for x in s.split(",") if x]
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Predict throughput and latency from measured traces.")
+    ap.add_argument("trace")
+    ap.add_argument("--clients", type=int_list, default=[1, 2, 4, 8, 16, 32, 64])
+    ap.add_argument("--window", type=int_list, default=[1])
+    ap.add_argument("--think-ms", type=float, default=0.0)
+    ap.add_argument("--service-scale", type=float, default=1.0)
+    ap.add_argument("--rate", type=float_list, default=[])
+    ap.add_argument("--validate", action="store_true")
+    ap.add_argument("--calls", type=int, default=50000)
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    runs = load_runs(args.trace)
+    if not runs:
+        raise SystemExit(f"{args.trace}: no runs with at least two successful calls")
+    model = calibrate(runs)
+    rng = random.Random(args.seed)
+    size = model["bytes"]
+    mib = size / (1024 * 1024)
+
+    print(f"Model: {size} bytes per call; station {model['mean_s']:.1f} us/call "
+          f"({1e6 / model['mean_s']:.0f} calls/s max, from -c {model['high']}), "
+          f"delay {model['mean_z']:.1f} us (from -c {model['low']})")
+
+    if args.validate:
+        print(f"{'in flight':>9} {'measured':>10} {'predicted':>10} {'err':>6}   "
+              f"{'p50 ms':>7} {'pred':>7}   {'p99 ms':>7} {'pred':>7}")
+        for run in sorted((r for r in runs if r.bytes == size), key=lambda r: r.concurrent):
+            x, p50, p99 = run.measured()
+            px, pp50, pp99 = simulate_closed(model, run.concurrent, 1, 0.0, 1.0, args.calls, rng)
+            print(f"{run.concurrent:>9} {x:>10.0f} {px:>10.0f} {100 * (px - x) / x:>+5.0f}%   "
+                  f"{p50 / 1000:>7.3f} {pp50 / 1000:>7.3f}   {p99 / 1000:>7.3f} {pp99 / 1000:>7.3f}")
+        return
+
+    if args.rate:
+        print(f"{'calls/s in':>10} {'calls/s':>10} {'MiB/s':>8} {'p50 ms':>8} {'p99 ms':>8}")
+        for rate in args.rate:
+            x, p50, p99 = simulate_open(model, rate, args.service_scale, args.calls, rng)
+            print(f"{rate:>10.0f} {x:>10.0f} {x * mib:>8.1f} {p50 / 1000:>8.3f} {p99 / 1000:>8.3f}")
+        return
+
+    print(f"{'clients':>7} {'window':>6} {'calls/s':>10} {'MiB/s':>8} {'p50 ms':>8} {'p99 ms':>8}")
+    for clients in args.clients:
+        for window in args.window:
+            x, p50, p99 = simulate_closed(model, clients, window, args.think_ms * 1000,
+                                          args.service_scale, args.calls, rng)
+            print(f"{clients:>7} {window:>6} {x:>10.0f} {x * mib:>8.1f} {p50 / 1000:>8.3f} {p99 / 1000:>8.3f}")
+
+
+if __name__ == "__main__":
+    sys.exit(main())
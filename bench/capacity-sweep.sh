@@ -0,0 +1,25 @@
+#! /bin/bash
+#
+# Traces a concurrency sweep against the service, then checks the capacity
+# model (bench/capacity-sim.py) against it: the model is calibrated from
+# the lowest and highest concurrency runs and predicts all of them. Needs
+# bin/sd-bus-client and a running RNG service (or bin/mock-service, e.g.
+# with --delay) on the user bus.
+#
+# Usage: bench/capacity-sweep.sh [BYTES] [CALLS] [CONCURRENCY...]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+BYTES=${1:-1024}
+CALLS=${2:-5000}
+shift 2 2> /dev/null
+LEVELS=${@:-1 2 4 8 16 32 64}
+TRACE=${TRACE:-$(mktemp /tmp/qrng-trace.XXXXXX)}
+
+: > $TRACE
+for c in $LEVELS; do
+    $CLIENT -n $CALLS -b $BYTES -c $c -q --trace $TRACE || exit 1
+done
+
+echo "Trace: $TRACE"
+$SCRIPT_DIR/capacity-sim.py $TRACE --validate
@@ -0,0 +1,25 @@
+#! /bin/bash
+#
+# Parallel verification of a container: writes one with --write-file
+# --container (or reuses PATH if it exists), then checks it with 1, 2, 4,
+# ... threads up to the CPU count. The first pass also pulls the file into
+# the page cache, so later passes measure checksumming rather than the
+# disk. Needs bin/sd-bus-client and a running RNG service for the write.
+#
+# Usage: bench/container-bench.sh [PATH] [MIB]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+FILE=${1:-/tmp/qrng-container.bin}
+MIB=${2:-1024}
+
+if [ ! -e $FILE ]; then
+    $CLIENT -q -n $MIB -b 1048576 -c 4 --write-file $FILE --container || exit 1
+fi
+
+$CLIENT -q --verify-file $FILE -c 1 > /dev/null || exit 1
+threads=1
+while [ $threads -le $(nproc) ]; do
+    $CLIENT -q --verify-file $FILE -c $threads || exit 1
+    threads=$((threads * 2))
+done
@@ -0,0 +1,118 @@
+// Footprint of client builds: binary size, startup time (median wall time
+// of `BINARY --help`, which covers exec, dynamic linking and option
+// parsing) and peak RSS and minor faults of one workload run. Each
+// binary's runs are separate child processes, measured with wait4.
+//
+// Build: gcc bench/footprint.c -o bin/footprint
+// Usage: bin/footprint [-r RUNS] BINARY... -- WORKLOAD_ARGS...
+//   e.g. bin/footprint bin/sd-bus-client bin/sd-bus-client-mini -- -n 1000 -c 16 -q
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ARGS 64
+
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Runs argv with stdout and stderr on /dev/null; returns the wall time in
+// microseconds, or 0 if it did not exit with status 0
+static uint64_t run(char **argv, struct rusage *usage) {
+    uint64_t start = now_usec();
+    int status;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return 0;
+    }
+    return now_usec() - start;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 50;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        runs = atoi(argv[2]);
+        first = 3;
+    }
+    int sep = first;
+    while (sep < argc && strcmp(argv[sep], "--") != 0) {
+        sep++;
+    }
+    if (sep == first || runs <= 0 || argc - sep > MAX_ARGS) {
+        fprintf(stderr, "Usage: %s [-r RUNS] BINARY... -- WORKLOAD_ARGS...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t *times = calloc(runs, sizeof(*times));
+    if (!times) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-28s %10s %12s %12s %12s %12s\n",
+           "binary", "size KiB", "startup ms", "workload ms", "max RSS KiB", "minor faults");
+    for (int b = first; b < sep; b++) {
+        struct stat st;
+        struct rusage usage;
+        char *help_argv[] = { argv[b], "--help", NULL };
+        char *work_argv[MAX_ARGS + 2] = { argv[b] };
+
+        if (stat(argv[b], &st) < 0) {
+            perror(argv[b]);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < runs; i++) {
+            times[i] = run(help_argv, &usage);
+            if (times[i] == 0) {
+                fprintf(stderr, "%s --help failed\n", argv[b]);
+                return EXIT_FAILURE;
+            }
+        }
+        qsort(times, runs, sizeof(*times), compare_u64);
+
+        for (int i = sep + 1; i < argc; i++) {
+            work_argv[i - sep] = argv[i];
+        }
+        uint64_t work = run(work_argv, &usage);
+        if (work == 0) {
+            fprintf(stderr, "%s: workload failed\n", argv[b]);
+            return EXIT_FAILURE;
+        }
+
+        printf("%-28s %10.1f %12.3f %12.1f %12ld %12ld\n", argv[b], st.st_size / 1024.0,
+               times[runs / 2] / 1000.0, work / 1000.0, usage.ru_maxrss, usage.ru_minflt);
+    }
+    free(times);
+    return EXIT_SUCCESS;
+}
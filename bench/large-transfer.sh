@@ -0,0 +1,21 @@
+#! /bin/bash
+#
+# Large-transfer throughput with different socket receive buffers: the
+# kernel default sd-bus picks, a small fixed buffer, and auto-sizing to the
+# reply. Each run moves about TOTAL_BYTES; the Transport line shows the
+# buffer in effect, queue depths and wakeups per call. Needs
+# bin/sd-bus-client and a running RNG service (bin/mock-service will do).
+#
+# Usage: bench/large-transfer.sh [TOTAL_BYTES] [CONCURRENT]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+TOTAL=${1:-1073741824}
+CONCURRENT=${2:-4}
+
+for bytes in 1048576 8388608 33554432; do
+    for rcvbuf in 262144 -1 0; do
+        echo "== $bytes bytes per call, --rcvbuf $rcvbuf"
+        $CLIENT -q -n $((TOTAL / bytes)) -b $bytes -c $CONCURRENT --rcvbuf $rcvbuf --interval 3600
+    done
+done
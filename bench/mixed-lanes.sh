@@ -0,0 +1,38 @@
+#! /bin/bash
+#
+# Small-request latency under a concurrent bulk stream, with and without
+# chunking and lane separation in daemon mode. Needs bin/sd-bus-client and a
+# running RNG service on the user bus.
+#
+# Usage: bench/mixed-lanes.sh [BULK_BYTES] [SMALL_REQUESTS]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+BULK_BYTES=${1:-67108864}
+SMALL_REQUESTS=${2:-2000}
+SOCKET=$(mktemp -u /tmp/qrng-bench.XXXXXX)
+
+run() {
+    local label=$1
+    shift
+
+    $CLIENT --daemon $SOCKET -q -c 4 --max-request $BULK_BYTES "$@" > /dev/null &
+    local daemon_pid=$!
+    sleep 0.5
+
+    # Keep a bulk transfer in flight for the whole small-request run
+    $CLIENT --connect $SOCKET -n 1000 -b $BULK_BYTES -c 2 -q > /dev/null 2>&1 &
+    local bulk_pid=$!
+    sleep 0.5
+
+    echo "== $label"
+    $CLIENT --connect $SOCKET -n $SMALL_REQUESTS -b 32 -c 1 -q | tail -n 1
+
+    kill $bulk_pid 2> /dev/null
+    kill -INT $daemon_pid
+    wait $daemon_pid 2> /dev/null
+}
+
+run "one lane, unchunked" --small-threshold 0 --quantum $BULK_BYTES
+run "one lane, 64 KiB chunks" --small-threshold 0 --quantum 65536
+run "small/bulk lanes, 64 KiB chunks" --small-threshold 4096 --quantum 65536
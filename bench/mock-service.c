@@ -0,0 +1,308 @@
+// Stand-in for the RNG service, for benchmarks and failure tests without
+// the real hardware. Serves ReadBytes on the user bus with the real
+// service's name, path and signature, but the bytes come from a fast PRNG
+// and are NOT random. It also serves the optional ReadBytesBatch method
+// (one block per requested length), unless started with --no-batch.
+//
+// --delay MS holds every reply for MS milliseconds, so calls are in flight
+// when the service is killed. --slow-delay MS holds the replies to the
+// first connection that calls for MS instead, to stand in for one slow path;
+// once that connection goes away the next caller takes its place.
+//
+// Build: gcc bench/mock-service.c -o bin/mock-service $(pkg-config --cflags --libs libsystemd)
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <systemd/sd-bus.h>
+#include <time.h>
+
+#include "../qrng.h"
+
+typedef struct pending_reply {
+    sd_bus_message *reply;
+    uint64_t due_usec;
+    struct pending_reply *next;
+} pending_reply_t;
+
+#define MAX_BATCH 65536
+
+static uint64_t state;
+static uint64_t delay_usec;
+static uint64_t slow_delay_usec;
+static char slow_sender[256];     // Unique name of the first caller, "" until one calls
+static int no_batch;
+static pending_reply_t *pending_head;
+static pending_reply_t *pending_tail;
+
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t next_u64(void) {
+    // splitmix64
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void fill(uint8_t *p, uint64_t len) {
+    for (uint64_t i = 0; i < len; i += 8) {
+        uint64_t v = next_u64();
+        memcpy(p + i, &v, len - i < 8 ? len - i : 8);
+    }
+}
+
+static int slow_sender_gone(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *name, *old_owner, *new_owner;
+
+    (void)userdata;
+    (void)ret_error;
+    if (sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner) >= 0 &&
+        strcmp(name, slow_sender) == 0 && new_owner[0] == '\0') {
+        slow_sender[0] = '\0';
+    }
+    return 0;
+}
+
+static uint64_t reply_delay(sd_bus_message *call) {
+    const char *sender = sd_bus_message_get_sender(call);
+
+    if (slow_delay_usec == 0 || !sender) {
+        return delay_usec;
+    }
+    if (slow_sender[0] == '\0') {
+        snprintf(slow_sender, sizeof(slow_sender), "%s", sender);
+    }
+    return strcmp(sender, slow_sender) == 0 ? slow_delay_usec : delay_usec;
+}
+
+// Send the reply to call now, or after --delay / --slow-delay
+static int send_reply(sd_bus_message *call, sd_bus_message *reply) {
+    uint64_t delay = reply_delay(call);
+    if (delay == 0) {
+        return sd_bus_send(NULL, reply, NULL);
+    }
+
+    pending_reply_t *pr = malloc(sizeof(*pr));
+    if (!pr) {
+        return -ENOMEM;
+    }
+    pr->reply = sd_bus_message_ref(reply);
+    pr->due_usec = now_usec() + delay;
+    pr->next = NULL;
+
+    // With one delay replies are due in arrival order and always go at the
+    // tail; a second delay needs the list kept sorted
+    if (!pending_tail || pending_tail->due_usec <= pr->due_usec) {
+        if (pending_tail) {
+            pending_tail->next = pr;
+        } else {
+            pending_head = pr;
+        }
+        pending_tail = pr;
+        return 1;
+    }
+    pending_reply_t **link = &pending_head;
+    while ((*link)->due_usec <= pr->due_usec) {
+        link = &(*link)->next;
+    }
+    pr->next = *link;
+    *link = pr;
+    return 1;
+}
+
+static int method_read_bytes(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    uint64_t len, timeout_ms;
+    uint8_t *p;
+    int ret;
+
+    (void)userdata;
+    (void)ret_error;
+
+    ret = sd_bus_message_read(m, "tt", &len, &timeout_ms);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sd_bus_message_new_method_return(m, &reply);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = sd_bus_message_append(reply, "i", 0);
+    if (ret >= 0) {
+        ret = sd_bus_message_append_array_space(reply, 'y', len, (void **)&p);
+    }
+    if (ret >= 0) {
+        fill(p, len);
+        ret = send_reply(m, reply);
+    }
+    sd_bus_message_unref(reply);
+    return ret;
+}
+
+static int method_read_bytes_batch(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    const uint64_t *lengths;
+    size_t size;
+    uint64_t timeout_ms;
+    uint8_t *p;
+    int ret;
+
+    (void)userdata;
+
+    ret = sd_bus_message_read_array(m, 't', (const void **)&lengths, &size);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = sd_bus_message_read(m, "t", &timeout_ms);
+    if (ret < 0) {
+        return ret;
+    }
+    size_t n = size / sizeof(uint64_t);
+    if (n > MAX_BATCH) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS,
+                                 "At most %d blocks per call", MAX_BATCH);
+    }
+
+    ret = sd_bus_message_new_method_return(m, &reply);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = sd_bus_message_append(reply, "i", 0);
+    if (ret >= 0) {
+        ret = sd_bus_message_open_container(reply, 'a', "ay");
+    }
+    for (size_t i = 0; ret >= 0 && i < n; i++) {
+        ret = sd_bus_message_append_array_space(reply, 'y', lengths[i], (void **)&p);
+        if (ret >= 0) {
+            fill(p, lengths[i]);
+        }
+    }
+    if (ret >= 0) {
+        ret = sd_bus_message_close_container(reply);
+    }
+    if (ret >= 0) {
+        ret = send_reply(m, reply);
+    }
+    sd_bus_message_unref(reply);
+    return ret;
+}
+
+// Send delayed replies that are due; returns how long until the next one
+static uint64_t send_due_replies(sd_bus *bus) {
+    uint64_t now = now_usec();
+
+    while (pending_head && pending_head->due_usec <= now) {
+        pending_reply_t *pr = pending_head;
+        pending_head = pr->next;
+        if (!pending_head) {
+            pending_tail = NULL;
+        }
+        sd_bus_send(bus, pr->reply, NULL);
+        sd_bus_message_unref(pr->reply);
+        free(pr);
+    }
+    return pending_head ? pending_head->due_usec - now : (uint64_t)-1;
+}
+
+static const sd_bus_vtable rng_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("ReadBytes", "tt", "iay", method_read_bytes, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("ReadBytesBatch", "att", "iaay", method_read_bytes_batch, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+// What a service without the batched method looks like
+static const sd_bus_vtable rng_vtable_single[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("ReadBytes", "tt", "iay", method_read_bytes, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"delay", required_argument, 0, 'd'},
+        {"no-batch", no_argument, 0, 'B'},
+        {"slow-delay", required_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
+    sd_bus *bus = NULL;
+    int ret;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "d:Bs:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'd':
+                delay_usec = strtoull(optarg, NULL, 10) * 1000;
+                break;
+            case 'B':
+                no_batch = 1;
+                break;
+            case 's':
+                slow_delay_usec = strtoull(optarg, NULL, 10) * 1000;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--delay MS] [--slow-delay MS] [--no-batch]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    state = (uint64_t)time(NULL);
+
+    ret = sd_bus_open_user(&bus);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to user bus: %s\n", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    ret = sd_bus_add_object_vtable(bus, NULL, QRNG_OBJECT_PATH, QRNG_INTERFACE,
+                                   no_batch ? rng_vtable_single : rng_vtable, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to add object: %s\n", strerror(-ret));
+        goto out;
+    }
+
+    if (slow_delay_usec > 0) {
+        ret = sd_bus_match_signal(bus, NULL, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                  "org.freedesktop.DBus", "NameOwnerChanged", slow_sender_gone,
+                                  NULL);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to watch callers: %s\n", strerror(-ret));
+            goto out;
+        }
+    }
+
+    ret = sd_bus_request_name(bus, QRNG_SERVICE, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to acquire service name: %s\n", strerror(-ret));
+        goto out;
+    }
+
+    for (;;) {
+        ret = sd_bus_process(bus, NULL);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to process bus: %s\n", strerror(-ret));
+            break;
+        }
+        if (ret > 0) {
+            continue;
+        }
+        ret = sd_bus_wait(bus, send_due_replies(bus));
+        if (ret < 0 && ret != -EINTR) {
+            fprintf(stderr, "Failed to wait on bus: %s\n", strerror(-ret));
+            break;
+        }
+    }
+
+out:
+    sd_bus_flush_close_unref(bus);
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#! /usr/bin/env python3
+#
+# Arrays per second filled through the Python binding (python/qrngmodule.c)
+# versus running the CLI and parsing the hex that print_octets writes, for
+# a few array sizes. Needs NumPy, the built extension on PYTHONPATH (e.g.
+# python/ after `python3 setup.py build_ext --inplace`), bin/sd-bus-client
+# and the service (or bin/mock-service) on the user bus.
+#
+# Usage: bench/numpy-bench.py [SECONDS_PER_CASE]
+
+import os
+import subprocess
+import sys
+import time
+
+import numpy as np
+import qrng
+
+CLIENT = os.environ.get(
+    "CLIENT", os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "bin", "sd-bus-client")
+)
+SECONDS = float(sys.argv[1]) if len(sys.argv) > 1 else 2.0
+SIZES = [1024, 64 * 1024, 1024 * 1024]
+
+
+def cli_fill(n):
+    out = subprocess.run([CLIENT, "-n", "1", "-b", str(n)], capture_output=True, text=True, check=True)
+    for line in out.stdout.splitlines():
+        if line.startswith("Generated Octets"):
+            return np.frombuffer(bytes.fromhex(line.split(": ", 1)[1]), dtype=np.uint8)
+    raise RuntimeError("no octets in client output")
+
+
+def binding_bytes(n):
+    a = np.empty(n, dtype=np.uint8)
+    qrng.fill_bytes(a)
+    return a
+
+
+def binding_floats(n):
+    a = np.empty(n // 8, dtype=np.float64)
+    qrng.fill_floats(a)
+    return a
+
+
+def binding_integers(n):
+    a = np.empty(n // 4, dtype=np.int32)
+    qrng.fill_integers(a, 0, 6)
+    return a
+
+
+def rate(fill, n):
+    count = 0
+    start = time.monotonic()
+    while time.monotonic() - start < SECONDS:
+        fill(n)
+        count += 1
+    return count / (time.monotonic() - start)
+
+
+print(f"{'bytes':>9} {'CLI + hex':>12} {'fill_bytes':>12} {'fill_floats':>12} {'fill_integers':>14}  (arrays/s)")
+for n in SIZES:
+    cli = rate(cli_fill, n)
+    row = [rate(f, n) for f in (binding_bytes, binding_floats, binding_integers)]
+    print(f"{n:>9} {cli:>12.1f} {row[0]:>12.1f} {row[1]:>12.1f} {row[2]:>14.1f}  ({row[0] / cli:.0f}x)")
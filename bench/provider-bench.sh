@@ -0,0 +1,66 @@
+#! /bin/bash
+#
+# Compare TLS handshakes/sec and RAND throughput with OpenSSL's default DRBG
+# against the QRNG provider. Needs bin/qrng-provider.so (see install.sh) and
+# a running RNG service on the user bus.
+#
+# Usage: bench/provider-bench.sh [SECONDS]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+ROOT_DIR=$(dirname $SCRIPT_DIR)
+SECONDS_PER_RUN=${1:-10}
+PORT=${PORT:-14433}
+
+WORK_DIR=$(mktemp -d)
+trap 'kill $SERVER_PID 2>/dev/null; rm -rf $WORK_DIR' EXIT
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+    -keyout $WORK_DIR/key.pem -out $WORK_DIR/cert.pem -days 1 -subj /CN=localhost \
+    2> /dev/null || exit 1
+
+cat > $WORK_DIR/qrng.cnf <<CNF
+openssl_conf = openssl_init
+
+[openssl_init]
+providers = provider_sect
+random = random_sect
+
+[provider_sect]
+default = default_sect
+qrng = qrng_sect
+
+[default_sect]
+activate = 1
+
+[qrng_sect]
+module = $ROOT_DIR/bin/qrng-provider.so
+activate = 1
+pool_bytes = 4194304
+refill_bytes = 1048576
+cache_bytes = 4096
+
+[random_sect]
+random = QRNG
+random_properties = provider=qrng
+CNF
+
+run() {
+    local label=$1
+    local conf=$2
+
+    echo "== $label"
+    OPENSSL_CONF=$conf openssl speed -seconds $SECONDS_PER_RUN rand 2> /dev/null | tail -n 2
+
+    OPENSSL_CONF=$conf openssl s_server -quiet -accept $PORT -www \
+        -cert $WORK_DIR/cert.pem -key $WORK_DIR/key.pem > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+    # Both ends draw randomness, so both run with the same configuration
+    OPENSSL_CONF=$conf openssl s_time -connect localhost:$PORT -new \
+        -time $SECONDS_PER_RUN 2> /dev/null | grep "connections/user sec"
+    kill $SERVER_PID
+    wait $SERVER_PID 2> /dev/null
+}
+
+run "default DRBG" /dev/null
+run "QRNG provider" $WORK_DIR/qrng.cnf
@@ -0,0 +1,66 @@
+#! /bin/bash
+#
+# Small-request latency and upstream call rate with and without the caching
+# proxy. Starts a private dbus-daemon, runs `sd-bus-client --proxy` on it
+# under the service's own name with the user bus as upstream, and sends the
+# same loads straight to the service and through the proxy. Needs
+# dbus-daemon, bin/sd-bus-client and the service (e.g. bin/mock-service
+# --delay 1) on the user bus.
+#
+# Usage: bench/proxy-bench.sh [REQUESTS] [BYTES]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+REQUESTS=${1:-5000}
+BYTES=${2:-32}
+UPSTREAM=${DBUS_SESSION_BUS_ADDRESS:-unix:path=$XDG_RUNTIME_DIR/bus}
+DIR=$(mktemp -d /tmp/qrng-proxy.XXXXXX)
+
+cat > $DIR/bus.conf << EOF
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>session</type>
+  <listen>unix:path=$DIR/bus</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+    <allow own="*"/>
+  </policy>
+</busconfig>
+EOF
+
+dbus-daemon --config-file=$DIR/bus.conf --fork --print-pid=3 3> $DIR/pid || exit 1
+trap 'kill $PROXY_PID $(cat $DIR/pid) 2> /dev/null; rm -rf $DIR' EXIT
+PROXIED=unix:path=$DIR/bus
+sleep 0.2
+
+run() {
+    local label=$1
+    shift
+    # A long --interval gives one report for the whole run
+    $CLIENT -q --interval 3600 "$@" | grep '^\[' | awk -v l="$label" '{
+        for (i = 1; i <= NF; i++) {
+            if ($i == "calls/s,") calls = $(i - 1)
+            if ($i == "p50") p50 = $(i + 1)
+            if ($i == "p99") p99 = $(i + 1)
+        }
+        printf "%-22s %10.0f %9s %9s", l, calls, p50, p99
+    }'
+}
+
+printf "%-22s %10s %9s %9s %16s\n" "" "calls/s" "p50 ms" "p99 ms" "upstream calls"
+for c in 1 16; do
+    run "direct    -c $c" --address $UPSTREAM -n $REQUESTS -b $BYTES -c $c
+    printf " %16d\n" $REQUESTS
+
+    DBUS_SESSION_BUS_ADDRESS=$PROXIED $CLIENT -q --proxy lv.lumii.trng --address $UPSTREAM \
+        > $DIR/proxy.log &
+    PROXY_PID=$!
+    sleep 0.3
+    run "proxied   -c $c" --address $PROXIED -n $REQUESTS -b $BYTES -c $c
+    kill -INT $PROXY_PID
+    wait $PROXY_PID
+    printf " %16s\n" $(sed -n 's/^  upstream: \([0-9]*\) calls.*/\1/p' $DIR/proxy.log)
+done
@@ -0,0 +1,129 @@
+// Scatter-read benchmark: fills a set of separately allocated segments
+// (a caller's own arrays) from the RNG service, once through qrng_read
+// into a bounce buffer followed by a copy into the segments, and once with
+// qrng_readv straight into them. Prints throughput and user-space copies
+// per delivered byte for each. Run it against bin/mock-service to measure
+// the client rather than the hardware.
+//
+// Build: gcc -O2 bench/readv-bench.c qrng.c -o bin/readv-bench -pthread $(pkg-config --cflags --libs libsystemd)
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "../qrng.h"
+
+static size_t call_size = 1024 * 1024;
+static int n_segments = 16;
+static unsigned n_calls = 500;
+
+static int run_copy(sd_bus *bus, struct iovec *iov, uint8_t *bounce, uint64_t *copied) {
+    int ret = qrng_read(bus, bounce, call_size, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    const uint8_t *src = bounce;
+    for (int i = 0; i < n_segments; i++) {
+        memcpy(iov[i].iov_base, src, iov[i].iov_len);
+        src += iov[i].iov_len;
+    }
+    explicit_bzero(bounce, call_size);
+    *copied += call_size;
+    return 0;
+}
+
+static int run_readv(sd_bus *bus, struct iovec *iov, uint8_t *bounce, uint64_t *copied) {
+    (void)bounce;
+    (void)copied;
+    return qrng_readv(bus, iov, n_segments, 0);
+}
+
+static int measure(const char *name, sd_bus *bus, struct iovec *iov, uint8_t *bounce,
+                   int (*fill)(sd_bus *, struct iovec *, uint8_t *, uint64_t *)) {
+    uint64_t copied = 0;
+    uint64_t lib_copied = qrng_bytes_copied();
+    uint64_t start = qrng_now_usec();
+
+    for (unsigned i = 0; i < n_calls; i++) {
+        int ret = fill(bus, iov, bounce, &copied);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to read from RNG service: %s\n", strerror(-ret));
+            return ret;
+        }
+    }
+
+    uint64_t usec = qrng_now_usec() - start;
+    uint64_t delivered = (uint64_t)n_calls * call_size;
+    copied += qrng_bytes_copied() - lib_copied;
+    printf("%-6s %8.3f GB/s, %.2f copies per byte\n", name,
+           usec > 0 ? delivered / (usec * 1e3) : 0.0, (double)copied / delivered);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"size",     required_argument, 0, 'b'},
+        {"segments", required_argument, 0, 's'},
+        {"calls",    required_argument, 0, 'n'},
+        {0, 0, 0, 0}
+    };
+    sd_bus *bus = NULL;
+    int ret;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "b:s:n:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'b':
+                call_size = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                n_segments = atoi(optarg);
+                break;
+            case 'n':
+                n_calls = (unsigned)atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--size BYTES] [--segments N] [--calls N]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (n_segments <= 0 || n_calls == 0 || call_size < (size_t)n_segments) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    ret = sd_bus_open_user(&bus);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to user bus: %s\n", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    // Segments of uneven size, each its own allocation
+    struct iovec *iov = calloc(n_segments, sizeof(*iov));
+    uint8_t *bounce = malloc(call_size);
+    size_t left = call_size;
+    for (int i = 0; i < n_segments; i++) {
+        size_t len = i == n_segments - 1 ? left : left / (n_segments - i) + (i % 2 ? 1 : -1) * (i % 5);
+        iov[i].iov_len = len;
+        iov[i].iov_base = malloc(len);
+        left -= len;
+    }
+
+    printf("%u calls of %zu bytes into %d segments\n", n_calls, call_size, n_segments);
+    ret = measure("copy", bus, iov, bounce, run_copy);
+    if (ret >= 0) {
+        ret = measure("readv", bus, iov, bounce, run_readv);
+    }
+
+    for (int i = 0; i < n_segments; i++) {
+        explicit_bzero(iov[i].iov_base, iov[i].iov_len);
+        free(iov[i].iov_base);
+    }
+    free(iov);
+    free(bounce);
+    sd_bus_flush_close_unref(bus);
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
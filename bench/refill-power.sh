@@ -0,0 +1,75 @@
+#! /bin/bash
+#
+# Wakeups/s and CPU time of the caching proxy at idle and under a steady
+# load, with and without --power-save. Starts a private dbus-daemon, runs
+# `sd-bus-client --proxy` on it as in bench/proxy-bench.sh, and samples the
+# proxy's context switches and CPU time from /proc. Needs dbus-daemon,
+# bin/sd-bus-client and the service (e.g. bin/mock-service) on the user bus.
+#
+# Usage: bench/refill-power.sh [SECONDS] [BYTES/S] [BYTES]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+SECONDS_PER_RUN=${1:-5}
+RATE=${2:-1048576}
+BYTES=${3:-4096}
+UPSTREAM=${DBUS_SESSION_BUS_ADDRESS:-unix:path=$XDG_RUNTIME_DIR/bus}
+DIR=$(mktemp -d /tmp/qrng-power.XXXXXX)
+
+cat > $DIR/bus.conf << EOF
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>session</type>
+  <listen>unix:path=$DIR/bus</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+    <allow own="*"/>
+  </policy>
+</busconfig>
+EOF
+
+dbus-daemon --config-file=$DIR/bus.conf --fork --print-pid=3 3> $DIR/pid || exit 1
+trap 'kill $PROXY_PID $(cat $DIR/pid) 2> /dev/null; rm -rf $DIR' EXIT
+PROXIED=unix:path=$DIR/bus
+sleep 0.2
+
+# Context switches and nanoseconds on CPU of all threads of a process
+sample() {
+    echo $(cat /proc/$1/task/*/status | awk '/ctxt_switches/ { s += $2 } END { print s }') \
+         $(cat /proc/$1/task/*/schedstat | awk '{ s += $1 } END { printf "%d", s }')
+}
+
+# Wakeups/s and CPU ms/s of the proxy while "$@" runs (or sleeps)
+measure() {
+    local before after
+    before=$(sample $PROXY_PID)
+    "$@"
+    after=$(sample $PROXY_PID)
+    echo $before $after | awk -v s=$SECONDS_PER_RUN \
+        '{ printf " %14.1f %14.2f", ($3 - $1) / s, ($4 - $2) / 1e6 / s }'
+}
+
+load() {
+    $CLIENT -q --address $PROXIED -n $((RATE * SECONDS_PER_RUN / BYTES)) -b $BYTES \
+        --max-rate $RATE > /dev/null
+}
+
+printf "%-12s %14s %14s %14s %14s %15s\n" "" "idle wake/s" "idle CPU ms/s" "load wake/s" \
+    "load CPU ms/s" "upstream calls"
+for mode in default power-save; do
+    flags=
+    [ $mode = power-save ] && flags=--power-save
+    DBUS_SESSION_BUS_ADDRESS=$PROXIED $CLIENT -q --proxy lv.lumii.trng --address $UPSTREAM \
+        $flags > $DIR/proxy.log &
+    PROXY_PID=$!
+    sleep 0.5
+    printf "%-12s" $mode
+    measure sleep $SECONDS_PER_RUN
+    measure load
+    kill -INT $PROXY_PID
+    wait $PROXY_PID
+    printf " %15s\n" $(sed -n 's/^  upstream: \([0-9]*\) calls.*/\1/p' $DIR/proxy.log)
+done
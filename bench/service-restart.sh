@@ -0,0 +1,52 @@
+#! /bin/bash
+#
+# Recovery after RNG service restarts: keeps a rate-limited load running
+# against the mock service on a private bus, kills the service every
+# RESTART_PERIOD seconds and starts it again GAP seconds later. The mock
+# holds replies for a few milliseconds so calls are in flight at the kill.
+# The client's last line gives recovery latency from the owner going away
+# to the first reply from the new owner, and from the new owner appearing
+# to that reply. Extra arguments (e.g. --fail-fast) go to the client.
+# Needs bin/sd-bus-client, bin/mock-service and dbus-daemon.
+#
+# Usage: bench/service-restart.sh [SECONDS] [RESTART_PERIOD] [GAP] [CLIENT_ARGS...]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+MOCK=${MOCK:-$(dirname $SCRIPT_DIR)/bin/mock-service}
+DURATION=${1:-20}
+PERIOD=${2:-4}
+GAP=${3:-0.5}
+shift 3 2> /dev/null
+RATE=2000
+
+DIR=$(mktemp -d /tmp/qrng-restart.XXXXXX)
+export DBUS_SESSION_BUS_ADDRESS=unix:path=$DIR/bus
+
+dbus-daemon --session --address=$DBUS_SESSION_BUS_ADDRESS --nofork --nopidfile 2> /dev/null &
+BUS_PID=$!
+while [ ! -S $DIR/bus ]; do sleep 0.01; done
+$MOCK --delay 5 &
+MOCK_PID=$!
+sleep 0.2
+
+$CLIENT -q -n $((DURATION * RATE)) -b 1024 -c 16 --connections 2 \
+    --max-rate 0:$RATE --interval 1 "$@" &
+CLIENT_PID=$!
+
+elapsed=0
+while kill -0 $CLIENT_PID 2> /dev/null && [ $elapsed -lt $DURATION ]; do
+    sleep $PERIOD
+    elapsed=$((elapsed + PERIOD))
+    echo "== killing service at ${elapsed} s, restarting after ${GAP} s" >&2
+    kill $MOCK_PID
+    wait $MOCK_PID 2> /dev/null
+    sleep $GAP
+    $MOCK --delay 5 &
+    MOCK_PID=$!
+done
+
+wait $CLIENT_PID
+kill $MOCK_PID $BUS_PID 2> /dev/null
+wait $MOCK_PID $BUS_PID 2> /dev/null
+rm -rf $DIR
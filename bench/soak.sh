@@ -0,0 +1,55 @@
+#! /bin/bash
+#
+# Soak test for connection failover: keeps a rate-limited load running
+# against the mock service on a private bus and restarts the bus every few
+# seconds. The client's interval reports show the throughput dip and its
+# final line the disconnects, reissued calls and recovery times. Needs
+# bin/sd-bus-client, bin/mock-service (see bench/mock-service.c) and
+# dbus-daemon.
+#
+# Usage: bench/soak.sh [SECONDS] [RESTART_PERIOD] [CALLS_PER_SEC] [CONNECTIONS]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+MOCK=${MOCK:-$(dirname $SCRIPT_DIR)/bin/mock-service}
+DURATION=${1:-30}
+PERIOD=${2:-5}
+RATE=${3:-2000}
+CONNECTIONS=${4:-4}
+
+DIR=$(mktemp -d /tmp/qrng-soak.XXXXXX)
+export DBUS_SESSION_BUS_ADDRESS=unix:path=$DIR/bus
+
+start_bus() {
+    dbus-daemon --session --address=$DBUS_SESSION_BUS_ADDRESS --nofork --nopidfile 2> /dev/null &
+    BUS_PID=$!
+    while [ ! -S $DIR/bus ]; do sleep 0.01; done
+    $MOCK &
+    MOCK_PID=$!
+}
+
+stop_bus() {
+    kill $MOCK_PID $BUS_PID 2> /dev/null
+    wait $MOCK_PID $BUS_PID 2> /dev/null
+    rm -f $DIR/bus
+}
+
+start_bus
+sleep 0.2
+
+$CLIENT -q -n $((DURATION * RATE)) -b 1024 -c 16 --connections $CONNECTIONS \
+    --max-rate 0:$RATE --interval 1 -t 1000 &
+CLIENT_PID=$!
+
+elapsed=0
+while kill -0 $CLIENT_PID 2> /dev/null && [ $elapsed -lt $DURATION ]; do
+    sleep $PERIOD
+    elapsed=$((elapsed + PERIOD))
+    echo "== restarting bus at ${elapsed} s" >&2
+    stop_bus
+    start_bus
+done
+
+wait $CLIENT_PID
+stop_bus
+rm -rf $DIR
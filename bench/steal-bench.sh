@@ -0,0 +1,23 @@
+#! /bin/bash
+#
+# File generation over several connections when one of them is slow:
+# with the mock started as `bin/mock-service --delay 2 --slow-delay 10`,
+# the first connection that calls sees 10 ms replies and the others 2 ms.
+# Prints the job report with per-worker chunks, utilisation and steals; the
+# job time should track the aggregate rate, not the slow connection's
+# share of the file. Needs bin/sd-bus-client.
+#
+# Usage: bench/steal-bench.sh [CHUNKS] [CONCURRENT]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+CLIENT=${CLIENT:-$(dirname $SCRIPT_DIR)/bin/sd-bus-client}
+CHUNKS=${1:-20000}
+CONCURRENT=${2:-16}
+FILE=$(mktemp -u /tmp/qrng-steal.XXXXXX)
+trap 'rm -f $FILE $FILE.journal' EXIT
+
+for connections in 1 2 4; do
+    echo "== $connections connections"
+    rm -f $FILE
+    $CLIENT -q -n $CHUNKS -b 4096 -c $CONCURRENT --connections $connections --write-file $FILE || exit 1
+done
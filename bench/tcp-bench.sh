@@ -0,0 +1,69 @@
+#! /bin/bash
+#
+# Cost of a TCP bus transport against a Unix socket: starts a private
+# dbus-daemon listening on both (TCP on loopback, ANONYMOUS auth), puts
+# bin/mock-service on it, and runs the same loads over each transport.
+# Needs dbus-daemon, bin/sd-bus-client and bin/mock-service.
+#
+# Usage: bench/tcp-bench.sh [REQUESTS]
+
+SCRIPT_DIR=$(dirname $(realpath $0))
+BIN=$(dirname $SCRIPT_DIR)/bin
+CLIENT=${CLIENT:-$BIN/sd-bus-client}
+MOCK=${MOCK:-$BIN/mock-service}
+REQUESTS=${1:-5000}
+PORT=${PORT:-47111}
+DIR=$(mktemp -d /tmp/qrng-tcp.XXXXXX)
+
+cat > $DIR/bus.conf << EOF
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>session</type>
+  <listen>unix:path=$DIR/bus</listen>
+  <listen>tcp:host=127.0.0.1,port=$PORT</listen>
+  <auth>EXTERNAL</auth>
+  <auth>ANONYMOUS</auth>
+  <allow_anonymous/>
+  <policy context="default">
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+    <allow own="*"/>
+  </policy>
+</busconfig>
+EOF
+
+dbus-daemon --config-file=$DIR/bus.conf --fork --print-pid=3 3> $DIR/pid || exit 1
+trap 'kill $MOCK_PID $(cat $DIR/pid) 2> /dev/null; rm -rf $DIR' EXIT
+UNIX=unix:path=$DIR/bus
+TCP=tcp:host=127.0.0.1,port=$PORT
+sleep 0.2
+DBUS_SESSION_BUS_ADDRESS=$UNIX $MOCK &
+MOCK_PID=$!
+sleep 0.3
+
+run() {
+    local label=$1
+    shift
+    # A long --interval gives one report for the whole run
+    local out=$($CLIENT -q --interval 3600 "$@" | grep '^\[')
+    echo "$out" | awk -v l="$label" '{
+        for (i = 1; i <= NF; i++) {
+            if ($i == "calls/s,") calls = $(i - 1)
+            if ($i == "bytes/s,") bytes = $(i - 1)
+            if ($i == "p50") p50 = $(i + 1)
+            if ($i == "p99") p99 = $(i + 1)
+        }
+        printf "%-34s %10.0f %10.1f %9s %9s\n", l, calls, bytes / 1048576, p50, p99
+    }'
+}
+
+printf "%-34s %10s %10s %9s %9s\n" "" "calls/s" "MiB/s" "p50 ms" "p99 ms"
+for transport in unix tcp; do
+    addr=$UNIX
+    [ $transport = tcp ] && addr=$TCP
+    run "$transport  -b 32    -c 1" --address $addr -n $REQUESTS -b 32 -c 1
+    run "$transport  -b 32    -c 64" --address $addr -n $REQUESTS -b 32 -c 64
+    run "$transport  -b 32    -c 64 --batch 64" --address $addr -n $REQUESTS -b 32 -c 64 --batch 64
+    run "$transport  -b 1 MiB -c 4" --address $addr -n 200 -b 1048576 -c 4
+done
@@ -0,0 +1,922 @@
+#include "conn-pool.h"
+#include "probes.h"
+#include "qrng.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CONN_POOL_DEFAULT_BACKOFF_MIN_MS 50
+#define CONN_POOL_DEFAULT_BACKOFF_MAX_MS 5000
+#define CONN_POOL_DEFAULT_MAX_REISSUES   3
+#define CONN_POOL_DEFAULT_QUEUE_MS       25000   // Same as the sd-bus call timeout
+#define CONN_POOL_MAX_EVENTS             16
+#define CONN_POOL_DEFAULT_MAX_WQUEUE     64
+#define CONN_POOL_BUF_HEADROOM           (64 * 1024)         // Message header and a second reply's start
+#define CONN_POOL_MAX_AUTO_BUF           (64 * 1024 * 1024)
+#define CONN_POOL_DEFAULT_KEEPALIVE_S    30
+#define CONN_POOL_KEEPALIVE_PROBES       3
+
+#define DBUS_SERVICE   "org.freedesktop.DBus"
+#define DBUS_PATH      "/org/freedesktop/DBus"
+#define OWNER_MATCH    "type='signal',sender='" DBUS_SERVICE "',path='" DBUS_PATH "'," \
+                       "interface='" DBUS_SERVICE "',member='NameOwnerChanged'," \
+                       "arg0='" QRNG_SERVICE "'"
+
+QRNG_PROBE_SEMAPHORE(flush);
+
+enum {
+    SERVICE_UNKNOWN,
+    SERVICE_UP,
+    SERVICE_DOWN,
+};
+
+typedef struct conn conn_t;
+typedef struct pool_call pool_call_t;
+
+struct pool_call {
+    conn_pool_t *pool;
+    conn_t *conn;                 // NULL while queued
+    sd_bus_slot *slot;
+    uint64_t length;              // Total bytes asked for
+    uint64_t *lengths;            // Block lengths of a batched call, else NULL
+    unsigned n_lengths;
+    unsigned reissues;
+    unsigned owner_gen;           // Owner generation of its connection when sent
+    uint64_t queued_usec;         // When it last entered the queue
+    sd_bus_message_handler_t callback;
+    void *userdata;
+
+    pool_call_t *prev;            // In-flight list of conn, or queue
+    pool_call_t *next;
+};
+
+struct conn {
+    conn_pool_t *pool;
+    sd_bus *bus;                  // NULL while down
+    uint32_t events;              // Registered epoll interest
+    uint32_t in_flight;
+    pool_call_t *calls;
+
+    uint64_t down_usec;           // When the last disconnect was noticed
+    uint64_t retry_usec;          // Next reconnect attempt while down
+    uint64_t backoff_ms;
+    int recovering;               // Reconnected, waiting for its first reply
+
+    // Unique name owning QRNG_SERVICE as seen on this connection: NULL
+    // until known, "" while the service is gone
+    char *owner;
+    unsigned owner_gen;           // Bumped on every owner change
+    sd_bus_slot *owner_match;     // NameOwnerChanged subscription
+    sd_bus_slot *owner_query;     // GetNameOwner in flight
+
+    uint64_t rcvbuf_for;          // Call size the receive buffer was sized for
+
+    int tcp;                      // Socket is TCP
+    int corked;                   // TCP_CORK set since the last flush
+};
+
+struct conn_pool {
+    conn_pool_config_t config;
+    int epfd;
+    conn_t *conns;
+
+    pool_call_t *queue_head;      // Calls waiting for a healthy connection
+    pool_call_t *queue_tail;
+
+    int service;                  // SERVICE_* across all connections
+    uint64_t service_down_usec;   // When the owner was last seen to go away
+    uint64_t service_up_usec;     // When the current owner was first seen
+    int resuming;                 // Owner is back, no reply from it yet
+
+    uint32_t seed;                // Backoff jitter
+    conn_pool_stats_t stats;
+};
+
+void conn_pool_config_defaults(conn_pool_config_t *config) {
+    if (config->connections == 0) {
+        config->connections = 1;
+    }
+    if (config->queue_timeout_ms == 0) {
+        config->queue_timeout_ms = CONN_POOL_DEFAULT_QUEUE_MS;
+    }
+    if (config->backoff_min_ms == 0) {
+        config->backoff_min_ms = CONN_POOL_DEFAULT_BACKOFF_MIN_MS;
+    }
+    if (config->backoff_max_ms < config->backoff_min_ms) {
+        config->backoff_max_ms = config->backoff_min_ms > CONN_POOL_DEFAULT_BACKOFF_MAX_MS
+                                     ? config->backoff_min_ms
+                                     : CONN_POOL_DEFAULT_BACKOFF_MAX_MS;
+    }
+    if (config->max_reissues == 0) {
+        config->max_reissues = CONN_POOL_DEFAULT_MAX_REISSUES;
+    }
+    if (config->max_queued_write == 0) {
+        config->max_queued_write = CONN_POOL_DEFAULT_MAX_WQUEUE;
+    }
+    if (config->keepalive_s == 0) {
+        config->keepalive_s = CONN_POOL_DEFAULT_KEEPALIVE_S;
+    }
+}
+
+static void queue_push(conn_pool_t *pool, pool_call_t *call, uint64_t now) {
+    call->conn = NULL;
+    call->queued_usec = now;
+    call->next = NULL;
+    call->prev = pool->queue_tail;
+    if (pool->queue_tail) {
+        pool->queue_tail->next = call;
+    } else {
+        pool->queue_head = call;
+    }
+    pool->queue_tail = call;
+    pool->stats.queued++;
+}
+
+// Put a call that could not be sent back at the head of the line
+static void queue_unpop(conn_pool_t *pool, pool_call_t *call) {
+    call->prev = NULL;
+    call->next = pool->queue_head;
+    if (pool->queue_head) {
+        pool->queue_head->prev = call;
+    } else {
+        pool->queue_tail = call;
+    }
+    pool->queue_head = call;
+    pool->stats.queued++;
+}
+
+static pool_call_t *queue_pop(conn_pool_t *pool) {
+    pool_call_t *call = pool->queue_head;
+
+    pool->queue_head = call->next;
+    if (pool->queue_head) {
+        pool->queue_head->prev = NULL;
+    } else {
+        pool->queue_tail = NULL;
+    }
+    pool->stats.queued--;
+    return call;
+}
+
+static void conn_unlink(conn_t *c, pool_call_t *call) {
+    if (call->prev) {
+        call->prev->next = call->next;
+    } else {
+        c->calls = call->next;
+    }
+    if (call->next) {
+        call->next->prev = call->prev;
+    }
+    call->conn = NULL;
+    c->in_flight--;
+}
+
+static void call_free(pool_call_t *call) {
+    free(call->lengths);
+    free(call);
+}
+
+// Complete a call without a reply
+static void call_fail(pool_call_t *call, int error) {
+    sd_bus_error e = SD_BUS_ERROR_NULL;
+
+    sd_bus_error_set_errno(&e, error);
+    call->callback(NULL, call->userdata, &e);
+    sd_bus_error_free(&e);
+    call_free(call);
+}
+
+// Move a call whose connection dropped back to the queue, unless it has
+// already been moved too often
+static void call_reissue(conn_pool_t *pool, pool_call_t *call, uint64_t now) {
+    if (call->reissues >= pool->config.max_reissues) {
+        call_fail(call, ECONNRESET);
+        return;
+    }
+    call->reissues++;
+    pool->stats.reissued++;
+    queue_push(pool, call, now);
+}
+
+static int conn_is_healthy(conn_t *c) {
+    return c->bus && sd_bus_is_open(c->bus) > 0;
+}
+
+// Healthy and addressing a known, present service owner
+static int conn_is_usable(conn_t *c) {
+    return conn_is_healthy(c) && c->owner && c->owner[0];
+}
+
+// Derive the service state from what the connections have seen. Only
+// connections that know the owner count, so a reconnecting connection
+// does not make the service look gone.
+static void service_update(conn_pool_t *pool, uint64_t now) {
+    int state = SERVICE_UNKNOWN;
+
+    for (unsigned i = 0; i < pool->config.connections && state != SERVICE_UP; i++) {
+        conn_t *c = &pool->conns[i];
+        if (c->owner) {
+            state = c->owner[0] ? SERVICE_UP : SERVICE_DOWN;
+        }
+    }
+    if (state == SERVICE_UNKNOWN || state == pool->service) {
+        return;
+    }
+
+    if (state == SERVICE_DOWN) {
+        if (pool->service == SERVICE_UP) {
+            pool->stats.service_outages++;
+        }
+        pool->service_down_usec = now;
+        pool->resuming = 0;
+    } else if (pool->service == SERVICE_DOWN) {
+        pool->service_up_usec = now;
+        pool->resuming = 1;
+    }
+    pool->service = state;
+}
+
+static void conn_set_owner(conn_t *c, const char *owner) {
+    char *copy = owner ? strdup(owner) : NULL;
+
+    if (owner && !copy) {
+        return;
+    }
+    free(c->owner);
+    c->owner = copy;
+    c->owner_gen++;
+    service_update(c->pool, qrng_now_usec());
+}
+
+static int owner_changed(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    conn_t *c = userdata;
+    const char *name, *old_owner, *new_owner;
+
+    (void)ret_error;
+    if (sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner) >= 0) {
+        conn_set_owner(c, new_owner);
+    }
+    return 0;
+}
+
+static int owner_reply(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    conn_t *c = userdata;
+    const char *owner;
+
+    (void)ret_error;
+    c->owner_query = sd_bus_slot_unref(c->owner_query);
+    if (sd_bus_message_is_method_error(reply, SD_BUS_ERROR_NAME_HAS_NO_OWNER)) {
+        conn_set_owner(c, "");
+    } else if (!sd_bus_message_is_method_error(reply, NULL) &&
+               sd_bus_message_read(reply, "s", &owner) >= 0) {
+        conn_set_owner(c, owner);
+    }
+    return 0;
+}
+
+// Ask the broker for the current owner; until it answers (or a
+// NameOwnerChanged signal does), the connection takes no calls
+static int conn_query_owner(conn_t *c) {
+    if (c->owner_query) {
+        return 0;
+    }
+    conn_set_owner(c, NULL);
+    return sd_bus_call_method_async(c->bus, &c->owner_query, DBUS_SERVICE, DBUS_PATH,
+                                    DBUS_SERVICE, "GetNameOwner", owner_reply, c, "s",
+                                    QRNG_SERVICE);
+}
+
+static int call_reply(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    pool_call_t *call = userdata;
+    conn_t *c = call->conn;
+    conn_pool_t *pool = call->pool;
+    uint64_t now = qrng_now_usec();
+    uint64_t cookie = 0;
+
+    sd_bus_message_get_reply_cookie(reply, &cookie);
+    QRNG_PROBE4(reply, call->userdata, call->length, cookie, c - pool->conns);
+
+    conn_unlink(c, call);
+    call->slot = sd_bus_slot_unref(call->slot);
+
+    // sd-bus answers every pending call with a synthetic NoReply error when
+    // the connection goes away; those deserve another connection
+    if (sd_bus_message_is_method_error(reply, SD_BUS_ERROR_NO_REPLY) && !conn_is_healthy(c)) {
+        call_reissue(pool, call, now);
+        return 0;
+    }
+
+    // The owner it was addressed to is gone. If we have not heard about
+    // that yet, ask, so the call is not sent straight back to the old name.
+    if (sd_bus_message_is_method_error(reply, SD_BUS_ERROR_SERVICE_UNKNOWN) ||
+        sd_bus_message_is_method_error(reply, SD_BUS_ERROR_NAME_HAS_NO_OWNER)) {
+        if (call->owner_gen == c->owner_gen) {
+            conn_query_owner(c);
+        }
+        call_reissue(pool, call, now);
+        return 0;
+    }
+
+    // The broker fails calls whose recipient disconnected with NoReply;
+    // if the owner changed since the call was sent, it is worth another try
+    if (sd_bus_message_is_method_error(reply, SD_BUS_ERROR_NO_REPLY) &&
+        call->owner_gen != c->owner_gen) {
+        call_reissue(pool, call, now);
+        return 0;
+    }
+
+    if (!sd_bus_message_is_method_error(reply, NULL)) {
+        if (c->recovering) {
+            uint64_t usec = now - c->down_usec;
+            c->recovering = 0;
+            c->backoff_ms = pool->config.backoff_min_ms;
+            pool->stats.recoveries++;
+            pool->stats.recovery_usec_total += usec;
+            if (usec > pool->stats.recovery_usec_max) {
+                pool->stats.recovery_usec_max = usec;
+            }
+        }
+        if (pool->resuming) {
+            uint64_t usec = now - pool->service_down_usec;
+            uint64_t resume = now - pool->service_up_usec;
+            pool->resuming = 0;
+            pool->stats.service_recoveries++;
+            pool->stats.service_recovery_usec_total += usec;
+            if (usec > pool->stats.service_recovery_usec_max) {
+                pool->stats.service_recovery_usec_max = usec;
+            }
+            pool->stats.resume_usec_total += resume;
+            if (resume > pool->stats.resume_usec_max) {
+                pool->stats.resume_usec_max = resume;
+            }
+        }
+    }
+
+    call->callback(reply, call->userdata, ret_error);
+    call_free(call);
+    return 0;
+}
+
+// The FORCE variants ignore net.core.rmem_max/wmem_max but need
+// CAP_NET_ADMIN; without it the size is silently capped
+static void set_sock_buf(int fd, int force_opt, int opt, long size) {
+    int value = size > INT32_MAX / 2 ? INT32_MAX / 2 : (int)size;
+
+    if (setsockopt(fd, SOL_SOCKET, force_opt, &value, sizeof(value)) < 0) {
+        setsockopt(fd, SOL_SOCKET, opt, &value, sizeof(value));
+    }
+}
+
+// In auto mode, grow the receive buffer so a whole reply fits: the reader
+// then wakes up once per reply instead of once per default-sized buffer.
+// This only pays off where the receiver's buffer limits the sender (TCP);
+// on a Unix socket the kernel flow-controls on the sender's buffer.
+static void conn_size_rcvbuf(conn_t *c, uint64_t length) {
+    if (c->pool->config.rcvbuf != 0 || length <= c->rcvbuf_for) {
+        return;
+    }
+    c->rcvbuf_for = length;
+
+    // sd-bus already asks for a few MiB; only ever grow from there. The
+    // kernel reports twice the requested size.
+    int fd = sd_bus_get_fd(c->bus);
+    int current = 0;
+    socklen_t len = sizeof(current);
+    uint64_t size = length + CONN_POOL_BUF_HEADROOM;
+    size = size > CONN_POOL_MAX_AUTO_BUF ? CONN_POOL_MAX_AUTO_BUF : size;
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &current, &len) == 0 && (uint64_t)current / 2 >= size) {
+        return;
+    }
+    set_sock_buf(fd, SO_RCVBUFFORCE, SO_RCVBUF, (long)size);
+}
+
+// Over TCP, calls sent between two waits are corked and leave together when
+// the caller goes back to waiting (conn_pool_prepare), so a batch of calls
+// fills segments instead of sending one small segment each
+static void conn_cork(conn_t *c) {
+    int on = 1;
+
+    if (c->tcp && !c->corked) {
+        setsockopt(sd_bus_get_fd(c->bus), IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+        c->corked = 1;
+    }
+}
+
+static void conn_uncork(conn_t *c) {
+    int off = 0;
+
+    if (c->corked) {
+        setsockopt(sd_bus_get_fd(c->bus), IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        c->corked = 0;
+    }
+}
+
+// Lone calls go out at once, and keepalive probes notice a peer that
+// vanished without closing the connection (a powered-off appliance)
+// within about keepalive_s * 2
+static void conn_setup_tcp(conn_pool_t *pool, conn_t *c, int fd) {
+    int domain = 0, on = 1;
+    socklen_t len = sizeof(domain);
+
+    c->tcp = getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) == 0 &&
+             (domain == AF_INET || domain == AF_INET6);
+    c->corked = 0;
+    if (!c->tcp) {
+        return;
+    }
+    int idle = (int)pool->config.keepalive_s;
+    int interval = idle / CONN_POOL_KEEPALIVE_PROBES > 0 ? idle / CONN_POOL_KEEPALIVE_PROBES : 1;
+    int probes = CONN_POOL_KEEPALIVE_PROBES;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+}
+
+// Address the owner's unique name directly, so the broker does not resolve
+// the well-known name (or try to activate the service) on every call
+static int call_send(conn_t *c, pool_call_t *call) {
+    conn_pool_t *pool = c->pool;
+    sd_bus_message *m = NULL;
+    int ret;
+
+    ret = sd_bus_message_new_method_call(c->bus, &m, c->owner, QRNG_OBJECT_PATH, QRNG_INTERFACE,
+                                         call->lengths ? QRNG_METHOD_BATCH : QRNG_METHOD);
+    if (ret >= 0) {
+        ret = sd_bus_message_set_auto_start(m, 0);
+    }
+    if (ret >= 0 && call->lengths) {
+        ret = sd_bus_message_append_array(m, 't', call->lengths,
+                                          call->n_lengths * sizeof(*call->lengths));
+        if (ret >= 0) {
+            ret = sd_bus_message_append(m, "t", pool->config.timeout_ms);
+        }
+    } else if (ret >= 0) {
+        ret = sd_bus_message_append(m, "tt", call->length, pool->config.timeout_ms);
+    }
+    if (ret >= 0) {
+        conn_size_rcvbuf(c, call->length);
+        conn_cork(c);
+        ret = sd_bus_call_async(c->bus, &call->slot, m, call_reply, call, 0);
+    }
+    if (ret >= 0) {
+        uint64_t cookie = 0;
+        sd_bus_message_get_cookie(m, &cookie);
+        QRNG_PROBE4(send, call->userdata, call->length, cookie, c - pool->conns);
+    }
+    sd_bus_message_unref(m);
+    if (ret < 0) {
+        return ret;
+    }
+
+    uint64_t queued;
+    if (sd_bus_get_n_queued_write(c->bus, &queued) >= 0 && queued > pool->stats.wqueue_max) {
+        pool->stats.wqueue_max = queued;
+    }
+
+    call->conn = c;
+    call->owner_gen = c->owner_gen;
+    call->prev = NULL;
+    call->next = c->calls;
+    if (c->calls) {
+        c->calls->prev = call;
+    }
+    c->calls = call;
+    c->in_flight++;
+    pool->stats.calls++;
+    return 0;
+}
+
+// Connections whose outbound queue is full take no calls until sd-bus has
+// written it out, so a slow broker pushes back instead of the queue growing
+static conn_t *least_loaded(conn_pool_t *pool) {
+    conn_t *best = NULL;
+    int limited = 0;
+
+    for (unsigned i = 0; i < pool->config.connections; i++) {
+        conn_t *c = &pool->conns[i];
+        uint64_t queued = 0;
+        if (!conn_is_usable(c)) {
+            continue;
+        }
+        if (sd_bus_get_n_queued_write(c->bus, &queued) >= 0 &&
+            queued >= pool->config.max_queued_write) {
+            limited = 1;
+            continue;
+        }
+        if (!best || c->in_flight < best->in_flight) {
+            best = c;
+        }
+    }
+    if (!best && limited) {
+        pool->stats.write_limited++;
+    }
+    return best;
+}
+
+static uint64_t jittered(conn_pool_t *pool, uint64_t ms) {
+    // xorshift32, +-25% so reconnects after a bus restart do not arrive in
+    // lockstep
+    pool->seed ^= pool->seed << 13;
+    pool->seed ^= pool->seed >> 17;
+    pool->seed ^= pool->seed << 5;
+    return ms * 3 / 4 + (ms > 1 ? pool->seed % (ms / 2) : 0);
+}
+
+static void conn_close(conn_t *c) {
+    c->owner_match = sd_bus_slot_unref(c->owner_match);
+    c->owner_query = sd_bus_slot_unref(c->owner_query);
+    free(c->owner);
+    c->owner = NULL;
+    sd_bus_close(c->bus);
+    c->bus = sd_bus_unref(c->bus);
+}
+
+static int conn_open(conn_pool_t *pool, conn_t *c) {
+    sd_bus *bus = NULL;
+    int ret;
+
+    ret = qrng_bus_open(pool->config.address, &bus);
+    if (ret < 0) {
+        return ret;
+    }
+
+    int fd = sd_bus_get_fd(bus);
+    conn_setup_tcp(pool, c, fd);
+    if (pool->config.rcvbuf > 0) {
+        set_sock_buf(fd, SO_RCVBUFFORCE, SO_RCVBUF, pool->config.rcvbuf);
+    }
+    if (pool->config.sndbuf > 0) {
+        set_sock_buf(fd, SO_SNDBUFFORCE, SO_SNDBUF, pool->config.sndbuf);
+    }
+    c->rcvbuf_for = 0;
+
+    // Subscribe before asking, so no owner change falls in between
+    c->bus = bus;
+    ret = sd_bus_add_match_async(bus, &c->owner_match, OWNER_MATCH, owner_changed, NULL, c);
+    if (ret >= 0) {
+        ret = conn_query_owner(c);
+    }
+    if (ret < 0) {
+        conn_close(c);
+        return ret;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = c };
+    if (epoll_ctl(pool->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ret = -errno;
+        conn_close(c);
+        return ret;
+    }
+    c->events = ev.events;
+    return 0;
+}
+
+// Tear down a broken connection, move its calls and schedule a reconnect
+static void conn_lost(conn_pool_t *pool, conn_t *c, uint64_t now) {
+    while (c->calls) {
+        pool_call_t *call = c->calls;
+        conn_unlink(c, call);
+        call->slot = sd_bus_slot_unref(call->slot);
+        call_reissue(pool, call, now);
+    }
+
+    epoll_ctl(pool->epfd, EPOLL_CTL_DEL, sd_bus_get_fd(c->bus), NULL);
+    conn_close(c);
+    // A connection that dropped again before its first reply keeps its
+    // original outage start, so recovery time covers the whole outage, and
+    // backs off further
+    if (c->recovering) {
+        c->backoff_ms = c->backoff_ms * 2 > pool->config.backoff_max_ms ? pool->config.backoff_max_ms
+                                                                        : c->backoff_ms * 2;
+    } else {
+        c->down_usec = now;
+    }
+    c->recovering = 0;
+    c->retry_usec = now + jittered(pool, c->backoff_ms) * 1000;
+    pool->stats.disconnects++;
+}
+
+static void conn_reconnect(conn_pool_t *pool, conn_t *c, uint64_t now) {
+    int ret = conn_open(pool, c);
+
+    QRNG_PROBE2(connect, c - pool->conns, ret);
+    if (ret < 0) {
+        pool->stats.reconnect_failures++;
+        c->backoff_ms = c->backoff_ms * 2 > pool->config.backoff_max_ms ? pool->config.backoff_max_ms
+                                                                        : c->backoff_ms * 2;
+        c->retry_usec = now + jittered(pool, c->backoff_ms) * 1000;
+        return;
+    }
+    c->recovering = 1;
+    pool->stats.reconnects++;
+}
+
+static int fail_now(conn_pool_t *pool) {
+    return pool->config.fail_fast && pool->service == SERVICE_DOWN;
+}
+
+// Hand queued calls to usable connections; calls that have waited too long
+// for one fail, and with fail_fast so does everything queued while the
+// service is gone
+static void drain_queue(conn_pool_t *pool, uint64_t now) {
+    while (pool->queue_head) {
+        conn_t *c = least_loaded(pool);
+        if (!c) {
+            break;
+        }
+        pool_call_t *call = queue_pop(pool);
+        if (call_send(c, call) < 0) {
+            // Most likely the connection just broke: the next process round
+            // notices that, and the call keeps its place in line meanwhile
+            queue_unpop(pool, call);
+            break;
+        }
+    }
+
+    uint64_t timeout_usec = pool->config.queue_timeout_ms * 1000;
+    while (pool->queue_head && pool->queue_head->queued_usec + timeout_usec <= now) {
+        call_fail(queue_pop(pool), pool->service == SERVICE_DOWN ? EHOSTDOWN : ENOTCONN);
+    }
+    while (pool->queue_head && fail_now(pool)) {
+        call_fail(queue_pop(pool), EHOSTDOWN);
+    }
+}
+
+int conn_pool_new(const conn_pool_config_t *config, conn_pool_t **ret) {
+    conn_pool_t *pool = calloc(1, sizeof(*pool));
+    int r = -ENOMEM;
+
+    if (!pool) {
+        return -ENOMEM;
+    }
+    pool->config = *config;
+    conn_pool_config_defaults(&pool->config);
+    pool->seed = (uint32_t)qrng_now_usec() | 1;
+    pool->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (pool->epfd < 0) {
+        r = -errno;
+        free(pool);
+        return r;
+    }
+    pool->conns = calloc(pool->config.connections, sizeof(*pool->conns));
+    if (!pool->conns) {
+        goto fail;
+    }
+
+    uint64_t now = qrng_now_usec();
+    unsigned opened = 0;
+    for (unsigned i = 0; i < pool->config.connections; i++) {
+        conn_t *c = &pool->conns[i];
+        c->pool = pool;
+        c->backoff_ms = pool->config.backoff_min_ms;
+        r = conn_open(pool, c);
+        QRNG_PROBE2(connect, i, r);
+        if (r < 0) {
+            c->down_usec = now;
+            c->retry_usec = now + jittered(pool, c->backoff_ms) * 1000;
+            continue;
+        }
+        opened++;
+    }
+    if (opened == 0) {
+        goto fail;
+    }
+
+    *ret = pool;
+    return 0;
+
+fail:
+    conn_pool_free(pool);
+    return r;
+}
+
+void conn_pool_free(conn_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+    for (unsigned i = 0; pool->conns && i < pool->config.connections; i++) {
+        conn_t *c = &pool->conns[i];
+        while (c->calls) {
+            pool_call_t *call = c->calls;
+            conn_unlink(c, call);
+            sd_bus_slot_unref(call->slot);
+            call_free(call);
+        }
+        if (c->bus) {
+            sd_bus_flush(c->bus);
+            conn_close(c);
+        }
+    }
+    while (pool->queue_head) {
+        call_free(queue_pop(pool));
+    }
+    free(pool->conns);
+    close(pool->epfd);
+    free(pool);
+}
+
+static int conn_takes_calls(conn_pool_t *pool, conn_t *c) {
+    uint64_t queued = 0;
+    if (!conn_is_usable(c)) {
+        return 0;
+    }
+    return sd_bus_get_n_queued_write(c->bus, &queued) < 0 ||
+           queued < pool->config.max_queued_write;
+}
+
+// preferred < 0 (or a connection that cannot take the call) means the
+// least loaded one
+static int pool_submit(conn_pool_t *pool, pool_call_t *call, int preferred) {
+    conn_t *c = NULL;
+    // Keep the order of calls that are already waiting
+    if (!pool->queue_head) {
+        if (preferred >= 0 && conn_takes_calls(pool, &pool->conns[preferred])) {
+            c = &pool->conns[preferred];
+        } else {
+            c = least_loaded(pool);
+        }
+    }
+    if (!c || call_send(c, call) < 0) {
+        queue_push(pool, call, qrng_now_usec());
+    }
+    return 0;
+}
+
+int conn_pool_read_async(conn_pool_t *pool, uint64_t length,
+                         sd_bus_message_handler_t callback, void *userdata) {
+    return conn_pool_read_async_on(pool, -1, length, callback, userdata);
+}
+
+int conn_pool_read_async_on(conn_pool_t *pool, int conn, uint64_t length,
+                            sd_bus_message_handler_t callback, void *userdata) {
+    pool_call_t *call = calloc(1, sizeof(*call));
+
+    if (!call) {
+        return -ENOMEM;
+    }
+    call->pool = pool;
+    call->length = length;
+    call->callback = callback;
+    call->userdata = userdata;
+    if (conn >= (int)pool->config.connections) {
+        conn = -1;
+    }
+    return pool_submit(pool, call, conn);
+}
+
+int conn_pool_read_batch_async(conn_pool_t *pool, const uint64_t *lengths, unsigned n,
+                               sd_bus_message_handler_t callback, void *userdata) {
+    pool_call_t *call = calloc(1, sizeof(*call));
+
+    if (!call) {
+        return -ENOMEM;
+    }
+    call->lengths = malloc(n * sizeof(*lengths));
+    if (!call->lengths) {
+        free(call);
+        return -ENOMEM;
+    }
+    memcpy(call->lengths, lengths, n * sizeof(*lengths));
+    call->n_lengths = n;
+    for (unsigned i = 0; i < n; i++) {
+        call->length += lengths[i];
+    }
+    call->pool = pool;
+    call->callback = callback;
+    call->userdata = userdata;
+    return pool_submit(pool, call, -1);
+}
+
+int conn_pool_process(conn_pool_t *pool) {
+    uint64_t now = qrng_now_usec();
+    int progress = 0;
+
+    for (unsigned i = 0; i < pool->config.connections; i++) {
+        conn_t *c = &pool->conns[i];
+
+        if (!c->bus) {
+            if (now >= c->retry_usec) {
+                conn_reconnect(pool, c, now);
+                progress = 1;
+            }
+            continue;
+        }
+
+        uint64_t queued;
+        if (sd_bus_get_n_queued_read(c->bus, &queued) >= 0 && queued > pool->stats.rqueue_max) {
+            pool->stats.rqueue_max = queued;
+        }
+
+        int ret;
+        while ((ret = sd_bus_process(c->bus, NULL)) > 0) {
+            progress = 1;
+        }
+        if (ret < 0 || !conn_is_healthy(c)) {
+            conn_lost(pool, c, now);
+            progress = 1;
+        }
+    }
+
+    size_t queued = pool->stats.queued;
+    drain_queue(pool, now);
+    if (pool->stats.queued != queued) {
+        progress = 1;
+    }
+    return progress;
+}
+
+int conn_pool_get_fd(conn_pool_t *pool) {
+    return pool->epfd;
+}
+
+uint64_t conn_pool_prepare(conn_pool_t *pool) {
+    uint64_t until = UINT64_MAX;
+
+    for (unsigned i = 0; i < pool->config.connections; i++) {
+        conn_t *c = &pool->conns[i];
+        uint64_t t = UINT64_MAX;
+
+        if (!c->bus) {
+            t = c->retry_usec;
+        } else {
+            conn_uncork(c);
+            if (QRNG_PROBE_ENABLED(flush)) {
+                uint64_t queued = 0;
+                sd_bus_get_n_queued_write(c->bus, &queued);
+                QRNG_GATED_PROBE2(flush, i, queued);
+            }
+            int events = sd_bus_get_events(c->bus);
+            if (events < 0) {
+                // Closed underneath us: let the next process round tear it down
+                t = 0;
+            } else if ((uint32_t)events != c->events) {
+                struct epoll_event ev = { .events = (uint32_t)events, .data.ptr = c };
+                epoll_ctl(pool->epfd, EPOLL_CTL_MOD, sd_bus_get_fd(c->bus), &ev);
+                c->events = (uint32_t)events;
+            }
+            if (t != 0) {
+                sd_bus_get_timeout(c->bus, &t);
+            }
+        }
+        until = t < until ? t : until;
+    }
+
+    if (pool->queue_head) {
+        uint64_t expiry = fail_now(pool) ? 0
+                        : pool->queue_head->queued_usec + pool->config.queue_timeout_ms * 1000;
+        until = expiry < until ? expiry : until;
+    }
+    return until;
+}
+
+int conn_pool_wait(conn_pool_t *pool, uint64_t timeout_usec) {
+    struct epoll_event events[CONN_POOL_MAX_EVENTS];
+    uint64_t until = conn_pool_prepare(pool);
+    uint64_t now = qrng_now_usec();
+
+    if (timeout_usec != UINT64_MAX && now + timeout_usec < until) {
+        until = now + timeout_usec;
+    }
+    int timeout = until == UINT64_MAX ? -1
+                : until <= now         ? 0
+                                       : (int)((until - now + 999) / 1000);
+    int n = epoll_wait(pool->epfd, events, CONN_POOL_MAX_EVENTS, timeout);
+    if (n < 0 && errno != EINTR) {
+        return -errno;
+    }
+    if (n > 0) {
+        pool->stats.wakeups++;
+    }
+    return 0;
+}
+
+void conn_pool_get_stats(conn_pool_t *pool, conn_pool_stats_t *stats) {
+    *stats = pool->stats;
+    stats->healthy = 0;
+    stats->service_up = pool->service == SERVICE_UP;
+    stats->rcvbuf = stats->sndbuf = 0;
+    for (unsigned i = 0; i < pool->config.connections; i++) {
+        conn_t *c = &pool->conns[i];
+        if (!conn_is_healthy(c)) {
+            continue;
+        }
+        // Report the largest buffers in use, as the kernel sees them
+        int fd = sd_bus_get_fd(c->bus);
+        int rcvbuf = 0, sndbuf = 0;
+        socklen_t len = sizeof(int);
+        getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+        len = sizeof(int);
+        getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+        stats->rcvbuf = rcvbuf > stats->rcvbuf ? rcvbuf : stats->rcvbuf;
+        stats->sndbuf = sndbuf > stats->sndbuf ? sndbuf : stats->sndbuf;
+        stats->healthy++;
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef CONN_POOL_H
+#define CONN_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <systemd/sd-bus.h>
+
+// Pool of bus connections for asynchronous ReadBytes calls. Calls go to the
+// least loaded healthy connection. When a connection drops, the calls it
+// had in flight are reissued on the others (or queued until one is back)
+// and it is re-established in the background with exponential backoff, so
+// a disconnect costs a round trip instead of the whole run.
+//
+// Each connection also follows the owner of the service name through
+// NameOwnerChanged. Calls go to the owner's unique name with auto-start
+// disabled; while the service is gone they wait (or fail at once with
+// fail_fast), and they resume as soon as a new owner shows up. Calls lost
+// with the old owner are reissued to the new one.
+typedef struct conn_pool conn_pool_t;
+
+typedef struct {
+    const char *address;       // D-Bus address to connect to, NULL for the user bus
+    unsigned connections;      // Bus connections to keep open
+    uint64_t timeout_ms;       // Timeout passed to ReadBytes
+    uint64_t queue_timeout_ms; // Longest wait for a healthy connection
+    uint64_t backoff_min_ms;   // First reconnect delay
+    uint64_t backoff_max_ms;   // Upper bound for the doubling reconnect delay
+    unsigned max_reissues;     // Times one call may be moved after a disconnect
+    int fail_fast;             // Fail calls with -EHOSTDOWN while the service is gone
+    long rcvbuf;               // SO_RCVBUF: 0 sizes it to fit the largest reply, -1 keeps the default
+    long sndbuf;               // SO_SNDBUF: 0 or -1 keeps the default (requests are small)
+    unsigned max_queued_write; // Outbound messages queued on a connection before it takes no more
+    unsigned keepalive_s;      // TCP keepalive idle time; probes follow every keepalive_s / 3
+} conn_pool_config_t;
+
+typedef struct {
+    uint64_t calls;               // ReadBytes calls issued, reissues included
+    uint64_t disconnects;
+    uint64_t reconnects;          // Connections re-established
+    uint64_t reconnect_failures;  // Reconnect attempts that failed
+    uint64_t reissued;            // Calls moved after their connection dropped
+    uint64_t recoveries;          // Reconnected connections that got a reply
+    uint64_t recovery_usec_total; // Disconnect to first reply, summed
+    uint64_t recovery_usec_max;
+    uint64_t service_outages;     // Times the service name lost its owner
+    uint64_t service_recoveries;  // Outages ended by a reply from a new owner
+    uint64_t service_recovery_usec_total; // Owner gone to first reply, summed
+    uint64_t service_recovery_usec_max;
+    uint64_t resume_usec_total;   // New owner seen to first reply, summed
+    uint64_t resume_usec_max;
+    uint64_t rqueue_max;          // Deepest sd-bus read queue seen
+    uint64_t wqueue_max;          // Deepest sd-bus write queue seen
+    uint64_t write_limited;       // Times calls waited for a write queue to drain
+    uint64_t wakeups;             // conn_pool_wait returns with fds ready
+    int rcvbuf;                   // Largest socket buffers in use, as reported by the kernel
+    int sndbuf;
+    int service_up;               // An owner is known
+    unsigned healthy;             // Connections currently open
+    size_t queued;                // Calls waiting for a connection
+} conn_pool_stats_t;
+
+// Fill in defaults for any zero fields of config.
+void conn_pool_config_defaults(conn_pool_config_t *config);
+
+// Open the connections. Fails only if none of them could be opened; the
+// service itself need not be running yet.
+int conn_pool_new(const conn_pool_config_t *config, conn_pool_t **ret);
+
+// Calls still in flight are dropped without invoking their callbacks.
+void conn_pool_free(conn_pool_t *pool);
+
+// Issue ReadBytes(length). callback runs exactly once: with the reply
+// (which may be an error reply), or with a NULL reply and ret_error set if
+// the call could not be completed on any connection.
+int conn_pool_read_async(conn_pool_t *pool, uint64_t length,
+                         sd_bus_message_handler_t callback, void *userdata);
+
+// Same, but sent on connection conn (0 to connections - 1) while it is
+// healthy and can take calls, so a caller can keep its own work on one
+// connection. Otherwise the call goes wherever conn_pool_read_async would
+// send it, failover included.
+int conn_pool_read_async_on(conn_pool_t *pool, int conn, uint64_t length,
+                            sd_bus_message_handler_t callback, void *userdata);
+
+// Issue ReadBytesBatch for n blocks (n > 0) with the same guarantees; the
+// reply carries (i aay). Whether the service has the method is for the
+// caller to check (qrng_has_batch), and an UnknownMethod reply is passed
+// on like any other error reply.
+int conn_pool_read_batch_async(conn_pool_t *pool, const uint64_t *lengths, unsigned n,
+                               sd_bus_message_handler_t callback, void *userdata);
+
+// Dispatch replies, detect broken connections and reconnect due ones.
+// Returns 1 if anything was processed, 0 if idle, or a negative errno value.
+int conn_pool_process(conn_pool_t *pool);
+
+// Pollable fd that becomes readable when conn_pool_process has work.
+int conn_pool_get_fd(conn_pool_t *pool);
+
+// Update the fd's interest set and return the CLOCK_MONOTONIC deadline (in
+// microseconds) for the next conn_pool_process call, UINT64_MAX if none.
+// Also flushes calls held back on corked TCP connections, so call it (or
+// conn_pool_wait) before sleeping.
+uint64_t conn_pool_prepare(conn_pool_t *pool);
+
+// Wait for work for at most timeout_usec (UINT64_MAX waits indefinitely).
+int conn_pool_wait(conn_pool_t *pool, uint64_t timeout_usec);
+
+void conn_pool_get_stats(conn_pool_t *pool, conn_pool_stats_t *stats);
+
+#endif
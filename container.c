@@ -0,0 +1,266 @@
+#include "container.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the container format is written in host byte order, which must be little-endian"
+#endif
+
+_Static_assert(sizeof(qrng_container_header_t) <= QRNG_CONTAINER_HEADER_SIZE,
+               "header does not fit its reserved space");
+_Static_assert(sizeof(qrng_chunk_entry_t) == 32, "index entries are 32 bytes");
+_Static_assert(sizeof(qrng_container_trailer_t) == 24, "trailer is 24 bytes");
+
+// CRC32C, reflected polynomial
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_update)(uint32_t crc, const uint8_t *p, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+// Slicing-by-8: eight table lookups per 8 bytes
+static uint32_t crc_update_table(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc_table[7][v & 0xff] ^ crc_table[6][(v >> 8) & 0xff] ^
+              crc_table[5][(v >> 16) & 0xff] ^ crc_table[4][(v >> 24) & 0xff] ^
+              crc_table[3][(v >> 32) & 0xff] ^ crc_table[2][(v >> 40) & 0xff] ^
+              crc_table[1][(v >> 48) & 0xff] ^ crc_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_update_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t c = crc;
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __builtin_ia32_crc32di(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+    }
+    return (uint32_t)c;
+}
+#endif
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xff] ^ (crc_table[t - 1][i] >> 8);
+        }
+    }
+
+    crc_update = crc_update_table;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_update = crc_update_sse42;
+    }
+#endif
+}
+
+uint32_t qrng_crc32c(uint32_t crc, const void *buf, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    return ~crc_update(~crc, buf, len);
+}
+
+static uint32_t header_crc(const qrng_container_header_t *header) {
+    return qrng_crc32c(0, header, offsetof(qrng_container_header_t, header_crc));
+}
+
+void qrng_container_header_init(qrng_container_header_t *header, uint64_t num_chunks,
+                                uint64_t chunk_size, uint64_t created_usec,
+                                const char *service, const char *object) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, QRNG_CONTAINER_MAGIC, 8);
+    header->version = QRNG_CONTAINER_VERSION;
+    header->header_size = QRNG_CONTAINER_HEADER_SIZE;
+    header->num_chunks = num_chunks;
+    header->chunk_size = chunk_size;
+    header->index_offset = QRNG_CONTAINER_HEADER_SIZE + num_chunks * chunk_size;
+    header->created_usec = created_usec;
+    strncpy(header->service, service, sizeof(header->service) - 1);
+    strncpy(header->object, object, sizeof(header->object) - 1);
+    header->header_crc = header_crc(header);
+}
+
+uint64_t qrng_container_chunk_offset(const qrng_container_header_t *header, uint64_t chunk) {
+    return header->header_size + chunk * header->chunk_size;
+}
+
+uint64_t qrng_container_file_size(const qrng_container_header_t *header) {
+    return header->index_offset + header->num_chunks * sizeof(qrng_chunk_entry_t) +
+           sizeof(qrng_container_trailer_t);
+}
+
+struct qrng_container {
+    const uint8_t *map;
+    size_t size;
+    const qrng_container_header_t *header;
+    const uint8_t *index;        // Entries may be unaligned, so they are copied out
+    uint64_t cursor;             // Next unclaimed chunk, advanced atomically
+};
+
+// Everything in the header must agree with the file it sits in
+static int check_header(const qrng_container_header_t *h, size_t size) {
+    if (memcmp(h->magic, QRNG_CONTAINER_MAGIC, 8) != 0 || h->version != QRNG_CONTAINER_VERSION ||
+        h->header_crc != header_crc(h)) {
+        return -EBADMSG;
+    }
+    if (h->header_size < sizeof(*h) || h->header_size > size || h->chunk_size == 0 ||
+        h->num_chunks > (size - h->header_size) / h->chunk_size) {
+        return -EBADMSG;
+    }
+    if (h->index_offset != h->header_size + h->num_chunks * h->chunk_size ||
+        qrng_container_file_size(h) != size) {
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+int qrng_container_open(const char *path, qrng_container_t **ret) {
+    struct stat st;
+    int fd, r;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (fstat(fd, &st) < 0) {
+        r = -errno;
+        close(fd);
+        return r;
+    }
+    if ((size_t)st.st_size < QRNG_CONTAINER_HEADER_SIZE + sizeof(qrng_container_trailer_t)) {
+        close(fd);
+        return -EBADMSG;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    r = map == MAP_FAILED ? -errno : 0;
+    close(fd);
+    if (r < 0) {
+        return r;
+    }
+
+    qrng_container_t *c = calloc(1, sizeof(*c));
+    if (!c) {
+        munmap(map, st.st_size);
+        return -ENOMEM;
+    }
+    c->map = map;
+    c->size = st.st_size;
+    c->header = map;
+
+    r = check_header(c->header, c->size);
+    if (r < 0) {
+        goto fail;
+    }
+    c->index = c->map + c->header->index_offset;
+
+    // No trailer means the writer has not finished
+    size_t index_len = c->header->num_chunks * sizeof(qrng_chunk_entry_t);
+    qrng_container_trailer_t trailer;
+    memcpy(&trailer, c->index + index_len, sizeof(trailer));
+    if (memcmp(trailer.magic, QRNG_CONTAINER_TRAILER, 8) != 0) {
+        r = -ENODATA;
+        goto fail;
+    }
+    if (trailer.num_chunks != c->header->num_chunks ||
+        trailer.index_crc != qrng_crc32c(0, c->index, index_len)) {
+        r = -EBADMSG;
+        goto fail;
+    }
+
+    *ret = c;
+    return 0;
+
+fail:
+    qrng_container_close(c);
+    return r;
+}
+
+void qrng_container_close(qrng_container_t *container) {
+    if (!container) {
+        return;
+    }
+    munmap((void *)container->map, container->size);
+    free(container);
+}
+
+const qrng_container_header_t *qrng_container_get_header(qrng_container_t *container) {
+    return container->header;
+}
+
+const void *qrng_container_chunk(qrng_container_t *container, uint64_t chunk,
+                                 qrng_chunk_entry_t *entry) {
+    if (chunk >= container->header->num_chunks) {
+        return NULL;
+    }
+    if (entry) {
+        memcpy(entry, container->index + chunk * sizeof(*entry), sizeof(*entry));
+    }
+    return container->map + qrng_container_chunk_offset(container->header, chunk);
+}
+
+int qrng_container_verify(qrng_container_t *container, uint64_t chunk) {
+    qrng_chunk_entry_t entry;
+    const void *data = qrng_container_chunk(container, chunk, &entry);
+
+    if (!data) {
+        return -ERANGE;
+    }
+    if (!(entry.flags & QRNG_CHUNK_PRESENT) ||
+        qrng_crc32c(0, data, container->header->chunk_size) != entry.crc) {
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+uint64_t qrng_container_claim(qrng_container_t *container, uint64_t max, uint64_t *first) {
+    uint64_t n = container->header->num_chunks;
+    uint64_t start = __atomic_fetch_add(&container->cursor, max, __ATOMIC_RELAXED);
+
+    if (start >= n) {
+        return 0;
+    }
+    *first = start;
+    return max < n - start ? max : n - start;
+}
+
+void qrng_container_rewind(qrng_container_t *container) {
+    __atomic_store_n(&container->cursor, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,95 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Container format for generated entropy files, so readers can split a
+// large file between threads and check every chunk on its own:
+//
+//   header    qrng_container_header_t, padded to header_size (4096) bytes
+//   chunks    num_chunks * chunk_size bytes, chunk i at header_size + i * chunk_size
+//   index     num_chunks qrng_chunk_entry_t, one per chunk, at index_offset
+//   trailer   qrng_container_trailer_t, written last: a file without it is
+//             incomplete
+//
+// All fields are little-endian. Checksums are CRC32C (Castagnoli). Chunks
+// and their index entries are written in whatever order replies arrive;
+// the trailer's index checksum is computed once every chunk is present.
+
+#define QRNG_CONTAINER_MAGIC       "QRNGCTR1"
+#define QRNG_CONTAINER_TRAILER     "QRNGIDX1"
+#define QRNG_CONTAINER_VERSION     1
+#define QRNG_CONTAINER_HEADER_SIZE 4096
+
+#define QRNG_CHUNK_PRESENT 1
+
+typedef struct {
+    char magic[8];           // QRNG_CONTAINER_MAGIC
+    uint32_t version;        // QRNG_CONTAINER_VERSION
+    uint32_t header_size;    // Bytes before the first chunk
+    uint64_t num_chunks;
+    uint64_t chunk_size;
+    uint64_t index_offset;
+    uint64_t created_usec;   // CLOCK_REALTIME when generation started
+    char service[64];        // Bus name and object the bytes came from
+    char object[64];
+    uint32_t header_crc;     // CRC32C of everything above
+    uint32_t reserved;
+} qrng_container_header_t;
+
+typedef struct {
+    uint32_t crc;            // CRC32C of the chunk
+    uint32_t flags;          // QRNG_CHUNK_PRESENT once written
+    uint64_t fetched_usec;   // CLOCK_REALTIME when its reply arrived
+    uint32_t latency_usec;   // Round trip of the call that fetched it
+    uint32_t attempts;       // Calls it took
+    uint64_t reserved;
+} qrng_chunk_entry_t;
+
+typedef struct {
+    char magic[8];           // QRNG_CONTAINER_TRAILER
+    uint64_t num_chunks;
+    uint32_t index_crc;      // CRC32C of the whole index
+    uint32_t reserved;
+} qrng_container_trailer_t;
+
+// CRC32C of len bytes, continuing from crc (start with 0). Uses the SSE4.2
+// instruction where the CPU has it.
+uint32_t qrng_crc32c(uint32_t crc, const void *buf, size_t len);
+
+// Writer side: fill in a header (including its checksum) and compute the
+// layout of a container. service and object are truncated to 63 bytes.
+void qrng_container_header_init(qrng_container_header_t *header, uint64_t num_chunks,
+                                uint64_t chunk_size, uint64_t created_usec,
+                                const char *service, const char *object);
+uint64_t qrng_container_chunk_offset(const qrng_container_header_t *header, uint64_t chunk);
+uint64_t qrng_container_file_size(const qrng_container_header_t *header);
+
+// Reader side, usable without sd-bus (link container.c alone): maps a
+// complete container read-only. Opening checks the
+// header, trailer and index checksums; chunks are checked on demand, so
+// many threads can verify disjoint chunks in parallel.
+typedef struct qrng_container qrng_container_t;
+
+int qrng_container_open(const char *path, qrng_container_t **ret);
+void qrng_container_close(qrng_container_t *container);
+
+const qrng_container_header_t *qrng_container_get_header(qrng_container_t *container);
+
+// Chunk data (chunk_size bytes) and, if entry is not NULL, its index entry.
+// NULL if chunk is out of range.
+const void *qrng_container_chunk(qrng_container_t *container, uint64_t chunk,
+                                 qrng_chunk_entry_t *entry);
+
+// 0 if the chunk matches its checksum, -EBADMSG if not, -ERANGE if chunk
+// is out of range.
+int qrng_container_verify(qrng_container_t *container, uint64_t chunk);
+
+// Claim up to max consecutive chunks that no other caller (in any thread)
+// has claimed since the last rewind. Returns the number claimed, starting
+// at *first, or 0 once every chunk is taken.
+uint64_t qrng_container_claim(qrng_container_t *container, uint64_t max, uint64_t *first);
+void qrng_container_rewind(qrng_container_t *container);
+
+#endif
@@ -0,0 +1,1184 @@
+// Daemon mode: one bus client shared by many local processes.
+//
+// Clients connect to a Unix stream socket and pipeline requests:
+//
+//   request:  uint32 length
+//   response: int32 status (0 or -errno), uint32 length, length bytes
+//
+// Integers are in host byte order and responses come back in request order.
+// Clients are grouped into tenants by uid (SO_PEERCRED). Requests are split
+// into chunks of at most one quantum and issued upstream with weighted
+// deficit round-robin across tenants, so a bulk consumer cannot starve small
+// ones. A tenant may have a byte/sec quota (token bucket) and a latency SLO;
+// a request whose estimated queueing delay exceeds the SLO is answered at
+// once with -EBUSY instead of being queued.
+//
+// Requests up to small_threshold bytes travel in their own lane: a separate
+// bus connection with its own in-flight window and DRR state, so a 32-byte
+// reply never sits in the socket behind a multi-megabyte one.
+//
+// Each lane's connections form a conn_pool, so a dropped bus connection
+// reissues the affected chunks instead of taking the daemon down.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "conn-pool.h"
+#include "modes.h"
+#include "qrng.h"
+
+#define DAEMON_MAX_EVENTS       64
+#define DAEMON_MAX_PIPELINE     32      // Pending requests per client connection
+#define DAEMON_RATE_WINDOW_USEC 100000  // Busy time per service rate sample
+#define DAEMON_HEADER_SIZE      8
+#define DAEMON_RECENT_USEC      10000000  // Window of the live latency percentiles
+
+// With lanes disabled only the bulk lane exists
+#define LANE_BULK  0
+#define LANE_SMALL 1
+#define N_LANES    2
+
+typedef struct daemon daemon_t;
+typedef struct client client_t;
+typedef struct tenant tenant_t;
+typedef struct lane lane_t;
+typedef struct daemon_request daemon_request_t;
+
+// Everything registered with epoll starts with its type
+enum {
+    SOURCE_LISTEN,
+    SOURCE_LANE,
+    SOURCE_CLIENT,
+};
+
+// A tenant's scheduling state within one lane
+typedef struct {
+    // Requests that still have bytes to issue, in arrival order
+    daemon_request_t *queue_head;
+    daemon_request_t *queue_tail;
+    uint64_t backlog;             // Unissued bytes in the queue
+
+    // Deficit round-robin state
+    uint64_t deficit;
+    int active;
+    tenant_t *next_active;
+
+    uint64_t requests;
+    uint64_t bytes;
+    qrng_sketch_t latency;
+} tenant_lane_t;
+
+struct tenant {
+    uid_t uid;
+    uint32_t weight;
+    uint64_t quota;               // Bytes/sec, 0 = unlimited
+    uint64_t slo_usec;            // 0 = no admission control
+    qrng_bucket_t bucket;
+
+    tenant_lane_t lanes[N_LANES];
+
+    uint64_t outstanding;         // Response bytes allocated for its requests
+    uint64_t requests;
+    uint64_t rejected;
+    uint64_t failed;
+
+    tenant_t *next;
+};
+
+struct lane {
+    int source;
+    int index;
+    const char *name;
+    conn_pool_t *pool;
+    uint32_t window;
+    uint32_t in_flight;
+
+    tenant_t *active_head;
+    tenant_t *active_tail;
+    uint32_t n_active;
+
+    // Service rate estimate, measured over time with chunks in flight
+    double service_rate;          // Bytes/sec, 0 until the first sample
+    uint64_t busy_since;
+    uint64_t busy_usec;
+    uint64_t busy_bytes;
+
+    uint64_t calls;
+    uint64_t errors;
+    qrng_window_t recent;         // Request latency over the last DAEMON_RECENT_USEC
+};
+
+// Owned by its client's queue until answered; the tenant queue and
+// in-flight chunks keep it alive after the client goes away
+struct daemon_request {
+    client_t *client;             // NULL once the client is gone
+    tenant_t *tenant;
+    lane_t *lane;
+    uint32_t length;
+    uint32_t issued;              // Bytes handed upstream (or abandoned)
+    uint32_t chunks_in_flight;
+    int in_tenant_queue;
+    int status;
+    int done;
+    uint64_t arrival_usec;
+    uint64_t issue_usec;          // First chunk handed upstream
+    uint64_t reply_usec;          // Last chunk answered
+    uint32_t lane_in_flight;      // Lane's upstream calls and tenant's backlog on arrival
+    uint32_t backlog;
+
+    uint8_t *response;            // Header followed by payload
+    size_t response_len;
+    size_t response_cap;          // Allocated size, for qrng_buf_free
+    size_t written;
+
+    daemon_request_t *next_in_client;
+    daemon_request_t *next_in_tenant;
+};
+
+struct client {
+    int source;
+    int fd;
+    uid_t uid;
+    pid_t pid;
+    tenant_t *tenant;
+    uint8_t header[4];
+    size_t header_len;
+    uint32_t epoll_events;
+
+    // Requests in arrival order; responses are written from the head
+    daemon_request_t *head;
+    daemon_request_t *tail;
+    uint32_t pending;
+
+    client_t *next;
+};
+
+typedef struct {
+    daemon_t *d;
+    daemon_request_t *req;
+    uint32_t offset;
+    uint32_t length;
+} chunk_t;
+
+struct daemon {
+    const daemon_options_t *opts;
+    int epfd;
+    int listen_source;
+    int listen_fd;
+
+    lane_t lanes[N_LANES];
+    int n_lanes;
+
+    tenant_t *tenants;
+    client_t *clients;
+
+    uint64_t quota_wake_usec;     // Earliest time a quota-blocked tenant can go, 0 if none
+    uint64_t start_usec;
+    qrng_cpu_stat_t cpu_start;    // cgroup CPU counters at start_usec
+    flight_recorder_t *flight;
+    int fatal;
+};
+
+static volatile sig_atomic_t daemon_stop = 0;
+static volatile sig_atomic_t daemon_report = 0;
+
+static void daemon_signal_handler(int sig) {
+    if (sig == SIGUSR1) {
+        daemon_report = 1;
+    } else {
+        daemon_stop = 1;
+    }
+}
+
+int daemon_parse_tenant(const char *spec, tenant_config_t *out) {
+    char *end;
+
+    memset(out, 0, sizeof(*out));
+    out->weight = 1;
+
+    out->uid = (uid_t)strtoul(spec, &end, 10);
+    if (end == spec) {
+        return -EINVAL;
+    }
+    if (*end == ':') {
+        spec = end + 1;
+        out->weight = (uint32_t)strtoul(spec, &end, 10);
+        if (end == spec || out->weight == 0) {
+            return -EINVAL;
+        }
+    }
+    if (*end == ':') {
+        spec = end + 1;
+        out->quota = strtoull(spec, &end, 10);
+    }
+    if (*end == ':') {
+        spec = end + 1;
+        out->slo_ms = strtoull(spec, &end, 10);
+    }
+    return *end == '\0' ? 0 : -EINVAL;
+}
+
+static tenant_t *tenant_new(daemon_t *d, const tenant_config_t *config) {
+    tenant_t *t = calloc(1, sizeof(*t));
+
+    if (!t) {
+        return NULL;
+    }
+    t->uid = config->uid;
+    t->weight = config->weight;
+    t->quota = config->quota;
+    t->slo_usec = config->slo_ms * 1000;
+    if (t->quota > 0) {
+        // One second of burst, but never less than a chunk so it can progress
+        double burst = t->quota > d->opts->quantum ? t->quota : d->opts->quantum;
+        qrng_bucket_init(&t->bucket, (double)t->quota, burst, qrng_now_usec());
+    }
+    t->next = d->tenants;
+    d->tenants = t;
+    return t;
+}
+
+static tenant_t *tenant_get(daemon_t *d, uid_t uid) {
+    for (tenant_t *t = d->tenants; t; t = t->next) {
+        if (t->uid == uid) {
+            return t;
+        }
+    }
+
+    tenant_config_t config = { .uid = uid, .weight = 1 };
+    return tenant_new(d, &config);
+}
+
+static void active_push(lane_t *lane, tenant_t *t) {
+    t->lanes[lane->index].next_active = NULL;
+    if (lane->active_tail) {
+        lane->active_tail->lanes[lane->index].next_active = t;
+    } else {
+        lane->active_head = t;
+    }
+    lane->active_tail = t;
+}
+
+static tenant_t *active_pop(lane_t *lane) {
+    tenant_t *t = lane->active_head;
+    tenant_lane_t *tl = &t->lanes[lane->index];
+
+    lane->active_head = tl->next_active;
+    if (!lane->active_head) {
+        lane->active_tail = NULL;
+    }
+    tl->next_active = NULL;
+    return t;
+}
+
+static void request_free(daemon_request_t *req) {
+    req->tenant->outstanding -= req->response_cap;
+    qrng_buf_free(req->response, req->response_cap);
+    free(req);
+}
+
+// Free a request nobody refers to anymore
+static void request_release(daemon_request_t *req) {
+    if (!req->client && !req->in_tenant_queue && req->chunks_in_flight == 0) {
+        request_free(req);
+    }
+}
+
+// Give up on the bytes of req that have not been issued yet
+static void request_abandon(daemon_request_t *req) {
+    if (req->issued < req->length) {
+        req->tenant->lanes[req->lane->index].backlog -= req->length - req->issued;
+        req->issued = req->length;
+    }
+}
+
+static void client_update_events(daemon_t *d, client_t *c) {
+    uint32_t events = 0;
+
+    if (c->pending < DAEMON_MAX_PIPELINE) {
+        events |= EPOLLIN;
+    }
+    if (c->head && c->head->done) {
+        events |= EPOLLOUT;
+    }
+    if (events != c->epoll_events) {
+        struct epoll_event ev = { .events = events, .data.ptr = c };
+        epoll_ctl(d->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->epoll_events = events;
+    }
+}
+
+static void client_close(daemon_t *d, client_t *c) {
+    epoll_ctl(d->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    // Abandon work that has not been issued; in-flight chunks finish on
+    // their own and are discarded
+    daemon_request_t *req = c->head;
+    while (req) {
+        daemon_request_t *next = req->next_in_client;
+        if (!req->done && req->lane) {
+            request_abandon(req);
+        }
+        req->client = NULL;
+        request_release(req);
+        req = next;
+    }
+
+    for (client_t **p = &d->clients; *p; p = &(*p)->next) {
+        if (*p == c) {
+            *p = c->next;
+            break;
+        }
+    }
+    free(c);
+}
+
+// Write answered requests from the head of the client's queue. Returns -1
+// if the client had to be closed.
+static int client_flush(daemon_t *d, client_t *c) {
+    while (c->head && c->head->done) {
+        daemon_request_t *req = c->head;
+        ssize_t n = send(c->fd, req->response + req->written, req->response_len - req->written,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            client_close(d, c);
+            return -1;
+        }
+        req->written += n;
+        if (req->written < req->response_len) {
+            continue;
+        }
+
+        c->head = req->next_in_client;
+        if (!c->head) {
+            c->tail = NULL;
+        }
+        c->pending--;
+        req->client = NULL;
+        request_release(req);
+    }
+    client_update_events(d, c);
+    return 0;
+}
+
+// All bytes are in (or the request failed): fill in the header, record
+// statistics and try to send. Returns -1 if the client had to be closed.
+static int request_complete(daemon_t *d, daemon_request_t *req) {
+    tenant_t *t = req->tenant;
+    int32_t status = req->status;
+    uint32_t length = status == 0 ? req->length : 0;
+
+    flight_record_t rec = {
+        .start_usec = req->arrival_usec,
+        .issue_usec = req->issue_usec,
+        .reply_usec = req->reply_usec,
+        .done_usec = qrng_now_usec(),
+        .bytes = req->length,
+        .status = status,
+        .in_flight = req->lane_in_flight,
+        .queued = req->backlog,
+        .id = t->uid,
+    };
+    flight_record(d->flight, &rec);
+
+    if (!req->client) {
+        request_release(req);
+        return 0;
+    }
+
+    memcpy(req->response, &status, 4);
+    memcpy(req->response + 4, &length, 4);
+    req->response_len = DAEMON_HEADER_SIZE + length;
+    req->done = 1;
+
+    if (status == 0) {
+        tenant_lane_t *tl = &t->lanes[req->lane->index];
+        tl->bytes += length;
+        qrng_sketch_add(&tl->latency, rec.done_usec - req->arrival_usec);
+        qrng_window_add(&req->lane->recent, rec.done_usec - req->arrival_usec, rec.done_usec);
+    } else if (status != -EBUSY && status != -ENOBUFS) {
+        t->failed++;
+    }
+
+    return client_flush(d, req->client);
+}
+
+// Estimated time for this tenant to get len more bytes through the lane,
+// given its DRR share of the lane's measured service rate and its quota
+static uint64_t estimate_delay_usec(lane_t *lane, tenant_t *t, uint64_t len) {
+    tenant_lane_t *tl = &t->lanes[lane->index];
+
+    if (lane->service_rate <= 0) {
+        return 0;
+    }
+
+    uint64_t weights = tl->active ? 0 : t->weight;
+    for (tenant_t *a = lane->active_head; a; a = a->lanes[lane->index].next_active) {
+        weights += a->weight;
+    }
+    double rate = lane->service_rate * t->weight / weights;
+    if (t->quota > 0 && t->quota < rate) {
+        rate = (double)t->quota;
+    }
+    return (uint64_t)((tl->backlog + len) / rate * 1e6);
+}
+
+// Returns -1 if the client had to be closed
+static int request_arrived(daemon_t *d, client_t *c, uint32_t length) {
+    tenant_t *t = c->tenant;
+    daemon_request_t *req = calloc(1, sizeof(*req));
+
+    if (!req) {
+        client_close(d, c);
+        return -1;
+    }
+    req->client = c;
+    req->tenant = t;
+    req->length = length;
+    req->arrival_usec = qrng_now_usec();
+    if (c->tail) {
+        c->tail->next_in_client = req;
+    } else {
+        c->head = req;
+    }
+    c->tail = req;
+    c->pending++;
+    t->requests++;
+
+    lane_t *lane = &d->lanes[d->n_lanes > 1 && length <= d->opts->small_threshold ? LANE_SMALL
+                                                                                  : LANE_BULK];
+    req->lane = lane;
+    req->lane_in_flight = lane->in_flight;
+    req->backlog = (uint32_t)t->lanes[lane->index].backlog;
+    t->lanes[lane->index].requests++;
+
+    int status = 0;
+    if (length == 0) {
+        status = -EINVAL;
+    } else if (length > d->opts->max_request) {
+        status = -EMSGSIZE;
+    } else if (t->outstanding + length > d->opts->max_outstanding) {
+        // Responses are allocated on arrival, so one uid pipelining on
+        // many connections must not be able to exhaust the daemon's memory
+        status = -ENOBUFS;
+        t->rejected++;
+    } else if (t->slo_usec > 0 && estimate_delay_usec(lane, t, length) > t->slo_usec) {
+        status = -EBUSY;
+        t->rejected++;
+    }
+
+    req->response_cap = DAEMON_HEADER_SIZE + (status == 0 ? length : 0);
+    req->response = qrng_buf_alloc(req->response_cap);
+    if (!req->response && status == 0) {
+        status = -ENOMEM;
+        req->response_cap = DAEMON_HEADER_SIZE;
+        req->response = qrng_buf_alloc(req->response_cap);
+    }
+    if (!req->response) {
+        // Never queued, so there is nothing for client_close to abandon
+        req->response_cap = 0;
+        req->issued = length;
+        client_close(d, c);
+        return -1;
+    }
+    t->outstanding += req->response_cap;
+
+    if (status < 0) {
+        req->status = status;
+        req->issued = length;
+        return request_complete(d, req);
+    }
+
+    tenant_lane_t *tl = &t->lanes[lane->index];
+    if (tl->queue_tail) {
+        tl->queue_tail->next_in_tenant = req;
+    } else {
+        tl->queue_head = req;
+    }
+    tl->queue_tail = req;
+    req->in_tenant_queue = 1;
+    tl->backlog += length;
+    if (!tl->active) {
+        tl->active = 1;
+        tl->deficit = 0;
+        active_push(lane, t);
+        lane->n_active++;
+    }
+    return 0;
+}
+
+static void update_service_rate(lane_t *lane, uint64_t now, uint32_t bytes) {
+    lane->busy_bytes += bytes;
+    if (lane->in_flight == 0) {
+        lane->busy_usec += now - lane->busy_since;
+        lane->busy_since = 0;
+    }
+
+    uint64_t busy = lane->busy_usec + (lane->busy_since ? now - lane->busy_since : 0);
+    if (busy < DAEMON_RATE_WINDOW_USEC) {
+        return;
+    }
+    double sample = lane->busy_bytes * 1e6 / busy;
+    lane->service_rate = lane->service_rate > 0 ? 0.8 * lane->service_rate + 0.2 * sample : sample;
+    lane->busy_bytes = 0;
+    lane->busy_usec = 0;
+    if (lane->busy_since) {
+        lane->busy_since = now;
+    }
+}
+
+static int chunk_callback(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    chunk_t *chunk = userdata;
+    daemon_t *d = chunk->d;
+    daemon_request_t *req = chunk->req;
+    lane_t *lane = req->lane;
+    const void *ptr = NULL;
+    size_t octets_len = 0;
+    int32_t status = 0;
+    int ret = 0;
+
+    lane->in_flight--;
+    req->chunks_in_flight--;
+    req->reply_usec = qrng_now_usec();
+    update_service_rate(lane, req->reply_usec, chunk->length);
+
+    if (ret_error && sd_bus_error_is_set(ret_error)) {
+        ret = -sd_bus_error_get_errno(ret_error);
+        ret = ret < 0 ? ret : -EIO;
+    } else if (sd_bus_message_is_method_error(reply, NULL)) {
+        ret = -sd_bus_message_get_errno(reply);
+        ret = ret < 0 ? ret : -EIO;
+    } else if ((ret = sd_bus_message_read(reply, "i", &status)) < 0 ||
+               (ret = sd_bus_message_read_array(reply, 'y', &ptr, &octets_len)) < 0) {
+        // ret already set
+    } else if (status != 0 || octets_len != chunk->length) {
+        ret = -EIO;
+    }
+
+    if (ret < 0) {
+        lane->errors++;
+        fprintf(stderr, "Upstream chunk failed (uid %u, %u bytes): %s\n",
+                req->tenant->uid, chunk->length, strerror(-ret));
+        if (req->status == 0) {
+            req->status = ret;
+            // Do not issue the rest of a failed request
+            request_abandon(req);
+        }
+    } else if (req->client && req->status == 0) {
+        memcpy(req->response + DAEMON_HEADER_SIZE + chunk->offset, ptr, chunk->length);
+    }
+
+    if (req->chunks_in_flight == 0 && req->issued == req->length) {
+        request_complete(d, req);
+    }
+    free(chunk);
+    return 0;
+}
+
+static int issue_chunk(daemon_t *d, daemon_request_t *req, uint32_t length) {
+    lane_t *lane = req->lane;
+    chunk_t *chunk = malloc(sizeof(*chunk));
+    int ret;
+
+    if (!chunk) {
+        return -ENOMEM;
+    }
+    chunk->d = d;
+    chunk->req = req;
+    chunk->offset = req->issued;
+    chunk->length = length;
+
+    ret = conn_pool_read_async(lane->pool, length, chunk_callback, chunk);
+    if (ret < 0) {
+        free(chunk);
+        return ret;
+    }
+
+    if (lane->in_flight == 0) {
+        lane->busy_since = qrng_now_usec();
+    }
+    if (req->issued == 0) {
+        req->issue_usec = qrng_now_usec();
+    }
+    lane->in_flight++;
+    lane->calls++;
+    req->chunks_in_flight++;
+    req->issued += length;
+    req->tenant->lanes[lane->index].backlog -= length;
+    return 0;
+}
+
+// Drop requests at the head of the tenant queue with nothing left to issue
+static daemon_request_t *tenant_queue_head(tenant_lane_t *tl) {
+    while (tl->queue_head && tl->queue_head->issued == tl->queue_head->length) {
+        daemon_request_t *req = tl->queue_head;
+        tl->queue_head = req->next_in_tenant;
+        if (!tl->queue_head) {
+            tl->queue_tail = NULL;
+        }
+        req->next_in_tenant = NULL;
+        req->in_tenant_queue = 0;
+        request_release(req);
+    }
+    return tl->queue_head;
+}
+
+// Fill the lane's window with weighted deficit round-robin: every visit
+// adds quantum * weight to the tenant's deficit, and chunks are issued
+// while the deficit covers them.
+static void dispatch_lane(daemon_t *d, lane_t *lane, uint64_t now) {
+    uint32_t quota_blocked = 0;
+
+    while (lane->active_head && lane->in_flight < lane->window) {
+        tenant_t *t = lane->active_head;
+        tenant_lane_t *tl = &t->lanes[lane->index];
+        daemon_request_t *req = tenant_queue_head(tl);
+
+        if (!req) {
+            active_pop(lane);
+            tl->active = 0;
+            tl->deficit = 0;
+            lane->n_active--;
+            continue;
+        }
+
+        uint32_t length = req->length - req->issued;
+        if (length > d->opts->quantum) {
+            length = d->opts->quantum;
+        }
+
+        if (tl->deficit < length) {
+            // Out of credit for this round: top up and move to the back
+            tl->deficit += (uint64_t)d->opts->quantum * t->weight;
+            active_push(lane, active_pop(lane));
+            continue;
+        }
+
+        if (t->quota > 0 && !qrng_bucket_take(&t->bucket, length, now)) {
+            uint64_t wake = now + qrng_bucket_wait_usec(&t->bucket, length, now);
+            if (d->quota_wake_usec == 0 || wake < d->quota_wake_usec) {
+                d->quota_wake_usec = wake;
+            }
+            active_push(lane, active_pop(lane));
+            // Stop once every active tenant is waiting for its quota
+            if (++quota_blocked >= lane->n_active) {
+                break;
+            }
+            continue;
+        }
+
+        int ret = issue_chunk(d, req, length);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to issue async method call: %s\n", strerror(-ret));
+            d->fatal = ret;
+            return;
+        }
+        tl->deficit -= length;
+        quota_blocked = 0;
+    }
+}
+
+static void dispatch(daemon_t *d) {
+    uint64_t now = qrng_now_usec();
+
+    d->quota_wake_usec = 0;
+    for (int i = 0; i < d->n_lanes && !d->fatal; i++) {
+        dispatch_lane(d, &d->lanes[i], now);
+    }
+}
+
+static void client_accept(daemon_t *d) {
+    for (;;) {
+        int fd = accept4(d->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                fprintf(stderr, "Failed to accept client: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0) {
+            fprintf(stderr, "Failed to get peer credentials: %s\n", strerror(errno));
+            close(fd);
+            continue;
+        }
+
+        client_t *c = calloc(1, sizeof(*c));
+        tenant_t *t = c ? tenant_get(d, cred.uid) : NULL;
+        if (!t) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->source = SOURCE_CLIENT;
+        c->fd = fd;
+        c->uid = cred.uid;
+        c->pid = cred.pid;
+        c->tenant = t;
+        c->epoll_events = EPOLLIN;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->next = d->clients;
+        d->clients = c;
+
+        if (d->opts->log_to_stdout) {
+            printf("Client connected: pid %d uid %u\n", (int)c->pid, c->uid);
+        }
+    }
+}
+
+static void client_read(daemon_t *d, client_t *c) {
+    while (c->pending < DAEMON_MAX_PIPELINE) {
+        ssize_t n = read(c->fd, c->header + c->header_len, sizeof(c->header) - c->header_len);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            break;
+        }
+        if (n <= 0) {
+            client_close(d, c);
+            return;
+        }
+        c->header_len += n;
+        if (c->header_len < sizeof(c->header)) {
+            continue;
+        }
+
+        uint32_t length;
+        memcpy(&length, c->header, 4);
+        c->header_len = 0;
+        if (request_arrived(d, c, length) < 0) {
+            return;
+        }
+    }
+    client_update_events(d, c);
+}
+
+static void print_latency(const char *label, const qrng_sketch_t *h) {
+    printf("%s latency avg %.2f ms p50 %.2f ms p99 %.2f ms max %.2f ms", label,
+           h->total ? h->sum / (double)h->total / 1000 : 0.0,
+           qrng_sketch_quantile(h, 0.5) / 1000.0, qrng_sketch_quantile(h, 0.99) / 1000.0,
+           h->max / 1000.0);
+}
+
+static void print_daemon_report(daemon_t *d) {
+    uint64_t now = qrng_now_usec();
+    double secs = (now - d->start_usec) / 1e6;
+    qrng_sketch_t recent;
+
+    printf("Daemon up %.1f s\n", secs);
+    for (int i = 0; i < d->n_lanes; i++) {
+        lane_t *lane = &d->lanes[i];
+        printf("  %s lane: window %u, %lu upstream calls (%lu failed), service rate %.1f KiB/s\n",
+               lane->name, lane->window, lane->calls, lane->errors, lane->service_rate / 1024);
+        qrng_window_snapshot(&lane->recent, now, &recent);
+        print_latency("    last 10 s:", &recent);
+        printf(" (%lu requests)\n", recent.total);
+        conn_pool_stats_t stats;
+        conn_pool_get_stats(lane->pool, &stats);
+        printf("    %u/%u connections up, %lu disconnects, %lu chunks reissued, "
+               "recovery avg %.1f ms max %.1f ms\n",
+               stats.healthy, d->opts->pool.connections, stats.disconnects, stats.reissued,
+               stats.recoveries ? stats.recovery_usec_total / 1000.0 / stats.recoveries : 0.0,
+               stats.recovery_usec_max / 1000.0);
+        printf("    rcvbuf %d, sndbuf %d, read queue max %lu, write queue max %lu (limited %lu times)\n",
+               stats.rcvbuf, stats.sndbuf, stats.rqueue_max, stats.wqueue_max, stats.write_limited);
+        if (stats.service_outages > 0) {
+            printf("    service %s, %lu restarts, recovery avg %.1f ms max %.1f ms\n",
+                   stats.service_up ? "up" : "gone", stats.service_outages,
+                   stats.service_recoveries
+                       ? stats.service_recovery_usec_total / 1000.0 / stats.service_recoveries
+                       : 0.0,
+                   stats.service_recovery_usec_max / 1000.0);
+        }
+    }
+    qrng_buf_stats_t bufs;
+    struct rusage usage;
+    qrng_buf_get_stats(&bufs);
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  buffers: %lu allocations (%lu from thread caches, %lu from depot, %lu large), "
+           "%.1f KiB reserved, %.1f KiB in depot; peak RSS %.1f MiB\n",
+           bufs.allocs, bufs.thread_hits, bufs.depot_hits, bufs.large,
+           bufs.reserved_bytes / 1024.0, bufs.depot_bytes / 1024.0, usage.ru_maxrss / 1024.0);
+    print_process_load("  ", d->start_usec);
+    print_cpu_throttling("  ", &d->cpu_start);
+    for (tenant_t *t = d->tenants; t; t = t->next) {
+        printf("  uid %u (weight %u, quota %lu B/s, SLO %lu ms): %lu requests, %lu rejected, "
+               "%lu failed\n",
+               t->uid, t->weight, t->quota, t->slo_usec / 1000, t->requests, t->rejected,
+               t->failed);
+        for (int i = 0; i < d->n_lanes; i++) {
+            tenant_lane_t *tl = &t->lanes[i];
+            if (tl->requests == 0) {
+                continue;
+            }
+            printf("    %s: %lu requests, %lu bytes, %.1f KiB/s,", d->lanes[i].name,
+                   tl->requests, tl->bytes, secs > 0 ? tl->bytes / secs / 1024 : 0.0);
+            print_latency("", &tl->latency);
+            printf("\n");
+        }
+    }
+    fflush(stdout);
+}
+
+static int listen_socket(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    // Tenants are told apart by uid, so other users must be able to connect
+    chmod(path, 0666);
+    return fd;
+}
+
+static int lane_init(daemon_t *d, lane_t *lane, int index, const char *name, uint32_t window) {
+    conn_pool_config_t config = d->opts->pool;
+    int ret;
+
+    lane->source = SOURCE_LANE;
+    lane->index = index;
+    lane->name = name;
+    lane->window = window;
+    qrng_window_init(&lane->recent, DAEMON_RECENT_USEC);
+
+    ret = conn_pool_new(&config, &lane->pool);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to bus: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = lane };
+    if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, conn_pool_get_fd(lane->pool), &ev) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+// Deliver replies until sd-bus runs out of work, issuing new chunks as
+// window slots free up
+static int lane_process(daemon_t *d, lane_t *lane) {
+    int ret;
+
+    do {
+        dispatch_lane(d, lane, qrng_now_usec());
+        ret = conn_pool_process(lane->pool);
+    } while (ret > 0 && !d->fatal);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to process bus (%s lane): %s\n", lane->name, strerror(-ret));
+    }
+    return ret;
+}
+
+int run_daemon(const daemon_options_t *opts) {
+    daemon_t d = { .opts = opts, .epfd = -1, .listen_source = SOURCE_LISTEN, .listen_fd = -1 };
+    struct epoll_event events[DAEMON_MAX_EVENTS];
+    int ret = 0;
+
+    d.start_usec = qrng_now_usec();
+    qrng_cpu_stat(qrng_limits(), &d.cpu_start);
+    for (size_t i = 0; i < opts->n_tenants; i++) {
+        if (!tenant_new(&d, &opts->tenants[i])) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+    ret = flight_new(&opts->flight, &d.flight);
+    if (ret < 0) {
+        goto out;
+    }
+
+    d.listen_fd = listen_socket(opts->socket_path);
+    if (d.listen_fd < 0) {
+        ret = d.listen_fd;
+        fprintf(stderr, "Failed to listen on %s: %s\n", opts->socket_path, strerror(-ret));
+        goto out;
+    }
+
+    d.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (d.epfd < 0) {
+        ret = -errno;
+        goto out;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &d.listen_source };
+    epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.listen_fd, &ev);
+
+    d.n_lanes = 1;
+    ret = lane_init(&d, &d.lanes[LANE_BULK], LANE_BULK, "bulk", opts->window);
+    if (ret >= 0 && opts->small_threshold > 0) {
+        // Small requests get their own connections so their replies are not
+        // queued in the same socket behind bulk transfers
+        d.n_lanes = N_LANES;
+        ret = lane_init(&d, &d.lanes[LANE_SMALL], LANE_SMALL, "small", opts->small_window);
+    }
+    if (ret < 0) {
+        goto out;
+    }
+
+    struct sigaction sa = { .sa_handler = daemon_signal_handler };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    flight_handle_signals();
+
+    if (opts->log_to_stdout) {
+        printf("Serving %s: bulk window %u, quantum %u bytes, max request %u bytes, "
+               "%lu bytes outstanding per tenant", opts->socket_path, opts->window,
+               opts->quantum, opts->max_request, opts->max_outstanding);
+        if (d.n_lanes > 1) {
+            printf(", small lane up to %u bytes with window %u", opts->small_threshold,
+                   opts->small_window);
+        }
+        printf("\n");
+    }
+
+    while (!daemon_stop && !d.fatal) {
+        if (daemon_report) {
+            daemon_report = 0;
+            print_daemon_report(&d);
+        }
+
+        uint64_t until = UINT64_MAX;
+        for (int i = 0; i < d.n_lanes; i++) {
+            ret = lane_process(&d, &d.lanes[i]);
+            if (ret < 0) {
+                goto done;
+            }
+        }
+        dispatch(&d);
+        for (int i = 0; i < d.n_lanes; i++) {
+            uint64_t lane_until = conn_pool_prepare(d.lanes[i].pool);
+            until = lane_until < until ? lane_until : until;
+        }
+        if (d.quota_wake_usec && d.quota_wake_usec < until) {
+            until = d.quota_wake_usec;
+        }
+        ret = 0;
+
+        uint64_t now = qrng_now_usec();
+        uint32_t in_flight = 0;
+        for (int i = 0; i < d.n_lanes; i++) {
+            in_flight += d.lanes[i].in_flight;
+        }
+        uint64_t stall_wait = flight_poll(d.flight, now, in_flight);
+        if (stall_wait != UINT64_MAX && now + stall_wait < until) {
+            until = now + stall_wait;
+        }
+        int timeout = until == UINT64_MAX ? -1
+                    : until <= now         ? 0
+                                           : (int)((until - now + 999) / 1000);
+        int n = epoll_wait(d.epfd, events, DAEMON_MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = -errno;
+            fprintf(stderr, "Failed to wait for events: %s\n", strerror(-ret));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int *source = events[i].data.ptr;
+            if (*source == SOURCE_LANE) {
+                continue; // Handled by lane_process at the top of the loop
+            }
+            if (*source == SOURCE_LISTEN) {
+                client_accept(&d);
+                continue;
+            }
+
+            client_t *c = (client_t *)source;
+            if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                if (client_flush(&d, c) < 0) {
+                    continue;
+                }
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                client_read(&d, c);
+            }
+        }
+    }
+done:
+    if (d.fatal) {
+        ret = d.fatal;
+    }
+
+    print_daemon_report(&d);
+
+out:
+    while (d.clients) {
+        client_close(&d, d.clients);
+    }
+    while (d.tenants) {
+        tenant_t *t = d.tenants;
+        d.tenants = t->next;
+        free(t);
+    }
+    if (d.epfd >= 0) {
+        close(d.epfd);
+    }
+    if (d.listen_fd >= 0) {
+        close(d.listen_fd);
+        unlink(opts->socket_path);
+    }
+    for (int i = 0; i < d.n_lanes; i++) {
+        conn_pool_free(d.lanes[i].pool);
+    }
+    flight_free(d.flight);
+    return ret;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n < 0 ? -errno : -ECONNRESET;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_request(int fd, uint32_t length) {
+    if (send(fd, &length, sizeof(length), MSG_NOSIGNAL) != sizeof(length)) {
+        return -errno;
+    }
+    return 0;
+}
+
+int run_daemon_client(const char *socket_path, int iterations, uint32_t num_bytes,
+                      int window, int log_to_stdout) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    qrng_sketch_t latency = {0};
+    uint64_t *sent_at = NULL;
+    uint8_t *buf = NULL;
+    int completed = 0, failed = 0, sent = 0;
+    int fd = -1;
+    int ret;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    if (window > DAEMON_MAX_PIPELINE) {
+        window = DAEMON_MAX_PIPELINE;
+    }
+    sent_at = calloc(window, sizeof(*sent_at));
+    buf = malloc(num_bytes);
+    if (!sent_at || !buf) {
+        fprintf(stderr, "Failed to allocate memory for client buffers\n");
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ret = -errno;
+        fprintf(stderr, "Failed to connect to %s: %s\n", socket_path, strerror(-ret));
+        goto out;
+    }
+
+    uint64_t start = qrng_now_usec();
+    ret = 0;
+    while (completed + failed < iterations) {
+        // Keep the pipeline full; responses arrive in order, so slot i % window
+        // always belongs to the oldest outstanding request
+        while (sent < iterations && sent - (completed + failed) < window) {
+            sent_at[sent % window] = qrng_now_usec();
+            ret = send_request(fd, num_bytes);
+            if (ret < 0) {
+                fprintf(stderr, "Failed to send request %d: %s\n", sent + 1, strerror(-ret));
+                goto out;
+            }
+            sent++;
+        }
+
+        int32_t header[2];
+        ret = read_full(fd, header, sizeof(header));
+        if (ret == 0 && header[0] == 0) {
+            // The length comes from whoever is listening on the socket
+            ret = (uint32_t)header[1] == num_bytes ? read_full(fd, buf, num_bytes) : -EPROTO;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Failed to read response: %s\n", strerror(-ret));
+            goto out;
+        }
+
+        int id = completed + failed;
+        if (header[0] != 0) {
+            fprintf(stderr, "Request %d failed: %s\n", id + 1, strerror(-header[0]));
+            failed++;
+            continue;
+        }
+        qrng_sketch_add(&latency, qrng_now_usec() - sent_at[id % window]);
+        completed++;
+
+        if (iterations == 1) {
+            print_octets(buf, (uint32_t)header[1], log_to_stdout);
+        } else if (log_to_stdout) {
+            printf("Request %d: received %d bytes\n", id + 1, header[1]);
+        }
+    }
+
+    double secs = (qrng_now_usec() - start) / 1e6;
+    printf("Completed %d requests (%d successful, %d failed) in %.3f s: %.1f req/s, %.1f KiB/s, "
+           "latency avg %.3f ms p50 %.3f ms p99 %.3f ms max %.3f ms\n",
+           iterations, completed, failed, secs, completed / secs,
+           (double)completed * num_bytes / secs / 1024,
+           latency.total ? latency.sum / (double)latency.total / 1000 : 0.0,
+           qrng_sketch_quantile(&latency, 0.5) / 1000.0, qrng_sketch_quantile(&latency, 0.99) / 1000.0,
+           latency.max / 1000.0);
+    if (failed > 0) {
+        ret = -EIO;
+    }
+
+out:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(sent_at);
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,870 @@
+// File generation mode: writes num_chunks replies of chunk_size bytes to a
+// file, each at its own offset, so replies can complete in any order.
+//
+// Completed chunks are recorded in PATH.journal, but only after the data
+// itself has been synced: every sync_bytes (or once a second) the output
+// is fdatasync'ed, then the chunks finished since the last sync are
+// appended to the journal as merged ranges and the journal is synced. A
+// crash therefore loses at most the last batch, and --resume fetches only
+// the chunks the journal does not list. The journal is removed once the
+// file is complete.
+//
+// Journal layout (host byte order): a header {magic, num_chunks,
+// chunk_size, flags} followed by {first, count} range records. A torn
+// record at the end is ignored.
+//
+// With --container the file uses the format in container.h: each chunk's
+// index entry is written next to it and so is synced and journaled with
+// it, and the trailer is added once the last chunk is on disk.
+// run_file_verify() checks such a file with several threads.
+//
+// Scheduling: with N connections the job runs N workers, one per
+// connection, each with its own share of the calls in flight. Chunks start
+// out split into N contiguous ranges, one per worker. A worker takes chunks
+// from the front of its range; a worker whose range runs dry steals the
+// back half of the largest remaining range. A slow connection therefore
+// ends up with less of the file, and the job finishes at the aggregate
+// speed rather than that of the slowest connection.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conn-pool.h"
+#include "container.h"
+#include "modes.h"
+#include "qrng.h"
+
+#define JOURNAL_MAGIC        "QRNGJNL1"
+#define JOB_SYNC_USEC        1000000
+#define JOB_MAX_ATTEMPTS     3
+#define JOURNAL_CONTAINER    1   // Journal flag: the file is a container
+#define VERIFY_CLAIM         16  // Chunks a verify thread claims at a time
+#define VERIFY_MAX_REPORTED  10
+
+typedef struct {
+    char magic[8];
+    uint64_t num_chunks;
+    uint32_t chunk_size;
+    uint32_t flags;             // JOURNAL_CONTAINER
+} journal_header_t;
+
+typedef struct {
+    uint64_t first;
+    uint64_t count;
+} journal_range_t;
+
+typedef struct file_job file_job_t;
+typedef struct job_call job_call_t;
+
+typedef struct {
+    unsigned id;                // Also the connection it sends on
+    uint64_t lo, hi;            // Chunks it still owns: taken from lo, stolen from hi
+    job_call_t *retries_head;   // Its failed calls to issue again
+    unsigned window;            // Its share of the calls in flight
+    unsigned in_flight;
+    uint64_t busy_since;        // When in_flight last went from 0 to 1
+
+    uint64_t written;
+    uint64_t busy_usec;         // Time with at least one call in flight
+    uint64_t steals;            // Ranges it took from other workers
+    uint64_t stolen;            // Chunks other workers took from it
+} job_worker_t;
+
+struct job_call {
+    file_job_t *job;
+    job_worker_t *worker;
+    uint64_t chunk;
+    unsigned attempts;
+    uint64_t sent_usec;
+    job_call_t *next;           // Retry list link
+};
+
+struct file_job {
+    const file_job_options_t *opts;
+    conn_pool_t *pool;
+    int fd;
+    int journal_fd;
+    uint8_t *done;              // Bitmap of chunks written in this run or earlier
+    uint64_t *pending;          // Chunks written since the last journal sync
+    size_t n_pending;
+    size_t pending_cap;
+    job_worker_t *workers;
+    unsigned n_workers;
+    uint64_t remaining;         // Chunks not yet written
+    qrng_container_header_t container;  // Layout, if opts->container
+    unsigned in_flight;
+    uint64_t unsynced_bytes;
+    uint64_t last_sync_usec;
+    int error;                  // First fatal error, stops issuing
+
+    uint64_t written;
+    uint64_t skipped;
+    uint64_t retries;
+    uint64_t syncs;
+    uint64_t sync_usec;
+    qrng_sketch_t latency;
+};
+
+static volatile sig_atomic_t job_stop = 0;
+
+static void job_signal_handler(int sig) {
+    (void)sig;
+    job_stop = 1;
+}
+
+static int chunk_done(const file_job_t *job, uint64_t chunk) {
+    return job->done[chunk / 8] & (1 << (chunk % 8));
+}
+
+static uint64_t realtime_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t chunk_offset(const file_job_t *job, uint64_t chunk) {
+    if (job->opts->container) {
+        return qrng_container_chunk_offset(&job->container, chunk);
+    }
+    return chunk * job->opts->chunk_size;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    return n < 0 ? -errno : (size_t)n != len ? -EIO : 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Make the data durable, then record it
+static int job_sync(file_job_t *job) {
+    uint64_t start = qrng_now_usec();
+
+    job->last_sync_usec = start;
+    job->unsynced_bytes = 0;
+    if (job->n_pending == 0) {
+        return 0;
+    }
+    if (fdatasync(job->fd) < 0) {
+        return -errno;
+    }
+
+    // Completions are mostly in order, so they merge into a few ranges
+    qsort(job->pending, job->n_pending, sizeof(job->pending[0]), cmp_u64);
+    journal_range_t *ranges = malloc(job->n_pending * sizeof(*ranges));
+    if (!ranges) {
+        return -ENOMEM;
+    }
+    size_t n_ranges = 0;
+    for (size_t i = 0; i < job->n_pending; i++) {
+        if (n_ranges > 0 &&
+            ranges[n_ranges - 1].first + ranges[n_ranges - 1].count == job->pending[i]) {
+            ranges[n_ranges - 1].count++;
+        } else {
+            ranges[n_ranges].first = job->pending[i];
+            ranges[n_ranges].count = 1;
+            n_ranges++;
+        }
+    }
+    int ret = write_all(job->journal_fd, ranges, n_ranges * sizeof(*ranges));
+    free(ranges);
+    if (ret == 0 && fdatasync(job->journal_fd) < 0) {
+        ret = -errno;
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    job->n_pending = 0;
+    job->syncs++;
+    job->sync_usec += qrng_now_usec() - start;
+    return 0;
+}
+
+// Load the ranges of an existing journal into the bitmap
+static int journal_load(file_job_t *job, const char *path) {
+    const file_job_options_t *opts = job->opts;
+    journal_header_t header;
+    journal_range_t range;
+    ssize_t n;
+
+    n = read(job->journal_fd, &header, sizeof(header));
+    if (n != sizeof(header) || memcmp(header.magic, JOURNAL_MAGIC, 8) != 0) {
+        fprintf(stderr, "Failed to resume: %s is not a journal\n", path);
+        return -EINVAL;
+    }
+    if (header.num_chunks != opts->num_chunks || header.chunk_size != opts->chunk_size) {
+        fprintf(stderr, "Failed to resume: journal is for %lu chunks of %u bytes, not %lu of %u\n",
+                header.num_chunks, header.chunk_size, opts->num_chunks, opts->chunk_size);
+        return -EINVAL;
+    }
+    if (!(header.flags & JOURNAL_CONTAINER) != !opts->container) {
+        fprintf(stderr, "Failed to resume: journal is for a %s file; %s --container\n",
+                opts->container ? "plain" : "container", opts->container ? "drop" : "add");
+        return -EINVAL;
+    }
+
+    off_t valid = sizeof(header);
+    while ((n = read(job->journal_fd, &range, sizeof(range))) == sizeof(range)) {
+        if (range.first > opts->num_chunks || range.count > opts->num_chunks - range.first) {
+            break;
+        }
+        for (uint64_t c = range.first; c < range.first + range.count; c++) {
+            if (!chunk_done(job, c)) {
+                job->done[c / 8] |= 1 << (c % 8);
+                job->remaining--;
+                job->skipped++;
+            }
+        }
+        valid += sizeof(range);
+    }
+    if (n < 0) {
+        return -errno;
+    }
+
+    // Drop a torn or bad tail so new records follow the last good one
+    if (ftruncate(job->journal_fd, valid) < 0 || lseek(job->journal_fd, valid, SEEK_SET) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+// Take the layout of a container being resumed from its own header
+static int container_load(file_job_t *job) {
+    const file_job_options_t *opts = job->opts;
+    qrng_container_header_t header;
+
+    ssize_t n = pread(job->fd, &header, sizeof(header), 0);
+    if (n < 0) {
+        return -errno;
+    }
+    if (n != sizeof(header) || memcmp(header.magic, QRNG_CONTAINER_MAGIC, 8) != 0 ||
+        header.num_chunks != opts->num_chunks || header.chunk_size != opts->chunk_size) {
+        fprintf(stderr, "Failed to resume: %s does not have a matching container header\n",
+                opts->path);
+        return -EINVAL;
+    }
+    job->container = header;
+    return 0;
+}
+
+// Once every chunk is on disk, checksum the index and add the trailer that
+// marks the container complete
+static int container_finish(file_job_t *job) {
+    const qrng_container_header_t *h = &job->container;
+    qrng_chunk_entry_t entries[1024];
+    qrng_container_trailer_t trailer = {
+        .magic = QRNG_CONTAINER_TRAILER,
+        .num_chunks = h->num_chunks,
+    };
+    uint64_t chunk = 0;
+
+    while (chunk < h->num_chunks) {
+        size_t n = sizeof(entries) / sizeof(entries[0]);
+        if (n > h->num_chunks - chunk) {
+            n = h->num_chunks - chunk;
+        }
+        ssize_t got = pread(job->fd, entries, n * sizeof(entries[0]),
+                            (off_t)(h->index_offset + chunk * sizeof(entries[0])));
+        if (got < 0) {
+            return -errno;
+        }
+        if ((size_t)got != n * sizeof(entries[0])) {
+            return -EIO;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!(entries[i].flags & QRNG_CHUNK_PRESENT)) {
+                fprintf(stderr, "Failed to finish container: chunk %lu has no index entry\n",
+                        chunk + i);
+                return -EBADMSG;
+            }
+        }
+        trailer.index_crc = qrng_crc32c(trailer.index_crc, entries, n * sizeof(entries[0]));
+        chunk += n;
+    }
+
+    int ret = pwrite_all(job->fd, &trailer, sizeof(trailer),
+                         (off_t)(h->index_offset + h->num_chunks * sizeof(entries[0])));
+    if (ret == 0 && fdatasync(job->fd) < 0) {
+        ret = -errno;
+    }
+    return ret;
+}
+
+static int job_open(file_job_t *job) {
+    const file_job_options_t *opts = job->opts;
+    char *journal_path;
+    int ret = 0;
+
+    if (asprintf(&journal_path, "%s.journal", opts->path) < 0) {
+        return -ENOMEM;
+    }
+
+    if (opts->container) {
+        qrng_container_header_init(&job->container, opts->num_chunks, opts->chunk_size,
+                                   realtime_usec(), QRNG_SERVICE, QRNG_OBJECT_PATH);
+    }
+
+    if (opts->resume) {
+        job->journal_fd = open(journal_path, O_RDWR | O_CLOEXEC);
+        if (job->journal_fd < 0) {
+            ret = -errno;
+            fprintf(stderr, "Failed to resume from %s: %s\n", journal_path, strerror(-ret));
+            goto out;
+        }
+        job->fd = open(opts->path, O_RDWR | O_CLOEXEC);
+        if (job->fd < 0) {
+            ret = -errno;
+            fprintf(stderr, "Failed to resume %s: %s\n", opts->path, strerror(-ret));
+            goto out;
+        }
+        ret = journal_load(job, journal_path);
+        if (ret == 0 && opts->container) {
+            ret = container_load(job);
+        }
+        goto out;
+    }
+
+    job->journal_fd = open(journal_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (job->journal_fd < 0) {
+        ret = -errno;
+        if (ret == -EEXIST) {
+            fprintf(stderr, "Failed to start: %s exists; use --resume or remove it\n", journal_path);
+        } else {
+            fprintf(stderr, "Failed to create %s: %s\n", journal_path, strerror(-ret));
+        }
+        goto out;
+    }
+    job->fd = open(opts->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (job->fd < 0) {
+        ret = -errno;
+        fprintf(stderr, "Failed to create %s: %s\n", opts->path, strerror(-ret));
+        goto out;
+    }
+    uint64_t size = opts->num_chunks * opts->chunk_size;
+    if (opts->container) {
+        size = qrng_container_file_size(&job->container);
+    }
+    if (ftruncate(job->fd, (off_t)size) < 0) {
+        ret = -errno;
+        fprintf(stderr, "Failed to size %s: %s\n", opts->path, strerror(-ret));
+        goto out;
+    }
+    // The header must be on disk before the journal can vouch for chunks
+    if (opts->container) {
+        ret = pwrite_all(job->fd, &job->container, sizeof(job->container), 0);
+        if (ret == 0 && fdatasync(job->fd) < 0) {
+            ret = -errno;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Failed to write %s: %s\n", opts->path, strerror(-ret));
+            goto out;
+        }
+    }
+
+    journal_header_t header = {
+        .magic = JOURNAL_MAGIC,
+        .num_chunks = opts->num_chunks,
+        .chunk_size = opts->chunk_size,
+        .flags = opts->container ? JOURNAL_CONTAINER : 0,
+    };
+    ret = write_all(job->journal_fd, &header, sizeof(header));
+    if (ret == 0 && fsync(job->journal_fd) < 0) {
+        ret = -errno;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", journal_path, strerror(-ret));
+    }
+
+out:
+    // A fresh job that could not start leaves nothing to resume
+    if (ret < 0 && !opts->resume && job->journal_fd >= 0) {
+        unlink(journal_path);
+    }
+    free(journal_path);
+    return ret;
+}
+
+static void worker_done(job_worker_t *w) {
+    if (--w->in_flight == 0) {
+        w->busy_usec += qrng_now_usec() - w->busy_since;
+    }
+}
+
+static int chunk_callback(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    job_call_t *call = userdata;
+    file_job_t *job = call->job;
+    uint32_t size = job->opts->chunk_size;
+    const void *ptr = NULL;
+    size_t len = 0;
+    int32_t status = 0;
+    int ret;
+
+    job->in_flight--;
+    worker_done(call->worker);
+    if (!reply) {
+        ret = -sd_bus_error_get_errno(ret_error);
+    } else if (sd_bus_message_is_method_error(reply, NULL)) {
+        ret = -sd_bus_message_get_errno(reply);
+    } else {
+        ret = sd_bus_message_read(reply, "i", &status);
+        if (ret >= 0 && status != 0) {
+            ret = -EIO;
+        }
+        if (ret >= 0) {
+            ret = sd_bus_message_read_array(reply, 'y', &ptr, &len);
+        }
+        if (ret >= 0 && len != size) {
+            ret = -EIO;
+        }
+    }
+
+    if (ret >= 0) {
+        uint64_t latency = qrng_now_usec() - call->sent_usec;
+        ret = pwrite_all(job->fd, ptr, size, (off_t)chunk_offset(job, call->chunk));
+        // The entry goes out with the chunk, so the same sync covers both
+        if (ret == 0 && job->opts->container) {
+            qrng_chunk_entry_t entry = {
+                .crc = qrng_crc32c(0, ptr, size),
+                .flags = QRNG_CHUNK_PRESENT,
+                .fetched_usec = realtime_usec(),
+                .latency_usec = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency,
+                .attempts = call->attempts + 1,
+            };
+            ret = pwrite_all(job->fd, &entry, sizeof(entry),
+                             (off_t)(job->container.index_offset + call->chunk * sizeof(entry)));
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Failed to write chunk %lu: %s\n", call->chunk, strerror(-ret));
+            job->error = ret;
+            free(call);
+            return 0;
+        }
+        qrng_sketch_add(&job->latency, latency);
+        job->done[call->chunk / 8] |= 1 << (call->chunk % 8);
+        job->pending[job->n_pending++] = call->chunk;
+        job->remaining--;
+        job->written++;
+        call->worker->written++;
+        job->unsynced_bytes += size;
+        free(call);
+        return 0;
+    }
+
+    // The pool already moved the call across reconnects; a failure here is
+    // the service's, so try a couple more times before giving up
+    if (++call->attempts < JOB_MAX_ATTEMPTS && !job_stop && job->error == 0) {
+        job->retries++;
+        call->next = call->worker->retries_head;
+        call->worker->retries_head = call;
+        return 0;
+    }
+    fprintf(stderr, "Failed to fetch chunk %lu: %s\n", call->chunk, strerror(-ret));
+    if (job->error == 0) {
+        job->error = ret;
+    }
+    free(call);
+    return 0;
+}
+
+static int job_issue(file_job_t *job, job_call_t *call) {
+    job_worker_t *w = call->worker;
+    call->sent_usec = qrng_now_usec();
+    int ret = conn_pool_read_async_on(job->pool, (int)w->id, job->opts->chunk_size,
+                                      chunk_callback, call);
+    if (ret < 0) {
+        return ret;
+    }
+    if (w->in_flight++ == 0) {
+        w->busy_since = call->sent_usec;
+    }
+    job->in_flight++;
+    return 0;
+}
+
+// Move the back half of the largest other range to w; 0 if nothing is left
+static int worker_steal(file_job_t *job, job_worker_t *w) {
+    job_worker_t *victim = NULL;
+
+    for (unsigned i = 0; i < job->n_workers; i++) {
+        job_worker_t *v = &job->workers[i];
+        if (v != w && v->hi > v->lo && (!victim || v->hi - v->lo > victim->hi - victim->lo)) {
+            victim = v;
+        }
+    }
+    if (!victim) {
+        return 0;
+    }
+    uint64_t take = (victim->hi - victim->lo + 1) / 2;
+    w->lo = victim->hi - take;
+    w->hi = victim->hi;
+    victim->hi = w->lo;
+    victim->stolen += take;
+    w->steals++;
+    return 1;
+}
+
+// Next chunk of w that is not on disk yet, stealing when its range is dry;
+// returns 0 once no worker has any left
+static int worker_next(file_job_t *job, job_worker_t *w, uint64_t *chunk) {
+    for (;;) {
+        while (w->lo < w->hi) {
+            uint64_t c = w->lo++;
+            if (!chunk_done(job, c)) {
+                *chunk = c;
+                return 1;
+            }
+        }
+        if (!worker_steal(job, w)) {
+            return 0;
+        }
+    }
+}
+
+// Issue each worker's retries, then its next missing chunks, up to its
+// share of the concurrency limit
+static int job_fill(file_job_t *job) {
+    for (unsigned i = 0; i < job->n_workers; i++) {
+        job_worker_t *w = &job->workers[i];
+        while (w->retries_head && w->in_flight < w->window) {
+            job_call_t *call = w->retries_head;
+            int ret = job_issue(job, call);
+            if (ret < 0) {
+                return ret;
+            }
+            w->retries_head = call->next;
+        }
+        uint64_t chunk;
+        while (w->in_flight < w->window && worker_next(job, w, &chunk)) {
+            job_call_t *call = calloc(1, sizeof(*call));
+            if (!call) {
+                w->lo--;        // Put it back
+                return -ENOMEM;
+            }
+            call->job = job;
+            call->worker = w;
+            call->chunk = chunk;
+            int ret = job_issue(job, call);
+            if (ret < 0) {
+                free(call);
+                w->lo--;
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+static void print_job_report(file_job_t *job, uint64_t usec) {
+    const file_job_options_t *opts = job->opts;
+    double secs = usec / 1e6;
+    uint64_t bytes = job->written * opts->chunk_size;
+
+    printf("Wrote %lu of %lu chunks (%lu already done) in %.1f s: %.1f MiB/s, "
+           "%lu retries, %lu journal syncs (avg %.1f ms)",
+           job->written, opts->num_chunks - job->skipped, job->skipped, secs,
+           secs > 0 ? bytes / secs / (1024 * 1024) : 0.0, job->retries, job->syncs,
+           job->syncs ? job->sync_usec / 1000.0 / job->syncs : 0.0);
+    if (job->latency.total > 0) {
+        printf(", latency p50 %.1f ms p99 %.1f ms",
+               qrng_sketch_quantile(&job->latency, 0.5) / 1000.0,
+               qrng_sketch_quantile(&job->latency, 0.99) / 1000.0);
+    }
+    printf("\n");
+
+    if (job->n_workers < 2) {
+        return;
+    }
+    for (unsigned i = 0; i < job->n_workers; i++) {
+        const job_worker_t *w = &job->workers[i];
+        printf("  Worker %u: %lu chunks, %.1f MiB/s, busy %.0f%%, %lu steals, "
+               "%lu chunks stolen from it\n",
+               w->id, w->written,
+               secs > 0 ? w->written * (double)opts->chunk_size / secs / (1024 * 1024) : 0.0,
+               usec > 0 ? 100.0 * w->busy_usec / usec : 0.0, w->steals, w->stolen);
+    }
+}
+
+// One worker per connection, each with a contiguous range and an even share
+// of the calls in flight
+static int job_workers_init(file_job_t *job) {
+    const file_job_options_t *opts = job->opts;
+    unsigned n = opts->pool.connections ? opts->pool.connections : 1;
+
+    if (n > opts->concurrent) {
+        n = opts->concurrent;
+    }
+    job->workers = calloc(n, sizeof(*job->workers));
+    if (!job->workers) {
+        return -ENOMEM;
+    }
+    job->n_workers = n;
+    for (unsigned i = 0; i < n; i++) {
+        job_worker_t *w = &job->workers[i];
+        w->id = i;
+        w->lo = opts->num_chunks * i / n;
+        w->hi = opts->num_chunks * (i + 1) / n;
+        w->window = opts->concurrent / n + (i < opts->concurrent % n);
+    }
+    return 0;
+}
+
+int run_file_job(const file_job_options_t *opts) {
+    file_job_t job = {
+        .opts = opts,
+        .fd = -1,
+        .journal_fd = -1,
+        .remaining = opts->num_chunks,
+    };
+    uint64_t start = qrng_now_usec();
+    int ret;
+
+    // At most concurrent chunks complete between two sync checks
+    job.pending_cap = opts->sync_bytes / opts->chunk_size + opts->concurrent + 1;
+    if (job.pending_cap > opts->num_chunks) {
+        job.pending_cap = opts->num_chunks;
+    }
+    job.done = calloc(opts->num_chunks / 8 + 1, 1);
+    job.pending = malloc(job.pending_cap * sizeof(*job.pending));
+    if (!job.done || !job.pending || job_workers_init(&job) < 0) {
+        fprintf(stderr, "Failed to allocate job state\n");
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = job_open(&job);
+    if (ret < 0) {
+        goto out;
+    }
+    if (opts->log_to_stdout) {
+        printf("Writing %lu chunks of %u bytes to %s (%lu already done), %u in flight on %u "
+               "connections\n", opts->num_chunks, opts->chunk_size, opts->path, job.skipped,
+               opts->concurrent, job.n_workers);
+    }
+
+    ret = conn_pool_new(&opts->pool, &job.pool);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to bus: %s\n", strerror(-ret));
+        goto out;
+    }
+
+    struct sigaction sa = { .sa_handler = job_signal_handler };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    job.last_sync_usec = qrng_now_usec();
+    while (job.remaining > 0 || job.in_flight > 0) {
+        // After a stop or a fatal error, finish what is in flight and
+        // record it
+        if (!job_stop && job.error == 0) {
+            ret = job_fill(&job);
+            if (ret < 0) {
+                fprintf(stderr, "Failed to issue ReadBytes: %s\n", strerror(-ret));
+                job.error = ret;
+            }
+        }
+        if (job.in_flight == 0 && (job_stop || job.error < 0)) {
+            break;
+        }
+
+        int processed = conn_pool_process(job.pool);
+        if (processed < 0) {
+            fprintf(stderr, "Failed to process bus: %s\n", strerror(-processed));
+            job.error = processed;
+            break;
+        }
+
+        uint64_t now = qrng_now_usec();
+        if (job.unsynced_bytes >= opts->sync_bytes ||
+            job.n_pending + opts->concurrent >= job.pending_cap ||
+            now - job.last_sync_usec >= JOB_SYNC_USEC) {
+            ret = job_sync(&job);
+            if (ret < 0) {
+                fprintf(stderr, "Failed to sync journal: %s\n", strerror(-ret));
+                job.error = ret;
+                break;
+            }
+            if (opts->log_to_stdout) {
+                printf("%lu of %lu chunks on disk\n", opts->num_chunks - job.remaining,
+                       opts->num_chunks);
+            }
+            now = job.last_sync_usec;
+        }
+        if (processed > 0) {
+            continue;
+        }
+
+        ret = conn_pool_wait(job.pool, job.last_sync_usec + JOB_SYNC_USEC - now);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to wait on bus: %s\n", strerror(-ret));
+            job.error = ret;
+            break;
+        }
+    }
+
+    // Whatever happened, record what did make it to the file
+    ret = job_sync(&job);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to sync journal: %s\n", strerror(-ret));
+    } else {
+        ret = job.error;
+    }
+    if (ret == 0 && job.remaining == 0 && opts->container) {
+        ret = container_finish(&job);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to finish container: %s\n", strerror(-ret));
+        }
+    }
+    print_job_report(&job, qrng_now_usec() - start);
+
+    if (ret == 0 && job.remaining == 0) {
+        char *journal_path;
+        if (asprintf(&journal_path, "%s.journal", opts->path) >= 0) {
+            unlink(journal_path);
+            free(journal_path);
+        }
+    } else {
+        printf("%lu chunks missing; run again with --resume to fetch them\n", job.remaining);
+        if (ret == 0) {
+            ret = -EINTR;
+        }
+    }
+
+out:
+    for (unsigned i = 0; i < job.n_workers; i++) {
+        while (job.workers[i].retries_head) {
+            job_call_t *call = job.workers[i].retries_head;
+            job.workers[i].retries_head = call->next;
+            free(call);
+        }
+    }
+    free(job.workers);
+    conn_pool_free(job.pool);
+    if (job.fd >= 0) {
+        close(job.fd);
+    }
+    if (job.journal_fd >= 0) {
+        close(job.journal_fd);
+    }
+    free(job.done);
+    free(job.pending);
+    return ret;
+}
+
+typedef struct {
+    qrng_container_t *container;
+    uint64_t verified;
+    uint64_t bad;
+    uint64_t *reported;         // Shared count of bad chunks printed so far
+} verify_worker_t;
+
+static void *verify_thread(void *arg) {
+    verify_worker_t *w = arg;
+    uint64_t first, n;
+
+    while ((n = qrng_container_claim(w->container, VERIFY_CLAIM, &first)) > 0) {
+        for (uint64_t chunk = first; chunk < first + n; chunk++) {
+            w->verified++;
+            if (qrng_container_verify(w->container, chunk) == 0) {
+                continue;
+            }
+            w->bad++;
+            if (__atomic_fetch_add(w->reported, 1, __ATOMIC_RELAXED) < VERIFY_MAX_REPORTED) {
+                fprintf(stderr, "Chunk %lu does not match its checksum\n", chunk);
+            }
+        }
+    }
+    return NULL;
+}
+
+int run_file_verify(const char *path, unsigned threads, int log_to_stdout) {
+    qrng_container_t *container;
+    uint64_t start = qrng_now_usec();
+    uint64_t reported = 0, verified = 0, bad = 0;
+    int ret;
+
+    ret = qrng_container_open(path, &container);
+    if (ret == -ENODATA) {
+        fprintf(stderr, "Failed to open %s: container is incomplete (no trailer)\n", path);
+        return ret;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(-ret));
+        return ret;
+    }
+    const qrng_container_header_t *h = qrng_container_get_header(container);
+    if (log_to_stdout) {
+        time_t created = h->created_usec / 1000000;
+        char when[32] = "";
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&created));
+        printf("%s: %lu chunks of %lu bytes from %s %s, created %s; %u threads\n", path,
+               h->num_chunks, h->chunk_size, h->service, h->object, when, threads);
+    }
+
+    verify_worker_t *workers = calloc(threads, sizeof(*workers));
+    pthread_t *tids = calloc(threads, sizeof(*tids));
+    if (!workers || !tids) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    unsigned started = 0;
+    for (; started < threads; started++) {
+        workers[started].container = container;
+        workers[started].reported = &reported;
+        ret = -pthread_create(&tids[started], NULL, verify_thread, &workers[started]);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to start verify thread: %s\n", strerror(-ret));
+            break;
+        }
+    }
+    // Threads that did start still cover every chunk between them
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        verified += workers[i].verified;
+        bad += workers[i].bad;
+    }
+    if (started == 0) {
+        goto out;
+    }
+
+    double secs = (qrng_now_usec() - start) / 1e6;
+    double mib = verified * (double)h->chunk_size / (1024 * 1024);
+    printf("Verified %lu chunks (%.1f MiB) in %.2f s with %u threads: %.1f MiB/s, %lu bad\n",
+           verified, mib, secs, started, secs > 0 ? mib / secs : 0.0, bad);
+    ret = bad > 0 ? -EBADMSG : 0;
+
+out:
+    free(workers);
+    free(tids);
+    qrng_container_close(container);
+    return ret;
+}
@@ -0,0 +1,244 @@
+#include "flight-recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qrng.h"
+
+// A triggered dump waits for this share of the ring to fill with what came
+// next, or for FLIGHT_AFTER_USEC, so it shows both sides of the anomaly
+#define FLIGHT_AFTER_SHARE 4
+#define FLIGHT_AFTER_USEC  1000000
+
+struct flight_recorder {
+    flight_config_t config;
+    flight_record_t *ring;
+    uint64_t written;             // Records ever stored; the newest is at (written - 1) % size
+
+    uint64_t *errors;             // Times of the last error_burst errors, a ring too
+    uint64_t n_errors;
+
+    uint64_t last_progress_usec;  // Last completion, or when requests went in flight
+    int stalled;                  // Dumped for the current stall already
+    uint64_t last_dump_usec;      // Last trigger, 0 = none yet
+
+    // Trigger waiting for the records that follow it
+    char pending[128];
+    uint64_t pending_written;
+    uint64_t pending_usec;
+    unsigned signal_seen;
+    unsigned dumps;
+    char default_prefix[4096];
+};
+
+static volatile sig_atomic_t flight_signals = 0;
+
+static void flight_signal_handler(int sig) {
+    (void)sig;
+    flight_signals++;
+}
+
+void flight_handle_signals(void) {
+    struct sigaction sa = { .sa_handler = flight_signal_handler };
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+int flight_new(const flight_config_t *config, flight_recorder_t **ret) {
+    *ret = NULL;
+    if (config->records == 0) {
+        return 0;
+    }
+
+    flight_recorder_t *f = calloc(1, sizeof(*f));
+    if (!f) {
+        return -ENOMEM;
+    }
+    f->config = *config;
+    if (!f->config.dump_prefix) {
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+        snprintf(f->default_prefix, sizeof(f->default_prefix), "%s/" FLIGHT_DEFAULT_NAME,
+                 dir && dir[0] ? dir : "/tmp");
+        f->config.dump_prefix = f->default_prefix;
+    }
+    if (f->config.cooldown_usec == 0) {
+        f->config.cooldown_usec = FLIGHT_DEFAULT_COOLDOWN;
+    }
+    if (f->config.error_window_usec == 0) {
+        f->config.error_burst = 0;
+    }
+    f->ring = calloc(config->records, sizeof(*f->ring));
+    if (f->config.error_burst > 0) {
+        f->errors = calloc(f->config.error_burst, sizeof(*f->errors));
+    }
+    if (!f->ring || (f->config.error_burst > 0 && !f->errors)) {
+        flight_free(f);
+        return -ENOMEM;
+    }
+    f->signal_seen = flight_signals;
+    f->last_progress_usec = qrng_now_usec();
+
+    *ret = f;
+    return 0;
+}
+
+void flight_free(flight_recorder_t *f) {
+    if (!f) {
+        return;
+    }
+    if (f->pending[0]) {
+        flight_dump(f, f->pending);
+    }
+    free(f->ring);
+    free(f->errors);
+    free(f);
+}
+
+// Schedule a dump for an automatic trigger, unless one fired within the
+// cooldown
+static void flight_trigger(flight_recorder_t *f, uint64_t now, const char *reason) {
+    if (f->pending[0] ||
+        (f->last_dump_usec && now - f->last_dump_usec < f->config.cooldown_usec)) {
+        return;
+    }
+    f->last_dump_usec = now;
+    snprintf(f->pending, sizeof(f->pending), "%s", reason);
+    f->pending_written = f->written;
+    f->pending_usec = now;
+}
+
+static void flight_dump_pending(flight_recorder_t *f) {
+    flight_dump(f, f->pending);
+    f->pending[0] = '\0';
+}
+
+void flight_record(flight_recorder_t *f, const flight_record_t *rec) {
+    char reason[128];
+
+    if (!f) {
+        return;
+    }
+    f->ring[f->written++ % f->config.records] = *rec;
+    f->last_progress_usec = rec->done_usec;
+    f->stalled = 0;
+    if (f->pending[0] &&
+        f->written - f->pending_written >= f->config.records / FLIGHT_AFTER_SHARE) {
+        flight_dump_pending(f);
+    }
+
+    uint64_t latency = rec->done_usec - rec->start_usec;
+    if (f->config.latency_usec && latency > f->config.latency_usec) {
+        snprintf(reason, sizeof(reason), "latency %.1f ms > %.1f ms (id %u)",
+                 latency / 1000.0, f->config.latency_usec / 1000.0, rec->id);
+        flight_trigger(f, rec->done_usec, reason);
+    }
+
+    if (rec->status < 0 && f->config.error_burst > 0) {
+        uint32_t burst = f->config.error_burst;
+        f->errors[f->n_errors++ % burst] = rec->done_usec;
+        // The oldest of the last burst errors is where the next one goes
+        uint64_t oldest = f->errors[f->n_errors % burst];
+        if (f->n_errors >= burst && rec->done_usec - oldest <= f->config.error_window_usec) {
+            snprintf(reason, sizeof(reason), "%u errors in %.1f ms (last: %s)",
+                     burst, (rec->done_usec - oldest) / 1000.0, strerror(-rec->status));
+            flight_trigger(f, rec->done_usec, reason);
+        }
+    }
+}
+
+uint64_t flight_poll(flight_recorder_t *f, uint64_t now, uint32_t in_flight) {
+    char reason[128];
+
+    if (!f) {
+        return UINT64_MAX;
+    }
+    if (f->signal_seen != (unsigned)flight_signals) {
+        f->signal_seen = flight_signals;
+        flight_dump(f, "SIGUSR2");
+    }
+
+    uint64_t wait = UINT64_MAX;
+    if (f->pending[0]) {
+        if (now - f->pending_usec >= FLIGHT_AFTER_USEC) {
+            flight_dump_pending(f);
+        } else {
+            wait = f->pending_usec + FLIGHT_AFTER_USEC - now;
+        }
+    }
+
+    if (in_flight == 0 || f->config.stall_usec == 0) {
+        f->last_progress_usec = now;
+        f->stalled = 0;
+        return wait;
+    }
+    if (f->stalled) {
+        return wait;
+    }
+    uint64_t idle = now - f->last_progress_usec;
+    if (idle < f->config.stall_usec) {
+        return f->config.stall_usec - idle < wait ? f->config.stall_usec - idle : wait;
+    }
+    // Nothing more is coming in, so there is no point waiting for it
+    f->stalled = 1;
+    snprintf(reason, sizeof(reason), "stall: nothing finished for %.1f ms with %u in flight",
+             idle / 1000.0, in_flight);
+    flight_trigger(f, now, reason);
+    if (f->pending[0]) {
+        flight_dump_pending(f);
+    }
+    return UINT64_MAX;
+}
+
+int flight_dump(flight_recorder_t *f, const char *reason) {
+    char path[4096];
+    char when[32];
+    struct timespec ts;
+    struct tm tm;
+    int ret = 0;
+
+    if (!f) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s.%d.%u", f->config.dump_prefix, (int)getpid(), f->dumps++);
+    // Never follow or reuse what someone else left at the path: the prefix
+    // may be in a world-writable directory such as /tmp
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!out) {
+        ret = -errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        fprintf(stderr, "Failed to write flight recorder dump %s: %s\n", path, strerror(-ret));
+        return ret;
+    }
+
+    uint64_t n = f->written < f->config.records ? f->written : f->config.records;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    // Wall and monotonic time of the dump, so record times can be placed
+    fprintf(out, "# flight recorder dump: %s\n", reason);
+    fprintf(out, "# pid=%d time=%s now=%lu records=%lu total=%lu\n",
+            (int)getpid(), when, qrng_now_usec(), n, f->written);
+    fprintf(out, "# start,issue,reply,done,bytes,status,in_flight,queued,id\n");
+    for (uint64_t i = f->written - n; i < f->written; i++) {
+        const flight_record_t *r = &f->ring[i % f->config.records];
+        fprintf(out, "%lu,%lu,%lu,%lu,%u,%d,%u,%u,%u\n", r->start_usec, r->issue_usec,
+                r->reply_usec, r->done_usec, r->bytes, r->status, r->in_flight, r->queued, r->id);
+    }
+    if (fclose(out) != 0) {
+        ret = -errno;
+        fprintf(stderr, "Failed to write flight recorder dump %s: %s\n", path, strerror(-ret));
+        return ret;
+    }
+
+    fprintf(stderr, "Flight recorder: %lu records to %s (%s)\n", n, path, reason);
+    return 0;
+}
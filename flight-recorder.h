@@ -0,0 +1,67 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+
+// Flight recorder: a fixed ring holding the last N finished requests, cheap
+// enough to leave on all the time. It is written out as text when the
+// process gets SIGUSR2 or when one of its triggers fires: a slow request or
+// a burst of errors (dumped once a quarter of the ring or a second has
+// passed, to show what followed), or a stall with requests in flight
+// (dumped at once). Nothing is allocated or written per request; dumps
+// happen from the caller's event loop.
+
+typedef struct {
+    uint32_t records;            // Ring size, 0 = off
+    const char *dump_prefix;     // Dumps go to PREFIX.<pid>.<seq>, NULL = default
+    uint64_t latency_usec;       // Dump on a request slower than this, 0 = never
+    uint32_t error_burst;        // Dump on this many errors ...
+    uint64_t error_window_usec;  // ... within this window, 0 = never
+    uint64_t stall_usec;         // Dump when nothing finishes for this long with
+                                 // requests in flight, 0 = never
+    uint64_t cooldown_usec;      // Least time between triggered dumps, 0 = default
+} flight_config_t;
+
+#define FLIGHT_DEFAULT_RECORDS  4096
+// The default prefix is this name in $XDG_RUNTIME_DIR, which only the user
+// can write to, or in /tmp without it
+#define FLIGHT_DEFAULT_NAME     "qrng-flight"
+#define FLIGHT_DEFAULT_COOLDOWN (10 * 1000000ULL)
+
+// One request, all times in qrng_now_usec() microseconds
+typedef struct {
+    uint64_t start_usec;         // Arrived, or was issued by a client
+    uint64_t issue_usec;         // First upstream call sent
+    uint64_t reply_usec;         // Last upstream reply received
+    uint64_t done_usec;          // Answer ready for the caller
+    uint32_t bytes;
+    int32_t status;              // 0 or a negative errno value
+    uint32_t in_flight;          // Upstream calls in flight when it started
+    uint32_t queued;             // Bytes queued ahead of it when it started
+    uint32_t id;                 // Request number, or tenant uid
+    uint32_t reserved;
+} flight_record_t;
+
+typedef struct flight_recorder flight_recorder_t;
+
+// Returns 0 with *ret NULL if config->records is 0; every function below
+// accepts a NULL recorder and does nothing
+int flight_new(const flight_config_t *config, flight_recorder_t **ret);
+void flight_free(flight_recorder_t *f);
+
+// Make SIGUSR2 ask every recorder for a dump at its next flight_poll
+void flight_handle_signals(void);
+
+// Store a finished request, dumping if it trips the latency or error trigger
+void flight_record(flight_recorder_t *f, const flight_record_t *rec);
+
+// Check the stall trigger, SIGUSR2 and pending dumps; call from the event
+// loop with the number of requests in flight. Returns the longest the loop may wait
+// before calling again, UINT64_MAX if there is no deadline.
+uint64_t flight_poll(flight_recorder_t *f, uint64_t now, uint32_t in_flight);
+
+// Write the ring, oldest first, to the next dump file. Returns 0 or a
+// negative errno value.
+int flight_dump(flight_recorder_t *f, const char *reason);
+
+#endif
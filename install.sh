@@ -4,7 +4,28 @@ SCRIPT_DIR=$(dirname $(realpath $0))
 cd $SCRIPT_DIR
 
 mkdir -p bin
-gcc sd-bus-client.c -o bin/sd-bus-client $(pkg-config --cflags --libs libsystemd)
+gcc sd-bus-client.c qrng.c kernel-feed.c daemon.c conn-pool.c sink.c file-job.c container.c proxy.c flight-recorder.c -o bin/sd-bus-client -pthread $(pkg-config --cflags --libs libsystemd)
+
+# Minimal profile: plain fetches only, static arenas, no stdio, size-optimised
+gcc -Os -s -ffunction-sections -fdata-sections -Wl,--gc-sections mini-client.c -o bin/sd-bus-client-mini \
+    $(pkg-config --cflags --libs libsystemd)
+
+# Stand-in service for the benchmarks in bench/
+gcc bench/mock-service.c -o bin/mock-service $(pkg-config --cflags --libs libsystemd)
+gcc -O2 bench/alloc-bench.c qrng.c -o bin/alloc-bench -pthread $(pkg-config --cflags --libs libsystemd)
+gcc -O2 bench/readv-bench.c qrng.c -o bin/readv-bench -pthread $(pkg-config --cflags --libs libsystemd)
+gcc -O2 bench/footprint.c -o bin/footprint
+
+# OpenSSL provider is optional: only built when OpenSSL 3 headers are present
+if pkg-config --exists 'libcrypto >= 3.0'; then
+    gcc -shared -fPIC qrng-provider.c qrng.c -o bin/qrng-provider.so -pthread \
+        $(pkg-config --cflags --libs libsystemd libcrypto)
+fi
+
+# Python binding is optional: only built when setuptools is available
+if python3 -c 'import setuptools' 2> /dev/null; then
+    (cd python && python3 setup.py build_ext --inplace)
+fi
 
 sudo cp bin/sd-bus-client $HOME/.local/bin
 
@@ -0,0 +1,284 @@
+// rngd-style feeding of the kernel entropy pool.
+//
+// The loop waits for demand (POLLOUT on the random device, which older
+// kernels raise once entropy drops below write_wakeup_threshold, bounded by
+// an interval for kernels that always report writable), sizes the next
+// ReadBytes call from the current deficit and credits the bytes with the
+// RNDADDENTROPY ioctl. Batch size and interval grow while the pool keeps
+// asking for more and back off while it stays full. If the bus connection
+// drops or calls fail (e.g. while the service restarts), the feeder keeps
+// running and retries with exponential backoff.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/random.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modes.h"
+#include "qrng.h"
+
+#define FEED_MIN_BATCH       64
+#define FEED_MIN_INTERVAL_MS 10
+#define FEED_BACKOFF_MIN_MS  50
+#define FEED_BACKOFF_MAX_MS  5000
+
+static volatile sig_atomic_t feed_stop = 0;
+
+static void feed_signal_handler(int sig) {
+    (void)sig;
+    feed_stop = 1;
+}
+
+static uint64_t now_usec(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t cpu_usec(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// Read a single integer from proc_dir/name; returns -1 if unavailable
+static long read_proc_value(const char *proc_dir, const char *name) {
+    char path[512];
+    char buf[32];
+    long value = -1;
+
+    snprintf(path, sizeof(path), "%s/%s", proc_dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    if (fgets(buf, sizeof(buf), f)) {
+        value = strtol(buf, NULL, 10);
+    }
+    fclose(f);
+    return value;
+}
+
+// Credit len bytes to the kernel. A sink that is not a random device (a
+// plain file or FIFO used in tests) gets the raw bytes written instead.
+static int inject(int fd, int is_random_device, const uint8_t *bytes, size_t len) {
+    if (!is_random_device) {
+        while (len > 0) {
+            ssize_t n = write(fd, bytes, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -errno;
+            }
+            bytes += n;
+            len -= n;
+        }
+        return 0;
+    }
+
+    struct rand_pool_info *info = qrng_buf_alloc(sizeof(*info) + len);
+    if (!info) {
+        return -ENOMEM;
+    }
+    info->entropy_count = (int)(len * 8);
+    info->buf_size = (int)len;
+    memcpy(info->buf, bytes, len);
+
+    int ret = ioctl(fd, RNDADDENTROPY, info) < 0 ? -errno : 0;
+    qrng_buf_free(info, sizeof(*info) + len);
+    return ret;
+}
+
+static void print_feed_report(uint64_t injected, uint64_t calls, uint64_t wall_usec,
+                              uint64_t cpu_used_usec) {
+    double secs = wall_usec / 1e6;
+
+    printf("Injected %lu bytes in %lu calls over %.1f s: %.1f bytes/sec, "
+           "CPU %.3f%% (%.2f us per KiB)\n",
+           injected, calls, secs, secs > 0 ? injected / secs : 0.0,
+           secs > 0 ? 100.0 * cpu_used_usec / wall_usec : 0.0,
+           injected > 0 ? cpu_used_usec / (injected / 1024.0) : 0.0);
+}
+
+int run_kernel_feed(const kernel_feed_options_t *opts) {
+    struct stat st;
+    uint8_t *buf = NULL;
+    sd_bus *bus = NULL;
+    int fd = -1;
+    int ret;
+
+    ret = qrng_bus_open(opts->address, &bus);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to bus: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    fd = open(opts->device, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ret = -errno;
+        fprintf(stderr, "Failed to open %s: %s\n", opts->device, strerror(-ret));
+        sd_bus_unref(bus);
+        return ret;
+    }
+    int is_random_device = fstat(fd, &st) == 0 && S_ISCHR(st.st_mode);
+
+    uint32_t max_batch = opts->max_batch < FEED_MIN_BATCH ? FEED_MIN_BATCH : opts->max_batch;
+    buf = malloc(max_batch);
+    if (!buf) {
+        fprintf(stderr, "Failed to allocate memory for feed buffer\n");
+        close(fd);
+        sd_bus_unref(bus);
+        return -ENOMEM;
+    }
+
+    struct sigaction sa = { .sa_handler = feed_signal_handler };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    long poolsize_bits = read_proc_value(opts->proc_dir, "poolsize");
+    if (opts->log_to_stdout) {
+        printf("Feeding %s (%s), pool size %ld bits, batch up to %u bytes, interval up to %lu ms\n",
+               opts->device, is_random_device ? "ioctl" : "raw writes",
+               poolsize_bits, max_batch, opts->interval_ms);
+    }
+
+    uint64_t max_interval = opts->interval_ms < FEED_MIN_INTERVAL_MS ? FEED_MIN_INTERVAL_MS
+                                                                    : opts->interval_ms;
+    uint64_t interval = max_interval;
+    uint32_t batch = FEED_MIN_BATCH;
+    uint64_t injected = 0;
+    uint64_t calls = 0;
+    uint64_t backoff_ms = FEED_BACKOFF_MIN_MS;
+    uint64_t reconnects = 0;
+    uint64_t read_errors = 0;
+    uint64_t wall_start = now_usec(CLOCK_MONOTONIC);
+    uint64_t cpu_start = cpu_usec();
+    ret = 0;
+
+    int pool_full = 1;
+    while (!feed_stop) {
+        // Newer kernels report the device as always writable, so POLLOUT is
+        // only a demand signal after we have seen a deficit; otherwise just
+        // wait out the interval.
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        int nfds = is_random_device && !pool_full ? 1 : 0;
+        if (poll(nfds ? &pfd : NULL, nfds, (int)interval) < 0 && errno != EINTR) {
+            ret = -errno;
+            fprintf(stderr, "Failed to poll %s: %s\n", opts->device, strerror(-ret));
+            break;
+        }
+        if (feed_stop) {
+            break;
+        }
+
+        if (!bus) {
+            ret = qrng_bus_open(opts->address, &bus);
+            if (ret < 0) {
+                backoff_ms = backoff_ms * 2 > FEED_BACKOFF_MAX_MS ? FEED_BACKOFF_MAX_MS : backoff_ms * 2;
+                interval = backoff_ms;
+                continue;
+            }
+            reconnects++;
+            interval = FEED_MIN_INTERVAL_MS;
+            pool_full = 0;
+            if (opts->log_to_stdout) {
+                printf("Reconnected to the bus\n");
+            }
+        }
+
+        // Without proc values (fake sink) every wakeup is treated as a full
+        // deficit, which still exercises the batching logic.
+        long avail = read_proc_value(opts->proc_dir, "entropy_avail");
+        long size = poolsize_bits > 0 ? poolsize_bits : (long)max_batch * 8;
+        long deficit_bytes = avail >= 0 ? (size - avail) / 8 : (long)batch;
+
+        pool_full = deficit_bytes <= 0;
+        if (pool_full) {
+            // Pool is full: ask less often and in smaller pieces
+            interval = interval * 2 > max_interval ? max_interval : interval * 2;
+            batch = batch / 2 < FEED_MIN_BATCH ? FEED_MIN_BATCH : batch / 2;
+            continue;
+        }
+
+        uint32_t want = deficit_bytes > (long)batch ? batch : (uint32_t)deficit_bytes;
+        if (want < FEED_MIN_BATCH) {
+            want = FEED_MIN_BATCH;
+        }
+
+        ret = qrng_read(bus, buf, want, opts->timeout_ms);
+        if (ret < 0 && sd_bus_is_open(bus) <= 0) {
+            // Lost the bus: keep feeding once it is back
+            fprintf(stderr, "Lost bus connection, reconnecting: %s\n", strerror(-ret));
+            bus = sd_bus_flush_close_unref(bus);
+            backoff_ms = FEED_BACKOFF_MIN_MS;
+            interval = backoff_ms;
+            pool_full = 1;
+            ret = 0;
+            continue;
+        }
+        if (ret < 0) {
+            // The service may be restarting (unknown name, no reply, a
+            // timeout): only the device failing is fatal
+            fprintf(stderr, "Failed to read %u bytes from RNG service, retrying: %s\n", want,
+                    strerror(-ret));
+            read_errors++;
+            interval = backoff_ms;
+            backoff_ms = backoff_ms * 2 > FEED_BACKOFF_MAX_MS ? FEED_BACKOFF_MAX_MS : backoff_ms * 2;
+            pool_full = 1;
+            ret = 0;
+            continue;
+        }
+        if (backoff_ms > FEED_BACKOFF_MIN_MS) {
+            // Recovered: feed the deficit that built up meanwhile
+            backoff_ms = FEED_BACKOFF_MIN_MS;
+            interval = FEED_MIN_INTERVAL_MS;
+        }
+
+        ret = inject(fd, is_random_device, buf, want);
+        explicit_bzero(buf, want);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to inject entropy into %s: %s\n", opts->device, strerror(-ret));
+            break;
+        }
+
+        injected += want;
+        calls++;
+
+        // Demand is still larger than what we sent: grow the batch and
+        // check again sooner
+        if (deficit_bytes > (long)want) {
+            batch = batch * 2 > max_batch ? max_batch : batch * 2;
+            interval = interval / 2 < FEED_MIN_INTERVAL_MS ? FEED_MIN_INTERVAL_MS : interval / 2;
+        }
+
+        if (opts->log_to_stdout) {
+            printf("Injected %u bytes (entropy_avail %ld bits, next batch %u, interval %lu ms)\n",
+                   want, avail, batch, interval);
+        }
+    }
+
+    print_feed_report(injected, calls, now_usec(CLOCK_MONOTONIC) - wall_start,
+                      cpu_usec() - cpu_start);
+    if (reconnects > 0) {
+        printf("Reconnected to the bus %lu times\n", reconnects);
+    }
+    if (read_errors > 0) {
+        printf("Retried %lu failed reads\n", read_errors);
+    }
+
+    free(buf);
+    close(fd);
+    sd_bus_flush_close_unref(bus);
+    return ret;
+}
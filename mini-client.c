@@ -0,0 +1,413 @@
+// Minimal-footprint client for small hosts and constrained containers: only
+// plain ReadBytes fetches (-n, -b, -c, -t, -q), synchronous at -c 1 and
+// asynchronous above, with the same output as sd-bus-client. Request
+// contexts and output buffers live in fixed static arenas and output goes
+// through write(2), so the binary links no stdio and allocates nothing
+// itself (sd-bus still allocates its messages). Built by install.sh as
+// bin/sd-bus-client-mini; bin/footprint (bench/footprint.c) compares it
+// with the full client.
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <systemd/sd-bus.h>
+#include <unistd.h>
+
+#include "qrng.h"
+
+#define MINI_MAX_CONCURRENT 64
+#define MINI_MAX_BYTES      (16 * 1024 * 1024)
+
+// Buffered output on a file descriptor
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[4096];
+} out_t;
+
+static out_t out = { .fd = STDOUT_FILENO };
+static out_t err = { .fd = STDERR_FILENO };
+
+static void out_flush(out_t *o) {
+    size_t off = 0;
+    while (off < o->len) {
+        ssize_t n = write(o->fd, o->buf + off, o->len - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;  // Nowhere left to report it
+        }
+        off += n;
+    }
+    o->len = 0;
+}
+
+static void out_char(out_t *o, char c) {
+    if (o->len == sizeof(o->buf)) {
+        out_flush(o);
+    }
+    o->buf[o->len++] = c;
+}
+
+static void out_str(out_t *o, const char *s) {
+    while (*s) {
+        out_char(o, *s++);
+    }
+}
+
+static void out_uint(out_t *o, uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n > 0) {
+        out_char(o, digits[--n]);
+    }
+}
+
+// "Failed to <what> (<label> <id>): <reason>" on stderr; id < 0 omits the
+// parenthesis
+static void report_error(const char *what, const char *label, int id, const char *reason) {
+    out_str(&err, "Failed to ");
+    out_str(&err, what);
+    if (id >= 0) {
+        out_str(&err, " (");
+        out_str(&err, label);
+        out_char(&err, ' ');
+        out_uint(&err, id);
+        out_char(&err, ')');
+    }
+    out_str(&err, ": ");
+    out_str(&err, reason);
+    out_char(&err, '\n');
+    out_flush(&err);
+}
+
+static void print_octets(const uint8_t *octets, size_t len) {
+    static const char hex[] = "0123456789ABCDEF";
+
+    out_str(&out, "Generated Octets (");
+    out_uint(&out, len);
+    out_str(&out, " bytes): ");
+    for (size_t i = 0; i < len; i++) {
+        out_char(&out, hex[octets[i] >> 4]);
+        out_char(&out, hex[octets[i] & 0xf]);
+        out_char(&out, ' ');
+    }
+    out_char(&out, '\n');
+}
+
+// Request contexts for the async path, handed out from a free list
+typedef struct {
+    int request_id;
+    uint32_t expected_bytes;
+} request_context_t;
+
+static request_context_t contexts[MINI_MAX_CONCURRENT];
+static request_context_t *free_contexts[MINI_MAX_CONCURRENT];
+static int n_free_contexts;
+
+static int completed_requests = 0;
+static int failed_requests = 0;
+static int log_to_stdout = 1;
+static int iterations = 1;
+
+// Checks a ReadBytes reply and returns its payload; label/id name the call
+// in error messages
+static int read_reply(sd_bus_message *reply, uint32_t expected, const char *label, int id,
+                      const uint8_t **ret_octets) {
+    int32_t status;
+    const void *ptr;
+    size_t len;
+    int ret;
+
+    if (sd_bus_message_is_method_error(reply, NULL)) {
+        report_error("issue method call", label, id, sd_bus_message_get_error(reply)->message);
+        return -EIO;
+    }
+    ret = sd_bus_message_read(reply, "i", &status);
+    if (ret < 0) {
+        report_error("parse reply message", label, id, strerror(-ret));
+        return ret;
+    }
+    if (status != 0) {
+        report_error("issue method call", label, id, "service returned an error status");
+        return -EIO;
+    }
+    ret = sd_bus_message_read_array(reply, 'y', &ptr, &len);
+    if (ret < 0) {
+        report_error("read array", label, id, strerror(-ret));
+        return ret;
+    }
+    if (len != expected) {
+        report_error("read array", label, id, "reply has the wrong length");
+        return -EIO;
+    }
+    *ret_octets = ptr;
+    return 0;
+}
+
+static int async_callback(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    request_context_t *ctx = userdata;
+    const uint8_t *octets;
+
+    if (ret_error && sd_bus_error_is_set(ret_error)) {
+        report_error("issue method call", "request", ctx->request_id, ret_error->message);
+        failed_requests++;
+    } else if (read_reply(reply, ctx->expected_bytes, "request", ctx->request_id, &octets) < 0) {
+        failed_requests++;
+    } else {
+        if (iterations == 1) {
+            if (log_to_stdout) {
+                print_octets(octets, ctx->expected_bytes);
+            }
+        } else if (log_to_stdout) {
+            out_str(&out, "Request ");
+            out_uint(&out, ctx->request_id);
+            out_str(&out, ": received ");
+            out_uint(&out, ctx->expected_bytes);
+            out_str(&out, " bytes\n");
+        }
+        completed_requests++;
+    }
+    free_contexts[n_free_contexts++] = ctx;
+    return 0;
+}
+
+static int run_sync(sd_bus *bus, uint32_t num_bytes, uint64_t timeout_ms) {
+    for (int i = 0; i < iterations; i++) {
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        sd_bus_message *reply = NULL;
+        const uint8_t *octets;
+        int ret;
+
+        if (log_to_stdout && iterations > 1) {
+            out_str(&out, "Iteration ");
+            out_uint(&out, i + 1);
+            out_char(&out, '/');
+            out_uint(&out, iterations);
+            out_str(&out, ": ");
+        }
+
+        ret = sd_bus_call_method(bus, QRNG_SERVICE, QRNG_OBJECT_PATH, QRNG_INTERFACE, QRNG_METHOD,
+                                 &error, &reply, "tt", (uint64_t)num_bytes, timeout_ms);
+        if (ret < 0) {
+            out_flush(&out);
+            report_error("issue method call", "iteration", i + 1, error.message ? error.message : strerror(-ret));
+            sd_bus_error_free(&error);
+            return ret;
+        }
+        ret = read_reply(reply, num_bytes, "iteration", i + 1, &octets);
+        if (ret == 0) {
+            if (iterations == 1) {
+                if (log_to_stdout) {
+                    print_octets(octets, num_bytes);
+                }
+            } else if (log_to_stdout) {
+                out_str(&out, "received ");
+                out_uint(&out, num_bytes);
+                out_str(&out, " bytes\n");
+            }
+        }
+        sd_bus_message_unref(reply);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (log_to_stdout) {
+        out_str(&out, "Completed ");
+        out_uint(&out, iterations);
+        out_str(&out, " iterations successfully\n");
+    }
+    return 0;
+}
+
+static int run_async(sd_bus *bus, uint32_t num_bytes, uint64_t timeout_ms, int concurrent) {
+    int requests_sent = 0;
+    int ret;
+
+    for (int i = 0; i < MINI_MAX_CONCURRENT; i++) {
+        free_contexts[i] = &contexts[i];
+    }
+    n_free_contexts = MINI_MAX_CONCURRENT;
+
+    while (requests_sent < iterations || requests_sent > completed_requests + failed_requests) {
+        // Send new requests up to the concurrency limit
+        while (requests_sent < iterations &&
+               requests_sent - completed_requests - failed_requests < concurrent) {
+            request_context_t *ctx = free_contexts[--n_free_contexts];
+            ctx->request_id = requests_sent + 1;
+            ctx->expected_bytes = num_bytes;
+
+            // A floating slot: the bus owns it until the reply is dispatched
+            ret = sd_bus_call_method_async(bus, NULL, QRNG_SERVICE, QRNG_OBJECT_PATH, QRNG_INTERFACE,
+                                           QRNG_METHOD, async_callback, ctx, "tt",
+                                           (uint64_t)num_bytes, timeout_ms);
+            if (ret < 0) {
+                out_flush(&out);
+                report_error("issue async method call", "request", ctx->request_id, strerror(-ret));
+                return ret;
+            }
+            requests_sent++;
+
+            if (log_to_stdout && iterations > 1) {
+                out_str(&out, "Sent request ");
+                out_uint(&out, requests_sent);
+                out_char(&out, '/');
+                out_uint(&out, iterations);
+                out_char(&out, '\n');
+            }
+        }
+
+        ret = sd_bus_process(bus, NULL);
+        if (ret < 0) {
+            out_flush(&out);
+            report_error("process bus", NULL, -1, strerror(-ret));
+            return ret;
+        }
+        if (ret > 0) {
+            continue;
+        }
+        if (requests_sent > completed_requests + failed_requests) {
+            // Nothing to dispatch: hand what was written so far to stdout
+            // before sleeping
+            out_flush(&out);
+            ret = sd_bus_wait(bus, UINT64_MAX);
+            if (ret < 0) {
+                report_error("wait on bus", NULL, -1, strerror(-ret));
+                return ret;
+            }
+        }
+    }
+
+    if (log_to_stdout) {
+        out_str(&out, "Completed ");
+        out_uint(&out, iterations);
+        out_str(&out, " requests (");
+        out_uint(&out, completed_requests);
+        out_str(&out, " successful, ");
+        out_uint(&out, failed_requests);
+        out_str(&out, " failed)\n");
+    }
+    return failed_requests > 0 ? -EIO : 0;
+}
+
+static void print_usage(const char *program_name) {
+    out_str(&out, "Usage: ");
+    out_str(&out, program_name);
+    out_str(&out, " [OPTIONS]\n"
+            "Options:\n"
+            "  -n, --iterations NUM    Number of D-Bus calls to make (default: 1)\n"
+            "  -b, --bytes NUM         Number of bytes to retrieve per call (default: 10)\n"
+            "  -c, --concurrent NUM    Number of concurrent in-flight requests (default: 1, max: 64)\n"
+            "  -t, --timeout MS        Timeout in milliseconds (default: 0 = no timeout)\n"
+            "  -l, --log               Log output to stdout (default: enabled)\n"
+            "  -q, --quiet             Disable logging to stdout\n"
+            "  -h, --help              Show this help message\n");
+}
+
+static void usage_error(const char *message) {
+    out_str(&err, "Error: ");
+    out_str(&err, message);
+    out_char(&err, '\n');
+    out_flush(&err);
+}
+
+int main(int argc, char *argv[]) {
+    sd_bus *bus = NULL;
+    uint32_t num_bytes = 10;
+    int concurrent = 1;
+    uint64_t timeout_ms = 0;
+    int ret;
+    int c;
+
+    static const struct option long_options[] = {
+        {"iterations", required_argument, 0, 'n'},
+        {"bytes",      required_argument, 0, 'b'},
+        {"concurrent", required_argument, 0, 'c'},
+        {"timeout",    required_argument, 0, 't'},
+        {"log",        no_argument,       0, 'l'},
+        {"quiet",      no_argument,       0, 'q'},
+        {"help",       no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    // getopt would report bad options through stdio
+    opterr = 0;
+    while ((c = getopt_long(argc, argv, "n:b:c:t:lqh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                iterations = atoi(optarg);
+                if (iterations <= 0) {
+                    usage_error("iterations must be positive");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                num_bytes = (uint32_t)atoi(optarg);
+                if (num_bytes == 0 || num_bytes > MINI_MAX_BYTES) {
+                    usage_error("bytes must be between 1 and 16777216");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                concurrent = atoi(optarg);
+                if (concurrent <= 0 || concurrent > MINI_MAX_CONCURRENT) {
+                    usage_error("concurrent must be between 1 and 64");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                timeout_ms = (uint64_t)atoll(optarg);
+                break;
+            case 'l':
+                log_to_stdout = 1;
+                break;
+            case 'q':
+                log_to_stdout = 0;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                out_flush(&out);
+                return EXIT_SUCCESS;
+            default:
+                usage_error("unknown option or missing argument (see --help)");
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (log_to_stdout) {
+        out_str(&out, "Starting ");
+        out_uint(&out, iterations);
+        out_str(&out, " iterations, ");
+        out_uint(&out, num_bytes);
+        out_str(&out, " bytes per call, ");
+        out_uint(&out, concurrent);
+        out_str(&out, " concurrent requests, timeout: ");
+        out_uint(&out, timeout_ms);
+        out_str(&out, " ms\n");
+    }
+
+    ret = sd_bus_open_user(&bus);
+    if (ret < 0) {
+        out_flush(&out);
+        report_error("connect to user bus", NULL, -1, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    if (concurrent == 1) {
+        ret = run_sync(bus, num_bytes, timeout_ms);
+    } else {
+        ret = run_async(bus, num_bytes, timeout_ms, concurrent);
+    }
+    out_flush(&out);
+
+    sd_bus_flush_close_unref(bus);
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
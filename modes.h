@@ -0,0 +1,110 @@
+#ifndef MODES_H
+#define MODES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <systemd/sd-bus.h>
+
+#include "conn-pool.h"
+#include "flight-recorder.h"
+#include "qrng.h"
+
+// Long-running modes of sd-bus-client, selected from main()
+
+typedef struct {
+    const char *device;        // Entropy sink, normally /dev/random
+    const char *proc_dir;      // Directory with entropy_avail and poolsize
+    uint32_t max_batch;        // Upper bound for one ReadBytes call
+    uint64_t interval_ms;      // Longest wait between demand checks
+    uint64_t timeout_ms;       // Timeout passed to ReadBytes
+    const char *address;       // Bus address as for qrng_bus_open, NULL = user bus
+    int log_to_stdout;
+} kernel_feed_options_t;
+
+// Inject QRNG bytes into the kernel entropy pool until SIGINT/SIGTERM,
+// reconnecting to the bus if the connection drops and retrying failed reads
+int run_kernel_feed(const kernel_feed_options_t *opts);
+
+typedef struct {
+    const char *path;          // Output file; the journal is PATH.journal
+    uint64_t num_chunks;
+    uint32_t chunk_size;       // Bytes per ReadBytes call and per journal unit
+    uint32_t concurrent;       // Calls in flight
+    uint64_t sync_bytes;       // Sync data and journal after this many new bytes
+    int resume;                // Skip chunks the existing journal lists
+    int container;             // Write the indexed, checksummed format of container.h
+    conn_pool_config_t pool;
+    int log_to_stdout;
+} file_job_options_t;
+
+// Write num_chunks * chunk_size bytes to a file with positional writes and
+// a journal of completed chunks, so an interrupted job can be resumed.
+// SIGINT/SIGTERM stop it after the calls in flight are written down.
+int run_file_job(const file_job_options_t *opts);
+
+// Check every chunk of a container against its index, with threads
+// claiming chunks from a shared cursor; -EBADMSG if any do not match
+int run_file_verify(const char *path, unsigned threads, int log_to_stdout);
+
+typedef struct {
+    uid_t uid;
+    uint32_t weight;           // DRR weight, default 1
+    uint64_t quota;            // Bytes/sec, 0 = unlimited
+    uint64_t slo_ms;           // Reject requests expected to wait longer, 0 = never
+} tenant_config_t;
+
+typedef struct {
+    const char *socket_path;
+    uint32_t window;           // Upstream ReadBytes calls in flight
+    uint32_t quantum;          // DRR quantum and largest upstream chunk
+    uint32_t max_request;      // Largest request a client may make
+    uint64_t max_outstanding;  // Response bytes a tenant may hold at once
+    uint32_t small_threshold;  // Requests up to this size use the small lane, 0 = one lane
+    uint32_t small_window;     // Upstream calls in flight on the small lane
+    conn_pool_config_t pool;   // Connections of each lane, ReadBytes timeout included
+    const tenant_config_t *tenants;
+    size_t n_tenants;
+    flight_config_t flight;    // Records each request; id is the tenant's uid
+    int log_to_stdout;
+} daemon_options_t;
+
+// Parse UID[:WEIGHT[:QUOTA[:SLO_MS]]]
+int daemon_parse_tenant(const char *spec, tenant_config_t *out);
+
+// Serve local clients over a Unix socket until SIGINT/SIGTERM; SIGUSR1
+// prints per-tenant statistics, SIGUSR2 dumps the flight recorder
+int run_daemon(const daemon_options_t *opts);
+
+typedef struct {
+    const char *name;          // Bus name to serve under
+    uint32_t buffer;           // Prefetch buffer size, at least twice refill
+    uint32_t refill;           // Bytes per upstream ReadBytes call
+    uint32_t window;           // Upstream calls in flight
+    uint32_t max_request;      // Largest request a client may make
+    int power_save;            // Refill late and in large calls, paced to consumption
+    conn_pool_config_t pool;   // Upstream connections, address included
+    int log_to_stdout;
+} proxy_options_t;
+
+// Serve ReadBytes at the service's object path under opts->name on the user
+// bus, answering from a buffer refilled with large upstream calls, until
+// SIGINT/SIGTERM; SIGUSR1 prints statistics
+int run_proxy(const proxy_options_t *opts);
+
+// Issue iterations requests of num_bytes to a daemon with up to window of
+// them pipelined, and report latency and throughput
+int run_daemon_client(const char *socket_path, int iterations, uint32_t num_bytes,
+                      int window, int log_to_stdout);
+
+void print_octets(const uint8_t *octets, size_t len, int should_log);
+
+// Wakeups (context switches) and CPU time per second of the process since
+// since_usec, one line prefixed by indent
+void print_process_load(const char *indent, uint64_t since_usec);
+
+// CPU time and quota throttling of the process's cgroup since start, one
+// line prefixed by indent; prints nothing without a cpu.max quota
+void print_cpu_throttling(const char *indent, const qrng_cpu_stat_t *start);
+
+#endif
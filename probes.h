@@ -0,0 +1,90 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <stdint.h>
+
+// USDT probes on the request lifecycle, in the SystemTap SDT note format
+// that bpftrace, bcc and perf read (see bench/*.bt). A probe is a single
+// nop plus an ELF note naming it, so it costs nothing until a tracer
+// attaches; its arguments are still computed, so keep them to values at
+// hand. Probes whose arguments cost something are gated on a semaphore the
+// tracer raises while attached.
+//
+// Every argument is passed as a signed 64-bit value ("-8@" in the note).
+// All probes are in provider "qrng":
+//
+//   connect(conn, ret)                 a pool connection was (re)opened, ret < 0 on failure
+//   submit(request, bytes, tag)        the client handed a request to the pool
+//   send(tag, bytes, cookie, conn)     a ReadBytes(Batch) call went to a connection
+//   flush(conn, queued_writes)         the event loop is about to wait (gated)
+//   reply(tag, bytes, cookie, conn)    the reply to a call arrived
+//   parse(request, bytes, tag)         a reply block was checked and accepted
+//   output(request, bytes, tag)        the block was handed to the outputs
+//   error(request, errno, tag)         a request failed (errno is positive)
+//
+// tag is the pool caller's context pointer, the same for every request of a
+// batch, and joins request probes to call probes; cookie is the D-Bus
+// serial of the call. Building with -DQRNG_NO_PROBES leaves them all out.
+
+#if !defined(QRNG_NO_PROBES) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define QRNG_PROBE_NOTE(name, semaphore, args, ...)                                  \
+    __asm__ __volatile__(                                                           \
+        "990: nop\n"                                                                \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                               \
+        ".balign 4\n"                                                               \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                          \
+        "991: .asciz \"stapsdt\"\n"                                                 \
+        "992: .balign 4\n"                                                          \
+        "993: .8byte 990b\n"                                                        \
+        ".8byte _.stapsdt.base\n"                                                   \
+        ".8byte " semaphore "\n"                                                    \
+        ".asciz \"qrng\"\n"                                                         \
+        ".asciz \"" #name "\"\n"                                                    \
+        ".asciz \"" args "\"\n"                                                     \
+        "994: .balign 4\n"                                                          \
+        ".popsection\n"                                                             \
+        ".ifndef _.stapsdt.base\n"                                                  \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"     \
+        ".weak _.stapsdt.base\n"                                                    \
+        ".hidden _.stapsdt.base\n"                                                  \
+        "_.stapsdt.base: .space 1\n"                                                \
+        ".size _.stapsdt.base, 1\n"                                                 \
+        ".popsection\n"                                                             \
+        ".endif\n"                                                                  \
+        :: __VA_ARGS__)
+
+#define QRNG_PROBE_ARG(n, x) [a##n] "nor" ((int64_t)(x))
+
+#define QRNG_PROBE_(name, semaphore, x1, x2)                                         \
+    QRNG_PROBE_NOTE(name, semaphore, "-8@%[a1] -8@%[a2]",                            \
+                    QRNG_PROBE_ARG(1, x1), QRNG_PROBE_ARG(2, x2))
+#define QRNG_PROBE2(name, x1, x2) QRNG_PROBE_(name, "0", x1, x2)
+#define QRNG_PROBE3(name, x1, x2, x3)                                                \
+    QRNG_PROBE_NOTE(name, "0", "-8@%[a1] -8@%[a2] -8@%[a3]",                         \
+                    QRNG_PROBE_ARG(1, x1), QRNG_PROBE_ARG(2, x2), QRNG_PROBE_ARG(3, x3))
+#define QRNG_PROBE4(name, x1, x2, x3, x4)                                            \
+    QRNG_PROBE_NOTE(name, "0", "-8@%[a1] -8@%[a2] -8@%[a3] -8@%[a4]",                \
+                    QRNG_PROBE_ARG(1, x1), QRNG_PROBE_ARG(2, x2), QRNG_PROBE_ARG(3, x3), \
+                    QRNG_PROBE_ARG(4, x4))
+
+// Gated probes: define the semaphore in one translation unit, test it with
+// QRNG_PROBE_ENABLED before computing the arguments
+#define QRNG_PROBE_SEMAPHORE(name)                                                   \
+    volatile unsigned short qrng_##name##_semaphore                                 \
+        __attribute__((section(".probes"), used)) = 0
+#define QRNG_PROBE_ENABLED(name) __builtin_expect(qrng_##name##_semaphore != 0, 0)
+#define QRNG_GATED_PROBE2(name, x1, x2) QRNG_PROBE_(name, "qrng_" #name "_semaphore", x1, x2)
+
+#else
+
+#define QRNG_PROBE2(name, x1, x2)                 do { } while (0)
+#define QRNG_PROBE3(name, x1, x2, x3)             do { } while (0)
+#define QRNG_PROBE4(name, x1, x2, x3, x4)         do { } while (0)
+#define QRNG_PROBE_SEMAPHORE(name)                extern int qrng_##name##_unused
+#define QRNG_PROBE_ENABLED(name)                  0
+#define QRNG_GATED_PROBE2(name, x1, x2)           do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,543 @@
+// Proxy mode: serves the service's own D-Bus interface (same object path,
+// interface and ReadBytes signature) under another bus name, or under the
+// service's name on another bus, so consumers that speak D-Bus directly can
+// use it unchanged.
+//
+// Requests are answered from a prefetched buffer. The buffer is refilled
+// from the upstream service with large ReadBytes calls whenever a whole
+// refill fits, so many small requests cost one upstream call. A request
+// that finds too few bytes waits in FIFO order for refills, up to its own
+// timeout argument. Requests too large for the buffer are passed through
+// as a single upstream call. Every byte is handed out once.
+//
+// With power_save the buffer is instead left to drain to what clients
+// consume in a few refill latencies, then topped up in calls of up to half
+// the buffer, so a light load costs a few large upstream calls rather
+// than a steady stream of small ones.
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conn-pool.h"
+#include "modes.h"
+#include "qrng.h"
+
+#define PROXY_RETRY_USEC        100000  // Pause refills after an upstream failure
+#define PROXY_DEFAULT_TIMEOUT   25000   // For requests with a zero timeout argument, in ms
+#define PROXY_RECENT_USEC       10000000  // Window of the live latency percentiles
+#define PROXY_RATE_USEC         1000000   // Consumption rate sample, for power_save
+#define PROXY_LEAD              4         // Refill latencies of consumption kept buffered
+
+typedef struct proxy proxy_t;
+
+typedef struct proxy_request {
+    sd_bus_message *call;
+    uint64_t length;
+    uint64_t arrived_usec;
+    uint64_t deadline_usec;
+    struct proxy_request *next;
+} proxy_request_t;
+
+typedef struct upstream_call {
+    proxy_t *proxy;
+    sd_bus_message *call;       // Pass-through: the request to answer, else NULL
+    uint64_t arrived_usec;      // Of the request, or when the refill was issued
+    uint64_t length;
+    struct upstream_call *prev;
+    struct upstream_call *next;
+} upstream_call_t;
+
+struct proxy {
+    const proxy_options_t *opts;
+    sd_bus *bus;                // Where the interface is served
+    conn_pool_t *pool;          // Upstream
+
+    uint8_t *ring;
+    size_t head;                // Read position
+    size_t level;               // Bytes buffered
+    uint64_t in_flight_bytes;   // Refill bytes on their way
+    unsigned in_flight;
+    uint64_t retry_usec;        // No refills before this after a failure
+
+    // power_save pacing
+    double rate;                // Bytes/sec served, smoothed
+    uint64_t rate_usec;         // Start of the current rate sample
+    uint64_t rate_bytes;        // bytes_served at rate_usec
+    uint64_t refill_usec;       // Upstream refill latency, smoothed
+
+    proxy_request_t *queue_head;
+    proxy_request_t *queue_tail;
+    upstream_call_t *upstream;  // Calls in flight, answered with an error at exit
+
+    uint64_t start_usec;
+    qrng_cpu_stat_t cpu_start;  // cgroup CPU counters at start_usec
+    uint64_t requests;
+    uint64_t hits;              // Answered at once from the buffer
+    uint64_t waited;            // Queued for a refill
+    uint64_t passed_through;
+    uint64_t timed_out;
+    uint64_t bytes_served;
+    uint64_t upstream_calls;
+    uint64_t upstream_bytes;
+    uint64_t upstream_errors;
+    qrng_sketch_t latency;      // Request arrival to reply
+    qrng_window_t recent;       // The same over the last PROXY_RECENT_USEC
+};
+
+static volatile sig_atomic_t proxy_stop = 0;
+static volatile sig_atomic_t proxy_report = 0;
+
+static void proxy_signal_handler(int sig) {
+    if (sig == SIGUSR1) {
+        proxy_report = 1;
+    } else {
+        proxy_stop = 1;
+    }
+}
+
+static void ring_put(proxy_t *p, const uint8_t *src, size_t len) {
+    size_t cap = p->opts->buffer;
+    size_t tail = (p->head + p->level) % cap;
+    size_t first = len < cap - tail ? len : cap - tail;
+
+    memcpy(p->ring + tail, src, first);
+    memcpy(p->ring, src + first, len - first);
+    p->level += len;
+}
+
+// Move len bytes out of the ring and wipe them, so no served byte lingers
+static void ring_get(proxy_t *p, uint8_t *dst, size_t len) {
+    size_t cap = p->opts->buffer;
+    size_t first = len < cap - p->head ? len : cap - p->head;
+
+    memcpy(dst, p->ring + p->head, first);
+    explicit_bzero(p->ring + p->head, first);
+    memcpy(dst + first, p->ring, len - first);
+    explicit_bzero(p->ring, len - first);
+    p->head = (p->head + len) % cap;
+    p->level -= len;
+}
+
+// Answer call with len bytes, from the buffer or (src != NULL) from src
+static int reply_bytes(proxy_t *p, sd_bus_message *call, const void *src, uint64_t len,
+                       uint64_t arrived_usec) {
+    sd_bus_message *reply = NULL;
+    void *dst;
+    int ret;
+
+    ret = sd_bus_message_new_method_return(call, &reply);
+    if (ret >= 0) {
+        ret = sd_bus_message_append(reply, "i", 0);
+    }
+    if (ret >= 0) {
+        ret = sd_bus_message_append_array_space(reply, 'y', len, &dst);
+    }
+    if (ret >= 0) {
+        if (src) {
+            memcpy(dst, src, len);
+        } else {
+            ring_get(p, dst, len);
+        }
+        ret = sd_bus_send(NULL, reply, NULL);
+    }
+    sd_bus_message_unref(reply);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to reply: %s\n", strerror(-ret));
+        return ret;
+    }
+    p->bytes_served += len;
+    uint64_t now = qrng_now_usec();
+    qrng_sketch_add(&p->latency, now - arrived_usec);
+    qrng_window_add(&p->recent, now - arrived_usec, now);
+    return 0;
+}
+
+// Hand buffered bytes to waiting requests, oldest first
+static void serve_queue(proxy_t *p) {
+    while (p->queue_head && p->queue_head->length <= p->level) {
+        proxy_request_t *req = p->queue_head;
+        p->queue_head = req->next;
+        if (!p->queue_head) {
+            p->queue_tail = NULL;
+        }
+        reply_bytes(p, req->call, NULL, req->length, req->arrived_usec);
+        sd_bus_message_unref(req->call);
+        free(req);
+    }
+}
+
+// Waiting requests past their timeout get the error sd-bus would give them
+static uint64_t expire_queue(proxy_t *p, uint64_t now) {
+    proxy_request_t **link = &p->queue_head;
+    proxy_request_t *last = NULL;
+    uint64_t next = UINT64_MAX;
+
+    while (*link) {
+        proxy_request_t *req = *link;
+        if (req->deadline_usec > now) {
+            next = req->deadline_usec < next ? req->deadline_usec : next;
+            last = req;
+            link = &req->next;
+            continue;
+        }
+        *link = req->next;
+        sd_bus_reply_method_errorf(req->call, SD_BUS_ERROR_TIMEOUT,
+                                   "No random bytes within the timeout");
+        p->timed_out++;
+        sd_bus_message_unref(req->call);
+        free(req);
+    }
+    p->queue_tail = last;
+    return next;
+}
+
+static int upstream_reply(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
+    upstream_call_t *up = userdata;
+    proxy_t *p = up->proxy;
+    const void *ptr = NULL;
+    size_t len = 0;
+    int32_t status = 0;
+    int ret;
+
+    p->in_flight--;
+    if (!up->call) {
+        p->in_flight_bytes -= up->length;
+    }
+    if (up->prev) {
+        up->prev->next = up->next;
+    } else {
+        p->upstream = up->next;
+    }
+    if (up->next) {
+        up->next->prev = up->prev;
+    }
+    if (!reply) {
+        ret = -sd_bus_error_get_errno(ret_error);
+    } else if (sd_bus_message_is_method_error(reply, NULL)) {
+        ret = -sd_bus_message_get_errno(reply);
+    } else {
+        ret = sd_bus_message_read(reply, "i", &status);
+        if (ret >= 0 && status != 0) {
+            ret = -EIO;
+        }
+        if (ret >= 0) {
+            ret = sd_bus_message_read_array(reply, 'y', &ptr, &len);
+        }
+        if (ret >= 0 && len != up->length) {
+            ret = -EIO;
+        }
+    }
+
+    if (ret < 0) {
+        p->upstream_errors++;
+        p->retry_usec = qrng_now_usec() + PROXY_RETRY_USEC;
+        if (up->call) {
+            sd_bus_reply_method_errorf(up->call, SD_BUS_ERROR_FAILED,
+                                       "Upstream ReadBytes failed: %s", strerror(-ret));
+        }
+    } else if (up->call) {
+        reply_bytes(p, up->call, ptr, len, up->arrived_usec);
+    } else {
+        uint64_t took = qrng_now_usec() - up->arrived_usec;
+        p->refill_usec = p->refill_usec ? (7 * p->refill_usec + took) / 8 : took;
+        ring_put(p, ptr, len);
+        p->upstream_bytes += len;
+    }
+    sd_bus_message_unref(up->call);
+    free(up);
+    return 0;
+}
+
+static int upstream_issue(proxy_t *p, uint64_t length, sd_bus_message *call,
+                          uint64_t arrived_usec) {
+    upstream_call_t *up = calloc(1, sizeof(*up));
+    if (!up) {
+        return -ENOMEM;
+    }
+    up->proxy = p;
+    up->length = length;
+    up->call = sd_bus_message_ref(call);
+    up->arrived_usec = arrived_usec;
+    int ret = conn_pool_read_async(p->pool, length, upstream_reply, up);
+    if (ret < 0) {
+        sd_bus_message_unref(up->call);
+        free(up);
+        return ret;
+    }
+    p->in_flight++;
+    p->upstream_calls++;
+    if (!call) {
+        p->in_flight_bytes += length;
+    }
+    up->next = p->upstream;
+    if (p->upstream) {
+        p->upstream->prev = up;
+    }
+    p->upstream = up;
+    return 0;
+}
+
+static void update_rate(proxy_t *p, uint64_t now) {
+    if (now - p->rate_usec < PROXY_RATE_USEC) {
+        return;
+    }
+    double sample = (p->bytes_served - p->rate_bytes) * 1e6 / (now - p->rate_usec);
+    p->rate = p->rate_usec > p->start_usec ? (p->rate + sample) / 2 : sample;
+    p->rate_usec = now;
+    p->rate_bytes = p->bytes_served;
+}
+
+// Keep the buffer topped up: a refill goes out whenever it fits next to
+// what is buffered and on its way. With power_save only once the buffer
+// runs low or a request is waiting, but then with the whole room.
+static int refill(proxy_t *p) {
+    const proxy_options_t *opts = p->opts;
+    uint64_t now = qrng_now_usec();
+
+    if (now < p->retry_usec) {
+        return 0;
+    }
+    if (opts->power_save) {
+        update_rate(p, now);
+        uint64_t low = (uint64_t)(p->rate * p->refill_usec * PROXY_LEAD / 1e6) + opts->refill;
+        if (!p->queue_head && p->level + p->in_flight_bytes >= low) {
+            return 0;
+        }
+    }
+    while (p->in_flight < opts->window &&
+           p->level + p->in_flight_bytes + opts->refill <= opts->buffer) {
+        uint64_t size = opts->refill;
+        if (opts->power_save) {
+            size = opts->buffer - p->level - p->in_flight_bytes;
+            size = size < opts->buffer / 2 ? size : opts->buffer / 2;
+        }
+        int ret = upstream_issue(p, size, NULL, now);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int method_read_bytes(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    proxy_t *p = userdata;
+    uint64_t len, timeout_ms;
+    uint64_t now = qrng_now_usec();
+    int ret;
+
+    ret = sd_bus_message_read(m, "tt", &len, &timeout_ms);
+    if (ret < 0) {
+        return ret;
+    }
+    if (len > p->opts->max_request) {
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS,
+                                 "At most %u bytes per call", p->opts->max_request);
+    }
+    p->requests++;
+
+    // Nobody jumps the queue, or a stream of small requests could starve a
+    // larger one
+    if (!p->queue_head && len <= p->level) {
+        p->hits++;
+        ret = reply_bytes(p, m, NULL, len, now);
+        return ret < 0 ? ret : 1;
+    }
+    // The buffer stops growing within one refill of full, so anything
+    // larger might never fit
+    if (len > p->opts->buffer - p->opts->refill) {
+        p->passed_through++;
+        ret = upstream_issue(p, len, m, now);
+        return ret < 0 ? ret : 1;
+    }
+
+    proxy_request_t *req = calloc(1, sizeof(*req));
+    if (!req) {
+        return -ENOMEM;
+    }
+    req->call = sd_bus_message_ref(m);
+    req->length = len;
+    req->arrived_usec = now;
+    req->deadline_usec = now + (timeout_ms ? timeout_ms : PROXY_DEFAULT_TIMEOUT) * 1000;
+    if (p->queue_tail) {
+        p->queue_tail->next = req;
+    } else {
+        p->queue_head = req;
+    }
+    p->queue_tail = req;
+    p->waited++;
+    return 1;
+}
+
+static const sd_bus_vtable proxy_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("ReadBytes", "tt", "iay", method_read_bytes, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+static void print_proxy_report(proxy_t *p) {
+    uint64_t now = qrng_now_usec();
+    double secs = (now - p->start_usec) / 1e6;
+    conn_pool_stats_t stats;
+    qrng_sketch_t recent;
+
+    conn_pool_get_stats(p->pool, &stats);
+    qrng_window_snapshot(&p->recent, now, &recent);
+    printf("Proxy up %.1f s: %lu requests (%lu from the buffer, %lu waited, %lu passed through, "
+           "%lu timed out), %.1f KiB/s served\n",
+           secs, p->requests, p->hits, p->waited, p->passed_through, p->timed_out,
+           secs > 0 ? p->bytes_served / secs / 1024 : 0.0);
+    printf("  latency avg %.3f ms p50 %.3f ms p99 %.3f ms max %.3f ms; "
+           "last 10 s p50 %.3f ms p99 %.3f ms\n",
+           p->latency.total ? p->latency.sum / (double)p->latency.total / 1000 : 0.0,
+           qrng_sketch_quantile(&p->latency, 0.5) / 1000.0,
+           qrng_sketch_quantile(&p->latency, 0.99) / 1000.0, p->latency.max / 1000.0,
+           qrng_sketch_quantile(&recent, 0.5) / 1000.0,
+           qrng_sketch_quantile(&recent, 0.99) / 1000.0);
+    printf("  upstream: %lu calls (%.1f/s, %lu failed), %lu bytes buffered of %u, "
+           "%u/%u connections up\n",
+           p->upstream_calls, secs > 0 ? p->upstream_calls / secs : 0.0, p->upstream_errors,
+           (uint64_t)p->level, p->opts->buffer, stats.healthy, p->opts->pool.connections);
+    print_process_load("  ", p->start_usec);
+    print_cpu_throttling("  ", &p->cpu_start);
+    fflush(stdout);
+}
+
+int run_proxy(const proxy_options_t *opts) {
+    proxy_t p = { .opts = opts };
+    int ret;
+
+    p.start_usec = qrng_now_usec();
+    p.rate_usec = p.start_usec;
+    qrng_cpu_stat(qrng_limits(), &p.cpu_start);
+    qrng_window_init(&p.recent, PROXY_RECENT_USEC);
+    p.ring = malloc(opts->buffer);
+    if (!p.ring) {
+        return -ENOMEM;
+    }
+
+    ret = conn_pool_new(&opts->pool, &p.pool);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to upstream bus: %s\n", strerror(-ret));
+        goto out;
+    }
+    ret = qrng_bus_open(NULL, &p.bus);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to bus: %s\n", strerror(-ret));
+        goto out;
+    }
+    ret = sd_bus_add_object_vtable(p.bus, NULL, QRNG_OBJECT_PATH, QRNG_INTERFACE, proxy_vtable, &p);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to add object: %s\n", strerror(-ret));
+        goto out;
+    }
+    // Take the name over from an owner that allows it
+    ret = sd_bus_request_name(p.bus, opts->name, SD_BUS_NAME_REPLACE_EXISTING);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to acquire %s: %s\n", opts->name, strerror(-ret));
+        goto out;
+    }
+
+    struct sigaction sa = { .sa_handler = proxy_signal_handler };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    if (opts->log_to_stdout) {
+        printf("Serving %s on %s: %u byte buffer, refills of %u bytes%s, %u in flight\n",
+               opts->name, QRNG_OBJECT_PATH, opts->buffer, opts->refill,
+               opts->power_save ? " (more when low, power save)" : "", opts->window);
+    }
+
+    while (!proxy_stop) {
+        if (proxy_report) {
+            proxy_report = 0;
+            print_proxy_report(&p);
+        }
+
+        // Upstream replies first, so requests see the freshest level
+        do {
+            ret = conn_pool_process(p.pool);
+        } while (ret > 0);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to process upstream bus: %s\n", strerror(-ret));
+            break;
+        }
+        serve_queue(&p);
+        do {
+            ret = sd_bus_process(p.bus, NULL);
+        } while (ret > 0);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to process bus: %s\n", strerror(-ret));
+            break;
+        }
+        serve_queue(&p);
+        ret = refill(&p);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to issue ReadBytes: %s\n", strerror(-ret));
+            break;
+        }
+
+        uint64_t now = qrng_now_usec();
+        uint64_t until = expire_queue(&p, now);
+        uint64_t pool_until = conn_pool_prepare(p.pool);
+        uint64_t bus_until;
+        until = pool_until < until ? pool_until : until;
+        if (sd_bus_get_timeout(p.bus, &bus_until) >= 0 && bus_until < until) {
+            until = bus_until;
+        }
+        if (p.retry_usec > now && p.retry_usec < until) {
+            until = p.retry_usec;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = sd_bus_get_fd(p.bus), .events = sd_bus_get_events(p.bus) },
+            { .fd = conn_pool_get_fd(p.pool), .events = POLLIN },
+        };
+        int timeout = until == UINT64_MAX ? -1
+                    : until <= now         ? 0
+                                           : (int)((until - now + 999) / 1000);
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            ret = -errno;
+            fprintf(stderr, "Failed to wait for events: %s\n", strerror(-ret));
+            break;
+        }
+        ret = 0;
+    }
+
+    print_proxy_report(&p);
+
+out:
+    // Nobody is left to answer waiting and passed-through requests, so
+    // fail them now rather than let the callers run into their timeouts
+    while (p.queue_head) {
+        proxy_request_t *req = p.queue_head;
+        p.queue_head = req->next;
+        sd_bus_reply_method_errorf(req->call, SD_BUS_ERROR_FAILED, "Proxy is shutting down");
+        sd_bus_message_unref(req->call);
+        free(req);
+    }
+    while (p.upstream) {
+        upstream_call_t *up = p.upstream;
+        p.upstream = up->next;
+        if (up->call) {
+            sd_bus_reply_method_errorf(up->call, SD_BUS_ERROR_FAILED, "Proxy is shutting down");
+            sd_bus_message_unref(up->call);
+        }
+        free(up);
+    }
+    // The pool drops its calls without callbacks, their records are gone
+    conn_pool_free(p.pool);
+    if (p.bus) {
+        sd_bus_flush(p.bus);
+        sd_bus_unref(p.bus);
+    }
+    if (p.ring) {
+        explicit_bzero(p.ring, opts->buffer);
+    }
+    free(p.ring);
+    return ret;
+}
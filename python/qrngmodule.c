@@ -0,0 +1,392 @@
+// Python binding over the client library: fills writable buffer-protocol
+// objects (bytearray, array.array, NumPy arrays, ...) in place with raw
+// bytes, uniform integers or uniform floats. The GIL is released while
+// waiting for the service.
+//
+// Requests up to POOL_LIMIT bytes are served from a process-wide entropy
+// pool; larger ones use a bus connection of the calling thread and are
+// read straight into the target memory.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../qrng.h"
+
+#define POOL_LIMIT     (64 * 1024)
+#define DIRECT_CHUNK   (8 * 1024 * 1024)  // Largest single ReadBytes call
+#define DRAW_BATCH     4096               // Integer draws fetched at a time
+
+static qrng_pool_t *pool;
+
+// sd-bus connections are not thread-safe and do not survive fork(). The
+// key's destructor closes a thread's connection when the thread exits.
+static __thread sd_bus *thread_bus;
+static __thread pid_t thread_bus_pid;
+static pthread_key_t thread_bus_key;
+
+static void thread_bus_release(void *bus) {
+    sd_bus_flush_close_unref(bus);
+}
+
+static void thread_bus_drop(void) {
+    thread_bus = sd_bus_unref(thread_bus);
+    pthread_setspecific(thread_bus_key, NULL);
+}
+
+// Called with the GIL held, so creation cannot race
+static int ensure_pool(void) {
+    if (pool) {
+        return 0;
+    }
+    qrng_pool_config_t config = {0};
+    return qrng_pool_new(&config, &pool);
+}
+
+static int read_direct(void *buf, size_t len) {
+    uint8_t *dst = buf;
+    int ret;
+
+    if (thread_bus && thread_bus_pid != getpid()) {
+        thread_bus_drop();
+    }
+    while (len > 0) {
+        if (!thread_bus) {
+            ret = sd_bus_open_user(&thread_bus);
+            if (ret < 0) {
+                return ret;
+            }
+            thread_bus_pid = getpid();
+            pthread_setspecific(thread_bus_key, thread_bus);
+        }
+        size_t n = len < DIRECT_CHUNK ? len : DIRECT_CHUNK;
+        ret = qrng_read(thread_bus, dst, n, 0);
+        if (ret < 0) {
+            if (!sd_bus_is_open(thread_bus)) {
+                thread_bus_drop();
+            }
+            return ret;
+        }
+        dst += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Raw bytes into buf. Runs without the GIL.
+static int fill_raw(void *buf, size_t len) {
+    if (len <= POOL_LIMIT) {
+        return qrng_pool_read(pool, buf, len);
+    }
+    return read_direct(buf, len);
+}
+
+static PyObject *set_errno(int ret) {
+    errno = -ret;
+    return PyErr_SetFromErrno(PyExc_OSError);
+}
+
+static int get_buffer(PyObject *obj, Py_buffer *view) {
+    if (PyObject_GetBuffer(obj, view, PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0) {
+        return -1;
+    }
+    if (ensure_pool() < 0) {
+        PyBuffer_Release(view);
+        PyErr_SetString(PyExc_OSError, "Failed to create entropy pool");
+        return -1;
+    }
+    return 0;
+}
+
+// Single-character struct format code of view, ignoring byte order prefixes
+static char format_code(const Py_buffer *view) {
+    const char *f = view->format ? view->format : "B";
+    if (*f == '@' || *f == '=' || *f == '<') {
+        f++;
+    }
+    return f[0] && !f[1] ? f[0] : 0;
+}
+
+PyDoc_STRVAR(fill_bytes_doc,
+"fill_bytes(buffer)\n\n"
+"Fill a writable, C-contiguous buffer with random bytes.");
+
+static PyObject *py_fill_bytes(PyObject *self, PyObject *args) {
+    PyObject *obj;
+    Py_buffer view;
+    int ret;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "O:fill_bytes", &obj) || get_buffer(obj, &view) < 0) {
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    ret = view.len > 0 ? fill_raw(view.buf, view.len) : 0;
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if (ret < 0) {
+        return set_errno(ret);
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(fill_floats_doc,
+"fill_floats(buffer)\n\n"
+"Fill a buffer of doubles ('d') or floats ('f') with uniform values in\n"
+"[0, 1), using 53 or 24 random bits per value.");
+
+static PyObject *py_fill_floats(PyObject *self, PyObject *args) {
+    PyObject *obj;
+    Py_buffer view;
+    int ret;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "O:fill_floats", &obj) || get_buffer(obj, &view) < 0) {
+        return NULL;
+    }
+    char code = format_code(&view);
+    if (!(code == 'd' && view.itemsize == 8) && !(code == 'f' && view.itemsize == 4)) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_TypeError, "fill_floats needs a buffer of float64 or float32");
+        return NULL;
+    }
+
+    size_t n = view.len / view.itemsize;
+    uint8_t *p = view.buf;
+    Py_BEGIN_ALLOW_THREADS
+    // Random bits are written in place, then turned into values in place;
+    // memcpy keeps the integer reads and float writes from aliasing
+    ret = view.len > 0 ? fill_raw(view.buf, view.len) : 0;
+    if (ret == 0 && code == 'd') {
+        for (size_t i = 0; i < n; i++) {
+            uint64_t u;
+            memcpy(&u, p + i * 8, 8);
+            double d = (u >> 11) * 0x1.0p-53;
+            memcpy(p + i * 8, &d, 8);
+        }
+    } else if (ret == 0) {
+        for (size_t i = 0; i < n; i++) {
+            uint32_t u;
+            memcpy(&u, p + i * 4, 4);
+            float f = (u >> 8) * 0x1.0p-24f;
+            memcpy(p + i * 4, &f, 4);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if (ret < 0) {
+        return set_errno(ret);
+    }
+    Py_RETURN_NONE;
+}
+
+// Uniform value in [0, range) from 32- or 64-bit draws (Lemire's
+// multiply-shift with rejection, so there is no modulo bias). Draws come
+// from draws[*pos] and are refilled from the pool when used up.
+typedef struct {
+    uint8_t *draws;
+    size_t count;
+    size_t pos;
+    int wide;
+} draw_state_t;
+
+static int next_draw(draw_state_t *s, uint64_t *ret_draw) {
+    if (s->pos == s->count) {
+        int ret = fill_raw(s->draws, s->count * (s->wide ? 8 : 4));
+        if (ret < 0) {
+            return ret;
+        }
+        s->pos = 0;
+    }
+    if (s->wide) {
+        memcpy(ret_draw, s->draws + s->pos * 8, 8);
+    } else {
+        uint32_t v;
+        memcpy(&v, s->draws + s->pos * 4, 4);
+        *ret_draw = v;
+    }
+    s->pos++;
+    return 0;
+}
+
+static int uniform(draw_state_t *s, uint64_t range, uint64_t *ret_value) {
+    uint64_t x;
+    int ret;
+
+    if (s->wide) {
+        ret = next_draw(s, &x);
+        if (ret < 0) {
+            return ret;
+        }
+        unsigned __int128 m = (unsigned __int128)x * range;
+        if ((uint64_t)m < range) {
+            uint64_t threshold = -range % range;
+            while ((uint64_t)m < threshold) {
+                ret = next_draw(s, &x);
+                if (ret < 0) {
+                    return ret;
+                }
+                m = (unsigned __int128)x * range;
+            }
+        }
+        *ret_value = (uint64_t)(m >> 64);
+        return 0;
+    }
+
+    ret = next_draw(s, &x);
+    if (ret < 0) {
+        return ret;
+    }
+    uint64_t m = x * range;
+    if ((uint32_t)m < range) {
+        uint32_t threshold = (uint32_t)(-(uint32_t)range % (uint32_t)range);
+        while ((uint32_t)m < threshold) {
+            ret = next_draw(s, &x);
+            if (ret < 0) {
+                return ret;
+            }
+            m = x * range;
+        }
+    }
+    *ret_value = m >> 32;
+    return 0;
+}
+
+static int fill_uniform(Py_buffer *view, uint64_t low, uint64_t range) {
+    size_t n = view->len / view->itemsize;
+    // Small arrays fetch only what they need; rejections refetch
+    draw_state_t s = { .count = n < DRAW_BATCH ? n : DRAW_BATCH, .wide = range > UINT32_MAX };
+    size_t draws_len = s.count * (s.wide ? 8 : 4);
+    int ret = 0;
+
+    if (n == 0) {
+        return 0;
+    }
+    s.pos = s.count;
+    s.draws = qrng_buf_alloc(draws_len);
+    if (!s.draws) {
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v;
+        ret = uniform(&s, range, &v);
+        if (ret < 0) {
+            break;
+        }
+        v += low;
+        switch (view->itemsize) {
+            case 1: ((uint8_t *)view->buf)[i] = (uint8_t)v; break;
+            case 2: ((uint16_t *)view->buf)[i] = (uint16_t)v; break;
+            case 4: ((uint32_t *)view->buf)[i] = (uint32_t)v; break;
+            default: ((uint64_t *)view->buf)[i] = v; break;
+        }
+    }
+    qrng_buf_free(s.draws, draws_len);
+    return ret;
+}
+
+PyDoc_STRVAR(fill_integers_doc,
+"fill_integers(buffer, low, high)\n\n"
+"Fill an integer buffer with values drawn uniformly from [low, high).\n"
+"Uses 4 random bytes per value when the range fits in 32 bits, else 8.\n"
+"For the full range of the element type use fill_bytes.");
+
+static PyObject *py_fill_integers(PyObject *self, PyObject *args) {
+    PyObject *obj, *low_obj, *high_obj;
+    Py_buffer view;
+    uint64_t low, high;
+    int ret;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "OOO:fill_integers", &obj, &low_obj, &high_obj) ||
+        get_buffer(obj, &view) < 0) {
+        return NULL;
+    }
+
+    char code = format_code(&view);
+    const char *signed_codes = "bhilq";
+    const char *unsigned_codes = "BHILQ";
+    int is_signed = code && strchr(signed_codes, code);
+    if (!code || (!is_signed && !strchr(unsigned_codes, code)) ||
+        (view.itemsize != 1 && view.itemsize != 2 && view.itemsize != 4 && view.itemsize != 8)) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_TypeError, "fill_integers needs a buffer of integers");
+        return NULL;
+    }
+
+    // Both bounds must fit the element type; high is exclusive
+    unsigned bits = view.itemsize * 8;
+    if (is_signed) {
+        long long l = PyLong_AsLongLong(low_obj);
+        long long h = PyLong_AsLongLong(high_obj);
+        long long min = bits == 64 ? LLONG_MIN : -(1LL << (bits - 1));
+        long long max = bits == 64 ? LLONG_MAX : (1LL << (bits - 1)) - 1;
+        if (PyErr_Occurred() || l >= h || l < min || h - 1 > max) {
+            goto range_error;
+        }
+        low = (uint64_t)l;
+        high = (uint64_t)h;
+    } else {
+        unsigned long long l = PyLong_AsUnsignedLongLong(low_obj);
+        unsigned long long h = PyLong_AsUnsignedLongLong(high_obj);
+        unsigned long long max = bits == 64 ? ULLONG_MAX : (1ULL << bits) - 1;
+        if (PyErr_Occurred() || l >= h || h - 1 > max) {
+            goto range_error;
+        }
+        low = l;
+        high = h;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = fill_uniform(&view, low, high - low);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if (ret < 0) {
+        return set_errno(ret);
+    }
+    Py_RETURN_NONE;
+
+range_error:
+    PyBuffer_Release(&view);
+    PyErr_Clear();
+    PyErr_SetString(PyExc_ValueError, "need low < high within the range of the element type");
+    return NULL;
+}
+
+static PyMethodDef qrng_methods[] = {
+    {"fill_bytes", py_fill_bytes, METH_VARARGS, fill_bytes_doc},
+    {"fill_floats", py_fill_floats, METH_VARARGS, fill_floats_doc},
+    {"fill_integers", py_fill_integers, METH_VARARGS, fill_integers_doc},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef qrng_module = {
+    PyModuleDef_HEAD_INIT,
+    "qrng",
+    "Fill buffers in place with entropy from the lv.lumii.trng D-Bus service.",
+    -1,
+    qrng_methods,
+    NULL, NULL, NULL, NULL
+};
+
+static pthread_once_t thread_bus_once = PTHREAD_ONCE_INIT;
+static int thread_bus_key_error;
+
+static void thread_bus_key_init(void) {
+    thread_bus_key_error = pthread_key_create(&thread_bus_key, thread_bus_release);
+}
+
+PyMODINIT_FUNC PyInit_qrng(void) {
+    pthread_once(&thread_bus_once, thread_bus_key_init);
+    if (thread_bus_key_error) {
+        errno = thread_bus_key_error;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return PyModule_Create(&qrng_module);
+}
@@ -0,0 +1,27 @@
+# Build: cd python && python3 setup.py build_ext --inplace
+import subprocess
+
+from setuptools import Extension, setup
+
+
+def pkg_config(flag, package="libsystemd"):
+    out = subprocess.run(["pkg-config", flag, package], capture_output=True, text=True, check=True)
+    return [arg[2:] for arg in out.stdout.split()]
+
+
+setup(
+    name="qrng",
+    version="0.1",
+    description="Fill buffers in place with entropy from the lv.lumii.trng D-Bus service",
+    ext_modules=[
+        Extension(
+            "qrng",
+            sources=["qrngmodule.c", "../qrng.c"],
+            include_dirs=pkg_config("--cflags-only-I"),
+            library_dirs=pkg_config("--libs-only-L"),
+            libraries=pkg_config("--libs-only-l"),
+            extra_compile_args=["-pthread"],
+            extra_link_args=["-pthread"],
+        )
+    ],
+)
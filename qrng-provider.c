@@ -0,0 +1,381 @@
+// OpenSSL 3 provider exposing the QRNG pool as a RAND implementation.
+//
+// Load it through openssl.cnf (see readme) and select "QRNG" as the primary
+// DRBG or as the seed source. Bytes come from a qrng_pool_t filled by a
+// background thread, and each calling thread keeps a small cache on top of
+// the pool, so RAND_bytes() in a handshake is a memcpy rather than a D-Bus
+// round trip.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/core.h>
+#include <openssl/core_dispatch.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#include <openssl/rand.h>
+
+#include "qrng.h"
+
+#define QRNG_PROVIDER_VERSION   "0.1"
+#define QRNG_STRENGTH           256
+#define QRNG_MAX_REQUEST        (1 << 16)
+#define QRNG_TLS_CACHE_MAX      (64 * 1024)
+#define QRNG_TLS_CACHE_DEFAULT  4096
+
+typedef struct {
+    const OSSL_CORE_HANDLE *handle;
+    qrng_pool_t *pool;
+    size_t tls_cache_bytes;
+} qrng_provider_t;
+
+typedef struct {
+    qrng_provider_t *prov;
+    int state;
+} qrng_rand_ctx_t;
+
+// Per-thread cache refilled from the pool in tls_cache_bytes chunks, so the
+// pool lock is taken once per chunk rather than once per RAND_bytes call
+typedef struct {
+    uint8_t buf[QRNG_TLS_CACHE_MAX];
+    size_t pos;
+    size_t len;
+    unsigned generation;
+    const qrng_provider_t *owner;
+} qrng_tls_cache_t;
+
+static __thread qrng_tls_cache_t tls_cache;
+
+static size_t param_size(const OSSL_PARAM *params, const char *key, size_t fallback) {
+    const OSSL_PARAM *p = OSSL_PARAM_locate_const(params, key);
+    const char *value;
+
+    if (!p || !OSSL_PARAM_get_utf8_ptr(p, &value) || !value) {
+        return fallback;
+    }
+    char *end;
+    unsigned long long v = strtoull(value, &end, 0);
+    return (end != value && *end == '\0' && v > 0) ? (size_t)v : fallback;
+}
+
+// Drop cached bytes that must not be handed out: after fork the parent may
+// emit the same ones, and a reloaded provider owns a different pool.
+static void tls_cache_check(const qrng_provider_t *prov) {
+    unsigned generation = qrng_fork_generation();
+
+    if (tls_cache.owner != prov || tls_cache.generation != generation) {
+        explicit_bzero(tls_cache.buf, sizeof(tls_cache.buf));
+        tls_cache.pos = 0;
+        tls_cache.len = 0;
+        tls_cache.owner = prov;
+        tls_cache.generation = generation;
+    }
+}
+
+static int qrng_fill(qrng_provider_t *prov, unsigned char *out, size_t outlen) {
+    tls_cache_check(prov);
+
+    while (outlen > 0) {
+        size_t avail = tls_cache.len - tls_cache.pos;
+        if (avail > 0) {
+            size_t n = outlen < avail ? outlen : avail;
+            memcpy(out, tls_cache.buf + tls_cache.pos, n);
+            explicit_bzero(tls_cache.buf + tls_cache.pos, n);
+            tls_cache.pos += n;
+            out += n;
+            outlen -= n;
+            continue;
+        }
+
+        // Large requests bypass the cache
+        if (outlen >= prov->tls_cache_bytes) {
+            return qrng_pool_read(prov->pool, out, outlen) == 0;
+        }
+
+        if (qrng_pool_read(prov->pool, tls_cache.buf, prov->tls_cache_bytes) < 0) {
+            return 0;
+        }
+        tls_cache.pos = 0;
+        tls_cache.len = prov->tls_cache_bytes;
+    }
+    return 1;
+}
+
+static void *qrng_rand_newctx(void *provctx, void *parent, const OSSL_DISPATCH *parent_calls) {
+    (void)parent;
+    (void)parent_calls;
+
+    qrng_rand_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    if (ctx) {
+        ctx->prov = provctx;
+        ctx->state = EVP_RAND_STATE_UNINITIALISED;
+    }
+    return ctx;
+}
+
+static void qrng_rand_freectx(void *vctx) {
+    free(vctx);
+}
+
+static int qrng_rand_instantiate(void *vctx, unsigned int strength, int prediction_resistance,
+                                 const unsigned char *pstr, size_t pstr_len,
+                                 const OSSL_PARAM params[]) {
+    qrng_rand_ctx_t *ctx = vctx;
+    (void)prediction_resistance;
+    (void)pstr;
+    (void)pstr_len;
+    (void)params;
+
+    if (strength > QRNG_STRENGTH) {
+        return 0;
+    }
+    ctx->state = EVP_RAND_STATE_READY;
+    return 1;
+}
+
+static int qrng_rand_uninstantiate(void *vctx) {
+    qrng_rand_ctx_t *ctx = vctx;
+    ctx->state = EVP_RAND_STATE_UNINITIALISED;
+    return 1;
+}
+
+static int qrng_rand_generate(void *vctx, unsigned char *out, size_t outlen,
+                              unsigned int strength, int prediction_resistance,
+                              const unsigned char *adin, size_t adin_len) {
+    qrng_rand_ctx_t *ctx = vctx;
+    (void)prediction_resistance;
+    (void)adin;
+    (void)adin_len;
+
+    if (strength > QRNG_STRENGTH) {
+        return 0;
+    }
+    if (!qrng_fill(ctx->prov, out, outlen)) {
+        ctx->state = EVP_RAND_STATE_ERROR;
+        return 0;
+    }
+    return 1;
+}
+
+static int qrng_rand_reseed(void *vctx, int prediction_resistance,
+                            const unsigned char *ent, size_t ent_len,
+                            const unsigned char *adin, size_t adin_len) {
+    (void)vctx;
+    (void)prediction_resistance;
+    (void)ent;
+    (void)ent_len;
+    (void)adin;
+    (void)adin_len;
+    return 1;
+}
+
+// Used when a DRBG is chained on top of us as its seed source
+static size_t qrng_rand_get_seed(void *vctx, unsigned char **buffer, int entropy,
+                                 size_t min_len, size_t max_len, int prediction_resistance,
+                                 const unsigned char *adin, size_t adin_len) {
+    qrng_rand_ctx_t *ctx = vctx;
+    size_t len = (size_t)(entropy + 7) / 8;
+    (void)prediction_resistance;
+    (void)adin;
+    (void)adin_len;
+
+    if (len < min_len) {
+        len = min_len;
+    }
+    if (len > max_len) {
+        return 0;
+    }
+
+    unsigned char *seed = OPENSSL_secure_malloc(len);
+    if (!seed) {
+        return 0;
+    }
+    if (!qrng_fill(ctx->prov, seed, len)) {
+        OPENSSL_secure_clear_free(seed, len);
+        return 0;
+    }
+    *buffer = seed;
+    return len;
+}
+
+static void qrng_rand_clear_seed(void *vctx, unsigned char *buffer, size_t b_len) {
+    (void)vctx;
+    OPENSSL_secure_clear_free(buffer, b_len);
+}
+
+// The cache is thread-local and the pool has its own lock
+static int qrng_rand_enable_locking(void *vctx) {
+    (void)vctx;
+    return 1;
+}
+
+static int qrng_rand_lock(void *vctx) {
+    (void)vctx;
+    return 1;
+}
+
+static void qrng_rand_unlock(void *vctx) {
+    (void)vctx;
+}
+
+static const OSSL_PARAM *qrng_rand_gettable_ctx_params(void *vctx, void *provctx) {
+    static const OSSL_PARAM gettable[] = {
+        OSSL_PARAM_int(OSSL_RAND_PARAM_STATE, NULL),
+        OSSL_PARAM_uint(OSSL_RAND_PARAM_STRENGTH, NULL),
+        OSSL_PARAM_size_t(OSSL_RAND_PARAM_MAX_REQUEST, NULL),
+        OSSL_PARAM_END
+    };
+    (void)vctx;
+    (void)provctx;
+    return gettable;
+}
+
+static int qrng_rand_get_ctx_params(void *vctx, OSSL_PARAM params[]) {
+    qrng_rand_ctx_t *ctx = vctx;
+    OSSL_PARAM *p;
+
+    p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STATE);
+    if (p && !OSSL_PARAM_set_int(p, ctx->state)) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STRENGTH);
+    if (p && !OSSL_PARAM_set_uint(p, QRNG_STRENGTH)) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_MAX_REQUEST);
+    if (p && !OSSL_PARAM_set_size_t(p, QRNG_MAX_REQUEST)) {
+        return 0;
+    }
+    return 1;
+}
+
+static int qrng_rand_verify_zeroization(void *vctx) {
+    (void)vctx;
+    return 1;
+}
+
+static const OSSL_DISPATCH qrng_rand_functions[] = {
+    { OSSL_FUNC_RAND_NEWCTX, (void (*)(void))qrng_rand_newctx },
+    { OSSL_FUNC_RAND_FREECTX, (void (*)(void))qrng_rand_freectx },
+    { OSSL_FUNC_RAND_INSTANTIATE, (void (*)(void))qrng_rand_instantiate },
+    { OSSL_FUNC_RAND_UNINSTANTIATE, (void (*)(void))qrng_rand_uninstantiate },
+    { OSSL_FUNC_RAND_GENERATE, (void (*)(void))qrng_rand_generate },
+    { OSSL_FUNC_RAND_RESEED, (void (*)(void))qrng_rand_reseed },
+    { OSSL_FUNC_RAND_GET_SEED, (void (*)(void))qrng_rand_get_seed },
+    { OSSL_FUNC_RAND_CLEAR_SEED, (void (*)(void))qrng_rand_clear_seed },
+    { OSSL_FUNC_RAND_ENABLE_LOCKING, (void (*)(void))qrng_rand_enable_locking },
+    { OSSL_FUNC_RAND_LOCK, (void (*)(void))qrng_rand_lock },
+    { OSSL_FUNC_RAND_UNLOCK, (void (*)(void))qrng_rand_unlock },
+    { OSSL_FUNC_RAND_GETTABLE_CTX_PARAMS, (void (*)(void))qrng_rand_gettable_ctx_params },
+    { OSSL_FUNC_RAND_GET_CTX_PARAMS, (void (*)(void))qrng_rand_get_ctx_params },
+    { OSSL_FUNC_RAND_VERIFY_ZEROIZATION, (void (*)(void))qrng_rand_verify_zeroization },
+    { 0, NULL }
+};
+
+static const OSSL_ALGORITHM qrng_rands[] = {
+    { "QRNG", "provider=qrng", qrng_rand_functions, "Buffered QRNG entropy over D-Bus" },
+    { NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_ALGORITHM *qrng_query_operation(void *provctx, int operation_id, int *no_cache) {
+    (void)provctx;
+    *no_cache = 0;
+    return operation_id == OSSL_OP_RAND ? qrng_rands : NULL;
+}
+
+static const OSSL_PARAM *qrng_gettable_params(void *provctx) {
+    static const OSSL_PARAM gettable[] = {
+        OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_NAME, NULL, 0),
+        OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_VERSION, NULL, 0),
+        OSSL_PARAM_int(OSSL_PROV_PARAM_STATUS, NULL),
+        OSSL_PARAM_END
+    };
+    (void)provctx;
+    return gettable;
+}
+
+static int qrng_get_params(void *provctx, OSSL_PARAM params[]) {
+    OSSL_PARAM *p;
+    (void)provctx;
+
+    p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_NAME);
+    if (p && !OSSL_PARAM_set_utf8_ptr(p, "QRNG D-Bus provider")) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_VERSION);
+    if (p && !OSSL_PARAM_set_utf8_ptr(p, QRNG_PROVIDER_VERSION)) {
+        return 0;
+    }
+    p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS);
+    if (p && !OSSL_PARAM_set_int(p, 1)) {
+        return 0;
+    }
+    return 1;
+}
+
+static void qrng_teardown(void *provctx) {
+    qrng_provider_t *prov = provctx;
+
+    qrng_pool_free(prov->pool);
+    free(prov);
+}
+
+static const OSSL_DISPATCH qrng_provider_functions[] = {
+    { OSSL_FUNC_PROVIDER_TEARDOWN, (void (*)(void))qrng_teardown },
+    { OSSL_FUNC_PROVIDER_QUERY_OPERATION, (void (*)(void))qrng_query_operation },
+    { OSSL_FUNC_PROVIDER_GETTABLE_PARAMS, (void (*)(void))qrng_gettable_params },
+    { OSSL_FUNC_PROVIDER_GET_PARAMS, (void (*)(void))qrng_get_params },
+    { 0, NULL }
+};
+
+int OSSL_provider_init(const OSSL_CORE_HANDLE *handle, const OSSL_DISPATCH *in,
+                       const OSSL_DISPATCH **out, void **provctx) {
+    OSSL_FUNC_core_get_params_fn *core_get_params = NULL;
+    qrng_pool_config_t config = {0};
+    qrng_provider_t *prov;
+
+    for (; in->function_id != 0; in++) {
+        if (in->function_id == OSSL_FUNC_CORE_GET_PARAMS) {
+            core_get_params = OSSL_FUNC_core_get_params(in);
+        }
+    }
+
+    // Tunables come from the provider's section in openssl.cnf
+    const char *pool_bytes = NULL, *refill_bytes = NULL, *cache_bytes = NULL;
+    const char *power_save = NULL;
+    OSSL_PARAM core_params[] = {
+        OSSL_PARAM_utf8_ptr("pool_bytes", (char **)&pool_bytes, 0),
+        OSSL_PARAM_utf8_ptr("refill_bytes", (char **)&refill_bytes, 0),
+        OSSL_PARAM_utf8_ptr("cache_bytes", (char **)&cache_bytes, 0),
+        OSSL_PARAM_utf8_ptr("power_save", (char **)&power_save, 0),
+        OSSL_PARAM_END
+    };
+    if (core_get_params) {
+        core_get_params(handle, core_params);
+    }
+
+    prov = calloc(1, sizeof(*prov));
+    if (!prov) {
+        return 0;
+    }
+    prov->handle = handle;
+
+    config.capacity = param_size(core_params, "pool_bytes", 0);
+    config.refill_bytes = param_size(core_params, "refill_bytes", 0);
+    config.power_save = param_size(core_params, "power_save", 0) != 0;
+    prov->tls_cache_bytes = param_size(core_params, "cache_bytes", QRNG_TLS_CACHE_DEFAULT);
+    if (prov->tls_cache_bytes > QRNG_TLS_CACHE_MAX) {
+        prov->tls_cache_bytes = QRNG_TLS_CACHE_MAX;
+    }
+
+    if (qrng_pool_new(&config, &prov->pool) < 0) {
+        free(prov);
+        return 0;
+    }
+
+    *out = qrng_provider_functions;
+    *provctx = prov;
+    return 1;
+}
@@ -0,0 +1,1047 @@
+#define _GNU_SOURCE
+
+#include "qrng.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define POOL_DEFAULT_CAPACITY  (1024 * 1024)
+#define POOL_DEFAULT_REFILL    (256 * 1024)
+#define POOL_MIN_CAPACITY      (64 * 1024)    // Floor when fitting the default to a memory limit
+#define POOL_RETRY_DELAY_MS    100
+#define POOL_LEAD              4              // power_save: refill latencies of reads kept buffered
+#define POOL_SLACK_NS          (20 * 1000 * 1000)
+
+struct qrng_pool {
+    qrng_pool_config_t config;
+
+    pthread_mutex_t lock;
+    pthread_cond_t data_ready;   // Signalled when bytes are added
+    pthread_cond_t need_refill;  // Signalled when the level drops below the watermark
+
+    uint8_t *ring;
+    size_t head;                 // Read position
+    size_t level;                // Bytes buffered
+
+    pthread_t thread;
+    int thread_running;
+    int stopping;
+    int last_error;              // Negative errno of the last failed refill, 0 otherwise
+    size_t wake_level;           // Readers wake the refill thread below this
+
+    // power_save pacing, refill thread only
+    double rate;                 // Bytes/sec read, smoothed
+    uint64_t rate_usec;          // Start of the current rate sample
+    uint64_t rate_bytes;         // stats.bytes_out at rate_usec
+    uint64_t refill_usec;        // Refill latency, smoothed
+
+    qrng_pool_stats_t stats;
+    qrng_sketch_t refill_latency; // Written by the refill thread only
+    struct qrng_pool *next;      // Registry link for fork handling
+};
+
+// All live pools, so fork handlers can quiesce and reset them
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static qrng_pool_t *registry = NULL;
+static volatile unsigned fork_generation = 0;
+static uint64_t bytes_copied = 0;  // Payload bytes copied out of replies
+
+int qrng_bus_open(const char *address, sd_bus **ret) {
+    sd_bus *bus = NULL;
+    int r;
+
+    if (!address) {
+        return sd_bus_open_user(ret);
+    }
+    r = sd_bus_new(&bus);
+    if (r < 0) {
+        return r;
+    }
+    r = sd_bus_set_address(bus, address);
+    if (r >= 0) {
+        r = sd_bus_set_bus_client(bus, 1);
+    }
+    if (r >= 0 && strncmp(address, "tcp:", 4) == 0) {
+        r = sd_bus_set_anonymous(bus, 1);
+    }
+    if (r >= 0) {
+        r = sd_bus_start(bus);
+    }
+    if (r < 0) {
+        sd_bus_unref(bus);
+        return r;
+    }
+    *ret = bus;
+    return 0;
+}
+
+int qrng_read(sd_bus *bus, void *buf, size_t len, uint64_t timeout_ms) {
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    return qrng_readv(bus, &iov, 1, timeout_ms);
+}
+
+int qrng_readv(sd_bus *bus, const struct iovec *iov, int iovcnt, uint64_t timeout_ms) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    size_t len = 0;
+    int ret;
+
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    ret = sd_bus_call_method(bus, QRNG_SERVICE, QRNG_OBJECT_PATH, QRNG_INTERFACE,
+                             QRNG_METHOD, &error, &reply, "tt",
+                             (uint64_t)len, timeout_ms);
+    if (ret < 0) {
+        goto out;
+    }
+
+    int32_t status;
+    ret = sd_bus_message_read(reply, "i", &status);
+    if (ret < 0) {
+        goto out;
+    }
+    if (status != 0) {
+        ret = -EIO;
+        goto out;
+    }
+
+    // The payload is read in place from the message, so scattering it
+    // costs no more than the single memcpy of qrng_read
+    const uint8_t *ptr;
+    size_t octets_len;
+    ret = sd_bus_message_read_array(reply, 'y', (const void **)&ptr, &octets_len);
+    if (ret < 0) {
+        goto out;
+    }
+    if (octets_len != len) {
+        ret = -EIO;
+        goto out;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, ptr, iov[i].iov_len);
+        ptr += iov[i].iov_len;
+    }
+    __atomic_fetch_add(&bytes_copied, len, __ATOMIC_RELAXED);
+    ret = 0;
+
+out:
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+    return ret;
+}
+
+uint64_t qrng_bytes_copied(void) {
+    return __atomic_load_n(&bytes_copied, __ATOMIC_RELAXED);
+}
+
+int qrng_has_batch(sd_bus *bus) {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply = NULL;
+    const char *xml;
+    int ret;
+
+    ret = sd_bus_call_method(bus, QRNG_SERVICE, QRNG_OBJECT_PATH,
+                             "org.freedesktop.DBus.Introspectable", "Introspect",
+                             &error, &reply, "");
+    if (ret >= 0) {
+        ret = sd_bus_message_read(reply, "s", &xml);
+    }
+    if (ret >= 0) {
+        ret = strstr(xml, "<method name=\"" QRNG_METHOD_BATCH "\">") != NULL;
+    }
+    sd_bus_error_free(&error);
+    sd_bus_message_unref(reply);
+    return ret;
+}
+
+void qrng_pool_config_defaults(qrng_pool_config_t *config) {
+    if (config->capacity == 0) {
+        uint64_t fit = qrng_limits_memory_budget(qrng_limits()) / 8;
+        config->capacity = POOL_DEFAULT_CAPACITY;
+        if (fit < config->capacity) {
+            config->capacity = fit > POOL_MIN_CAPACITY ? fit : POOL_MIN_CAPACITY;
+        }
+    }
+    if (config->refill_bytes == 0) {
+        config->refill_bytes = POOL_DEFAULT_REFILL;
+    }
+    if (config->refill_bytes > config->capacity) {
+        config->refill_bytes = config->capacity;
+    }
+    if (config->low_watermark == 0 || config->low_watermark > config->capacity) {
+        config->low_watermark = config->capacity - config->refill_bytes + 1;
+    }
+}
+
+// Describe the n free bytes behind the buffered data, so a refill can be
+// read straight into the ring; returns the number of iovecs used. Caller
+// holds the lock. Only the refill thread adds data and readers never move
+// the tail, so the region stays free after the lock is dropped.
+static int ring_free_iov(qrng_pool_t *pool, size_t n, struct iovec iov[2]) {
+    size_t cap = pool->config.capacity;
+    size_t tail = (pool->head + pool->level) % cap;
+    size_t first = n < cap - tail ? n : cap - tail;
+
+    iov[0].iov_base = pool->ring + tail;
+    iov[0].iov_len = first;
+    iov[1].iov_base = pool->ring;
+    iov[1].iov_len = n - first;
+    return n > first ? 2 : 1;
+}
+
+// Move n bytes out of the ring and wipe them. Caller holds the lock.
+static void ring_pop(qrng_pool_t *pool, uint8_t *dst, size_t n) {
+    size_t cap = pool->config.capacity;
+    size_t first = n < cap - pool->head ? n : cap - pool->head;
+
+    memcpy(dst, pool->ring + pool->head, first);
+    explicit_bzero(pool->ring + pool->head, first);
+    memcpy(dst + first, pool->ring, n - first);
+    explicit_bzero(pool->ring, n - first);
+    pool->head = (pool->head + n) % cap;
+    pool->level -= n;
+}
+
+// power_save: after a refill, set the level for the next one from how fast
+// readers took the last batch and how long refills take. Caller holds the lock.
+static void pool_pace_locked(qrng_pool_t *pool, uint64_t now, uint64_t took) {
+    if (pool->rate_usec && now > pool->rate_usec) {
+        double sample = (pool->stats.bytes_out - pool->rate_bytes) * 1e6 / (now - pool->rate_usec);
+        pool->rate = pool->rate ? (pool->rate + sample) / 2 : sample;
+    }
+    pool->rate_usec = now;
+    pool->rate_bytes = pool->stats.bytes_out;
+    pool->refill_usec = pool->refill_usec ? (7 * pool->refill_usec + took) / 8 : took;
+
+    double low = pool->config.capacity / 8 + pool->rate * pool->refill_usec * POOL_LEAD / 1e6;
+    pool->wake_level = low < pool->config.low_watermark ? (size_t)low : pool->config.low_watermark;
+}
+
+static void *refill_thread(void *userdata) {
+    qrng_pool_t *pool = userdata;
+    sd_bus *bus = NULL;
+    int ret;
+
+    if (pool->config.power_save) {
+        prctl(PR_SET_TIMERSLACK, POOL_SLACK_NS, 0, 0, 0);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopping) {
+        if (pool->level >= pool->wake_level) {
+            pthread_cond_wait(&pool->need_refill, &pool->lock);
+            pool->stats.wakeups++;
+            continue;
+        }
+
+        size_t want = pool->config.capacity - pool->level;
+        if (want > pool->config.refill_bytes && !pool->config.power_save) {
+            want = pool->config.refill_bytes;
+        }
+        struct iovec iov[2];
+        int iovcnt = ring_free_iov(pool, want, iov);
+        pthread_mutex_unlock(&pool->lock);
+
+        // The connection belongs to this thread only; sd-bus objects are
+        // not thread-safe.
+        uint64_t took = 0;
+        ret = bus ? 0 : qrng_bus_open(pool->config.address, &bus);
+        if (ret >= 0) {
+            uint64_t start = qrng_now_usec();
+            ret = qrng_readv(bus, iov, iovcnt, pool->config.timeout_ms);
+            took = qrng_now_usec() - start;
+            if (ret >= 0) {
+                qrng_sketch_add(&pool->refill_latency, took);
+            }
+        }
+        if (ret < 0 && bus && !sd_bus_is_open(bus)) {
+            bus = sd_bus_unref(bus);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (ret < 0) {
+            pool->last_error = ret;
+            pool->stats.refill_errors++;
+            pthread_cond_broadcast(&pool->data_ready);
+
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += POOL_RETRY_DELAY_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            if (!pool->stopping) {
+                pthread_cond_timedwait(&pool->need_refill, &pool->lock, &deadline);
+                pool->stats.wakeups++;
+            }
+            continue;
+        }
+
+        pool->level += want;
+        pool->last_error = 0;
+        pool->stats.refills++;
+        pool->stats.bytes_in += want;
+        if (pool->config.power_save) {
+            pool_pace_locked(pool, qrng_now_usec(), took);
+        }
+        pthread_cond_broadcast(&pool->data_ready);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    sd_bus_unref(bus);
+    return NULL;
+}
+
+// Start the refill thread if it is not running. Caller holds the lock.
+static int pool_start_locked(qrng_pool_t *pool) {
+    if (pool->thread_running) {
+        return 0;
+    }
+    int ret = pthread_create(&pool->thread, NULL, refill_thread, pool);
+    if (ret != 0) {
+        return -ret;
+    }
+    pool->thread_running = 1;
+    return 0;
+}
+
+static void fork_prepare(void) {
+    pthread_mutex_lock(&registry_lock);
+    for (qrng_pool_t *pool = registry; pool; pool = pool->next) {
+        pthread_mutex_lock(&pool->lock);
+    }
+}
+
+static void fork_parent(void) {
+    for (qrng_pool_t *pool = registry; pool; pool = pool->next) {
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+// The child has no refill threads and must not reuse buffered bytes the
+// parent may also hand out. Wipe every pool; threads restart on next read.
+static void fork_child(void) {
+    fork_generation++;
+    for (qrng_pool_t *pool = registry; pool; pool = pool->next) {
+        explicit_bzero(pool->ring, pool->config.capacity);
+        pool->head = 0;
+        pool->level = 0;
+        pool->thread_running = 0;
+        pool->last_error = 0;
+        pthread_cond_init(&pool->data_ready, NULL);
+        pthread_cond_init(&pool->need_refill, NULL);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void registry_init(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+unsigned qrng_fork_generation(void) {
+    return fork_generation;
+}
+
+int qrng_pool_new(const qrng_pool_config_t *config, qrng_pool_t **ret) {
+    qrng_pool_t *pool;
+    int r;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return -ENOMEM;
+    }
+
+    pool->config = *config;
+    qrng_pool_config_defaults(&pool->config);
+    pool->wake_level = pool->config.low_watermark;
+
+    pool->ring = calloc(1, pool->config.capacity);
+    // The caller's string need not outlive the call
+    pool->config.address = config->address ? strdup(config->address) : NULL;
+    if (!pool->ring || (config->address && !pool->config.address)) {
+        free(pool->ring);
+        free(pool);
+        return -ENOMEM;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->data_ready, NULL);
+    pthread_cond_init(&pool->need_refill, NULL);
+
+    pthread_once(&registry_once, registry_init);
+    pthread_mutex_lock(&registry_lock);
+    pool->next = registry;
+    registry = pool;
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    r = pool_start_locked(pool);
+    pthread_mutex_unlock(&pool->lock);
+    if (r < 0) {
+        qrng_pool_free(pool);
+        return r;
+    }
+
+    *ret = pool;
+    return 0;
+}
+
+void qrng_pool_free(qrng_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&registry_lock);
+    for (qrng_pool_t **p = &registry; *p; p = &(*p)->next) {
+        if (*p == pool) {
+            *p = pool->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->need_refill);
+    int running = pool->thread_running;
+    pthread_mutex_unlock(&pool->lock);
+    if (running) {
+        pthread_join(pool->thread, NULL);
+    }
+
+    explicit_bzero(pool->ring, pool->config.capacity);
+    free(pool->ring);
+    pthread_cond_destroy(&pool->data_ready);
+    pthread_cond_destroy(&pool->need_refill);
+    pthread_mutex_destroy(&pool->lock);
+    free((char *)pool->config.address);
+    free(pool);
+}
+
+// Take what is buffered and wake the refill thread if the level got low.
+// Caller holds the lock.
+static size_t pool_take_locked(qrng_pool_t *pool, uint8_t *dst, size_t len) {
+    size_t n = len < pool->level ? len : pool->level;
+
+    if (n > 0) {
+        ring_pop(pool, dst, n);
+        pool->stats.bytes_out += n;
+    }
+    if (pool->level < pool->wake_level) {
+        pool_start_locked(pool);
+        pthread_cond_signal(&pool->need_refill);
+    }
+    return n;
+}
+
+int qrng_pool_read(qrng_pool_t *pool, void *buf, size_t len) {
+    uint8_t *dst = buf;
+    int waited = 0;
+    int ret = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (len > 0) {
+        size_t n = pool_take_locked(pool, dst, len);
+        dst += n;
+        len -= n;
+        if (len == 0) {
+            break;
+        }
+
+        if (pool->last_error < 0 && pool->level == 0 && waited) {
+            ret = pool->last_error;
+            break;
+        }
+        if (!waited) {
+            pool->stats.reader_waits++;
+        }
+        waited = 1;
+        pthread_cond_wait(&pool->data_ready, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (ret < 0) {
+        explicit_bzero(buf, dst - (uint8_t *)buf);
+    }
+    return ret;
+}
+
+size_t qrng_pool_try_read(qrng_pool_t *pool, void *buf, size_t len) {
+    pthread_mutex_lock(&pool->lock);
+    size_t n = pool_take_locked(pool, buf, len);
+    pthread_mutex_unlock(&pool->lock);
+    return n;
+}
+
+void qrng_pool_get_stats(qrng_pool_t *pool, qrng_pool_stats_t *stats) {
+    qrng_sketch_t latency = {0};
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    stats->level = pool->level;
+    pthread_mutex_unlock(&pool->lock);
+
+    // The refill thread may be adding to it right now; no lock needed
+    qrng_sketch_merge(&latency, &pool->refill_latency);
+    stats->refill_p50_usec = qrng_sketch_quantile(&latency, 0.5);
+    stats->refill_p99_usec = qrng_sketch_quantile(&latency, 0.99);
+}
+
+// Buffer size classes: 1 << BUF_MIN_SHIFT up to 1 << BUF_MAX_SHIFT
+#define BUF_MIN_SHIFT     6
+#define BUF_MAX_SHIFT     22
+#define BUF_CLASSES       (BUF_MAX_SHIFT - BUF_MIN_SHIFT + 1)
+#define BUF_SLAB_SHIFT    12                 // Classes up to 4 KiB come from slabs
+#define BUF_SLAB_SIZE     (64 * 1024)
+#define BUF_THREAD_BYTES  (1024 * 1024)      // Cache limit per class and thread
+#define BUF_DEPOT_BYTES   (16 * 1024 * 1024) // Depot limit per class
+
+// Free buffers are linked through their first bytes
+typedef struct buf_block {
+    struct buf_block *next;
+} buf_block_t;
+
+typedef struct {
+    buf_block_t *head;
+    size_t count;
+} buf_list_t;
+
+typedef struct {
+    buf_list_t lists[BUF_CLASSES];
+    int registered;
+} buf_cache_t;
+
+static __thread buf_cache_t buf_cache;
+static pthread_once_t buf_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buf_key;
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static buf_list_t depot[BUF_CLASSES];
+static qrng_buf_stats_t buf_stats;  // Updated with relaxed atomics
+
+// The caps above, lowered in buf_init to fit a cgroup memory limit
+static size_t buf_thread_bytes = BUF_THREAD_BYTES;
+static size_t buf_depot_bytes = BUF_DEPOT_BYTES;
+
+#define BUF_STAT_ADD(field, n) __atomic_fetch_add(&buf_stats.field, (n), __ATOMIC_RELAXED)
+
+static unsigned buf_class(size_t len) {
+    if (len <= (1u << BUF_MIN_SHIFT)) {
+        return 0;
+    }
+    return (64 - __builtin_clzll(len - 1)) - BUF_MIN_SHIFT;
+}
+
+static size_t buf_class_size(unsigned c) {
+    return (size_t)1 << (c + BUF_MIN_SHIFT);
+}
+
+static size_t buf_thread_cap(unsigned c) {
+    size_t cap = buf_thread_bytes / buf_class_size(c);
+    return cap < 2 ? 2 : cap;
+}
+
+static int buf_from_slab(unsigned c) {
+    return c + BUF_MIN_SHIFT <= BUF_SLAB_SHIFT;
+}
+
+static void buf_push(buf_list_t *list, void *buf) {
+    buf_block_t *block = buf;
+    block->next = list->head;
+    list->head = block;
+    list->count++;
+}
+
+static void *buf_pop(buf_list_t *list) {
+    buf_block_t *block = list->head;
+    list->head = block->next;
+    list->count--;
+    block->next = NULL;
+    return block;
+}
+
+static void buf_move(buf_list_t *dst, buf_list_t *src, size_t n) {
+    while (n-- > 0 && src->head) {
+        buf_push(dst, buf_pop(src));
+    }
+}
+
+// Give depot buffers over the cap back to malloc. Slab buffers stay, since
+// their slab cannot be freed piecemeal. Caller holds depot_lock.
+static void depot_trim(unsigned c) {
+    size_t cap = buf_depot_bytes / buf_class_size(c);
+
+    if (buf_from_slab(c)) {
+        return;
+    }
+    while (depot[c].count > cap) {
+        free(buf_pop(&depot[c]));
+        BUF_STAT_ADD(released, 1);
+        BUF_STAT_ADD(reserved_bytes, -(uint64_t)buf_class_size(c));
+    }
+}
+
+// Thread exit: hand the cached buffers to the depot
+static void buf_cache_flush(void *userdata) {
+    buf_cache_t *cache = userdata;
+
+    pthread_mutex_lock(&depot_lock);
+    for (unsigned c = 0; c < BUF_CLASSES; c++) {
+        buf_move(&depot[c], &cache->lists[c], SIZE_MAX);
+        depot_trim(c);
+    }
+    pthread_mutex_unlock(&depot_lock);
+}
+
+static void depot_fork_prepare(void) {
+    pthread_mutex_lock(&depot_lock);
+}
+
+static void depot_fork_release(void) {
+    pthread_mutex_unlock(&depot_lock);
+}
+
+static void buf_init(void) {
+    // Each class may keep its share of the memory budget in the depot, and
+    // a quarter of that per thread
+    uint64_t share = qrng_limits_memory_budget(qrng_limits()) / BUF_CLASSES;
+    if (share < buf_depot_bytes) {
+        buf_depot_bytes = share;
+    }
+    if (share / 4 < buf_thread_bytes) {
+        buf_thread_bytes = share / 4;
+    }
+    pthread_key_create(&buf_key, buf_cache_flush);
+    pthread_atfork(depot_fork_prepare, depot_fork_release, depot_fork_release);
+}
+
+static buf_cache_t *buf_thread_cache(void) {
+    if (!buf_cache.registered) {
+        pthread_once(&buf_once, buf_init);
+        pthread_setspecific(buf_key, &buf_cache);
+        buf_cache.registered = 1;
+    }
+    return &buf_cache;
+}
+
+// Nothing cached: carve a new slab or malloc a single buffer
+static void *buf_fresh(buf_list_t *list, unsigned c) {
+    size_t size = buf_class_size(c);
+
+    if (!buf_from_slab(c)) {
+        void *buf = malloc(size);
+        if (buf) {
+            BUF_STAT_ADD(reserved_bytes, size);
+        }
+        return buf;
+    }
+
+    uint8_t *slab = malloc(BUF_SLAB_SIZE);
+    if (!slab) {
+        return NULL;
+    }
+    BUF_STAT_ADD(reserved_bytes, BUF_SLAB_SIZE);
+    for (size_t off = size; off < BUF_SLAB_SIZE; off += size) {
+        buf_push(list, slab + off);
+    }
+    return slab;
+}
+
+void *qrng_buf_alloc(size_t len) {
+    BUF_STAT_ADD(allocs, 1);
+    if (len > buf_class_size(BUF_CLASSES - 1)) {
+        BUF_STAT_ADD(large, 1);
+        return malloc(len);
+    }
+
+    unsigned c = buf_class(len);
+    buf_list_t *list = &buf_thread_cache()->lists[c];
+    if (list->head) {
+        BUF_STAT_ADD(thread_hits, 1);
+        return buf_pop(list);
+    }
+
+    // Refill half the thread's cache in one go
+    pthread_mutex_lock(&depot_lock);
+    buf_move(list, &depot[c], buf_thread_cap(c) / 2);
+    pthread_mutex_unlock(&depot_lock);
+    if (list->head) {
+        BUF_STAT_ADD(depot_hits, 1);
+        return buf_pop(list);
+    }
+    return buf_fresh(list, c);
+}
+
+void qrng_buf_free(void *buf, size_t len) {
+    if (!buf) {
+        return;
+    }
+    explicit_bzero(buf, len);
+    if (len > buf_class_size(BUF_CLASSES - 1)) {
+        free(buf);
+        return;
+    }
+
+    unsigned c = buf_class(len);
+    buf_list_t *list = &buf_thread_cache()->lists[c];
+    buf_push(list, buf);
+    if (list->count > buf_thread_cap(c)) {
+        // Most recently freed buffers stay: they are the ones still in cache
+        buf_list_t keep = { NULL, 0 };
+        buf_move(&keep, list, buf_thread_cap(c) / 2);
+        pthread_mutex_lock(&depot_lock);
+        buf_move(&depot[c], list, SIZE_MAX);
+        depot_trim(c);
+        pthread_mutex_unlock(&depot_lock);
+        buf_move(list, &keep, SIZE_MAX);
+    }
+}
+
+void qrng_buf_get_stats(qrng_buf_stats_t *stats) {
+    stats->allocs = __atomic_load_n(&buf_stats.allocs, __ATOMIC_RELAXED);
+    stats->thread_hits = __atomic_load_n(&buf_stats.thread_hits, __ATOMIC_RELAXED);
+    stats->depot_hits = __atomic_load_n(&buf_stats.depot_hits, __ATOMIC_RELAXED);
+    stats->large = __atomic_load_n(&buf_stats.large, __ATOMIC_RELAXED);
+    stats->released = __atomic_load_n(&buf_stats.released, __ATOMIC_RELAXED);
+    stats->reserved_bytes = __atomic_load_n(&buf_stats.reserved_bytes, __ATOMIC_RELAXED);
+    stats->depot_bytes = 0;
+    pthread_mutex_lock(&depot_lock);
+    for (unsigned c = 0; c < BUF_CLASSES; c++) {
+        stats->depot_bytes += depot[c].count * buf_class_size(c);
+    }
+    pthread_mutex_unlock(&depot_lock);
+}
+
+static pthread_once_t limits_once = PTHREAD_ONCE_INIT;
+static qrng_limits_t limits;
+
+// First line of a cgroup control file
+static int limits_read_file(const char *dir, const char *name, char *buf, size_t size) {
+    char path[sizeof(limits.cpu_cgroup) + 32];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return -errno;
+    }
+    int ret = fgets(buf, (int)size, f) ? 0 : -EIO;
+    fclose(f);
+    return ret;
+}
+
+// memory.max and memory.high hold a byte count or "max"
+static void limits_read_memory(const char *dir, const char *name, qrng_limits_t *out) {
+    char buf[64];
+    char *end;
+
+    if (limits_read_file(dir, name, buf, sizeof(buf)) < 0) {
+        return;
+    }
+    uint64_t bytes = strtoull(buf, &end, 10);
+    if (end != buf && (out->memory_max == 0 || bytes < out->memory_max)) {
+        out->memory_max = bytes;
+    }
+}
+
+// Collect the limits of dir and every ancestor up to the hierarchy's root,
+// which is the first root_len characters of dir
+static void limits_walk(qrng_limits_t *out, char *dir, size_t root_len) {
+    char buf[64];
+
+    for (;;) {
+        char quota[32];
+        unsigned long period;
+        if (limits_read_file(dir, "cpu.max", buf, sizeof(buf)) == 0 &&
+            sscanf(buf, "%31s %lu", quota, &period) == 2 && strcmp(quota, "max") != 0 &&
+            period > 0) {
+            double cpus = strtoull(quota, NULL, 10) / (double)period;
+            if (out->cpu_quota == 0 || cpus < out->cpu_quota) {
+                out->cpu_quota = cpus;
+                snprintf(out->cpu_cgroup, sizeof(out->cpu_cgroup), "%s", dir);
+            }
+        }
+        limits_read_memory(dir, "memory.max", out);
+        limits_read_memory(dir, "memory.high", out);
+
+        char *slash = strrchr(dir, '/');
+        if (strlen(dir) <= root_len || !slash || (size_t)(slash - dir) < root_len) {
+            break;
+        }
+        *slash = '\0';
+    }
+}
+
+// Where the cgroup2 hierarchy is mounted and the process's cgroup in it
+static int limits_find_cgroup(char *dir, size_t size, size_t *root_len) {
+    char line[1024];
+    char root[256] = "", mount[256] = "", path[256] = "";
+
+    FILE *f = fopen("/proc/self/mountinfo", "re");
+    if (!f) {
+        return -errno;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        const char *fstype = strstr(line, " - ");
+        if (fstype && strncmp(fstype + 3, "cgroup2 ", 8) == 0 &&
+            sscanf(line, "%*s %*s %*s %255s %255s", root, mount) == 2) {
+            break;
+        }
+        mount[0] = '\0';
+    }
+    fclose(f);
+
+    f = fopen("/proc/self/cgroup", "re");
+    if (!f) {
+        return -errno;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            sscanf(line + 3, "%255s", path);
+        }
+    }
+    fclose(f);
+    if (!mount[0] || !path[0]) {
+        return -ENOENT;
+    }
+
+    // A mount of part of the hierarchy shows paths relative to its root
+    const char *rel = path;
+    size_t n = strlen(root);
+    if (strcmp(root, "/") != 0 && strncmp(path, root, n) == 0) {
+        rel += n;
+    }
+    *root_len = strlen(mount);
+    snprintf(dir, size, "%s%s", mount, strcmp(rel, "/") == 0 ? "" : rel);
+    return 0;
+}
+
+static void limits_init(void) {
+    char dir[sizeof(limits.cpu_cgroup)];
+    size_t root_len = 0;
+    cpu_set_t set;
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    limits.cpus_online = online > 0 ? (unsigned)online : 1;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        limits.cpus_online = (unsigned)CPU_COUNT(&set);
+    }
+    if (limits_find_cgroup(dir, sizeof(dir), &root_len) == 0) {
+        limits_walk(&limits, dir, root_len);
+    }
+}
+
+const qrng_limits_t *qrng_limits(void) {
+    pthread_once(&limits_once, limits_init);
+    return &limits;
+}
+
+unsigned qrng_limits_cpus(const qrng_limits_t *limits) {
+    unsigned cpus = limits->cpus_online;
+
+    if (limits->cpu_quota > 0) {
+        unsigned quota = (unsigned)limits->cpu_quota;
+        quota += limits->cpu_quota > quota;
+        if (quota < cpus) {
+            cpus = quota;
+        }
+    }
+    return cpus > 0 ? cpus : 1;
+}
+
+uint64_t qrng_limits_memory_budget(const qrng_limits_t *limits) {
+    return limits->memory_max ? limits->memory_max / 4 : UINT64_MAX;
+}
+
+int qrng_cpu_stat(const qrng_limits_t *limits, qrng_cpu_stat_t *stat) {
+    char path[sizeof(limits->cpu_cgroup) + 16];
+    char key[32];
+    uint64_t value;
+
+    memset(stat, 0, sizeof(*stat));
+    if (!limits->cpu_cgroup[0]) {
+        return -ENOENT;
+    }
+    snprintf(path, sizeof(path), "%s/cpu.stat", limits->cpu_cgroup);
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return -errno;
+    }
+    while (fscanf(f, "%31s %lu", key, &value) == 2) {
+        if (strcmp(key, "usage_usec") == 0) {
+            stat->usage_usec = value;
+        } else if (strcmp(key, "nr_periods") == 0) {
+            stat->nr_periods = value;
+        } else if (strcmp(key, "nr_throttled") == 0) {
+            stat->nr_throttled = value;
+        } else if (strcmp(key, "throttled_usec") == 0) {
+            stat->throttled_usec = value;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+uint64_t qrng_now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bucket_refill(qrng_bucket_t *bucket, uint64_t now_usec) {
+    if (now_usec > bucket->last_usec) {
+        bucket->tokens += bucket->rate * (now_usec - bucket->last_usec) / 1e6;
+        if (bucket->tokens > bucket->burst) {
+            bucket->tokens = bucket->burst;
+        }
+        bucket->last_usec = now_usec;
+    }
+}
+
+void qrng_bucket_init(qrng_bucket_t *bucket, double rate, double burst, uint64_t now_usec) {
+    bucket->rate = rate;
+    bucket->burst = burst;
+    bucket->tokens = burst;
+    bucket->last_usec = now_usec;
+}
+
+int qrng_bucket_take(qrng_bucket_t *bucket, double n, uint64_t now_usec) {
+    bucket_refill(bucket, now_usec);
+    if (bucket->tokens < n) {
+        return 0;
+    }
+    bucket->tokens -= n;
+    return 1;
+}
+
+uint64_t qrng_bucket_wait_usec(qrng_bucket_t *bucket, double n, uint64_t now_usec) {
+    bucket_refill(bucket, now_usec);
+    if (bucket->tokens >= n) {
+        return 0;
+    }
+    return (uint64_t)((n - bucket->tokens) * 1e6 / bucket->rate) + 1;
+}
+
+static unsigned sketch_index(uint64_t value) {
+    if (value < QRNG_SKETCH_SUB) {
+        return (unsigned)value;
+    }
+    unsigned exp = 63 - __builtin_clzll(value);
+    unsigned idx = QRNG_SKETCH_SUB + (exp - 4) * QRNG_SKETCH_SUB +
+                   (unsigned)((value >> (exp - 4)) & (QRNG_SKETCH_SUB - 1));
+    return idx < QRNG_SKETCH_BINS ? idx : QRNG_SKETCH_BINS - 1;
+}
+
+// Midpoint of the values that map to idx
+static uint64_t sketch_value(unsigned idx) {
+    if (idx < QRNG_SKETCH_SUB) {
+        return idx;
+    }
+    unsigned exp = (idx - QRNG_SKETCH_SUB) / QRNG_SKETCH_SUB + 4;
+    uint64_t low = (uint64_t)(QRNG_SKETCH_SUB + (idx - QRNG_SKETCH_SUB) % QRNG_SKETCH_SUB)
+                   << (exp - 4);
+    return low + ((1ULL << (exp - 4)) >> 1);
+}
+
+// Single-writer updates: plain arithmetic, stored so concurrent readers
+// never see a torn value
+#define SKETCH_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define SKETCH_LOAD(field)         __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+void qrng_sketch_add(qrng_sketch_t *sketch, uint64_t value) {
+    unsigned idx = sketch_index(value);
+
+    SKETCH_STORE(sketch->counts[idx], sketch->counts[idx] + 1);
+    SKETCH_STORE(sketch->total, sketch->total + 1);
+    SKETCH_STORE(sketch->sum, sketch->sum + value);
+    if (value > sketch->max) {
+        SKETCH_STORE(sketch->max, value);
+    }
+}
+
+void qrng_sketch_reset(qrng_sketch_t *sketch) {
+    for (unsigned i = 0; i < QRNG_SKETCH_BINS; i++) {
+        SKETCH_STORE(sketch->counts[i], 0);
+    }
+    SKETCH_STORE(sketch->total, 0);
+    SKETCH_STORE(sketch->sum, 0);
+    SKETCH_STORE(sketch->max, 0);
+}
+
+void qrng_sketch_merge(qrng_sketch_t *dst, const qrng_sketch_t *src) {
+    // The total is recounted from the buckets, so it always matches them
+    uint64_t total = 0;
+    for (unsigned i = 0; i < QRNG_SKETCH_BINS; i++) {
+        uint64_t n = SKETCH_LOAD(src->counts[i]);
+        if (n) {
+            dst->counts[i] += n;
+            total += n;
+        }
+    }
+    dst->total += total;
+    dst->sum += SKETCH_LOAD(src->sum);
+    uint64_t max = SKETCH_LOAD(src->max);
+    if (max > dst->max) {
+        dst->max = max;
+    }
+}
+
+uint64_t qrng_sketch_quantile(const qrng_sketch_t *sketch, double q) {
+    uint64_t total = SKETCH_LOAD(sketch->total);
+    uint64_t max = SKETCH_LOAD(sketch->max);
+
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < QRNG_SKETCH_BINS; i++) {
+        seen += SKETCH_LOAD(sketch->counts[i]);
+        if (seen >= rank) {
+            uint64_t v = sketch_value(i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+void qrng_window_init(qrng_window_t *window, uint64_t window_usec) {
+    memset(window, 0, sizeof(*window));
+    window->slot_usec = window_usec / QRNG_WINDOW_SLOTS ? window_usec / QRNG_WINDOW_SLOTS : 1;
+}
+
+void qrng_window_add(qrng_window_t *window, uint64_t value, uint64_t now_usec) {
+    uint64_t epoch = now_usec / window->slot_usec;
+    unsigned i = (unsigned)(epoch % QRNG_WINDOW_SLOTS);
+
+    // First value of a new slot: whatever it held is a window old
+    if (window->epochs[i] != epoch) {
+        qrng_sketch_reset(&window->slots[i]);
+        SKETCH_STORE(window->epochs[i], epoch);
+    }
+    qrng_sketch_add(&window->slots[i], value);
+}
+
+void qrng_window_snapshot(const qrng_window_t *window, uint64_t now_usec, qrng_sketch_t *out) {
+    uint64_t epoch = now_usec / window->slot_usec;
+
+    memset(out, 0, sizeof(*out));
+    for (unsigned i = 0; i < QRNG_WINDOW_SLOTS; i++) {
+        uint64_t e = SKETCH_LOAD(window->epochs[i]);
+        if (e <= epoch && epoch - e < QRNG_WINDOW_SLOTS) {
+            qrng_sketch_merge(out, &window->slots[i]);
+        }
+    }
+}
@@ -0,0 +1,211 @@
+#ifndef QRNG_H
+#define QRNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <systemd/sd-bus.h>
+
+// D-Bus coordinates of the RNG service
+#define QRNG_SERVICE     "lv.lumii.trng"
+#define QRNG_OBJECT_PATH "/lv/lumii/trng/SourceXorAggregator"
+#define QRNG_INTERFACE   "lv.lumii.trng.Rng"
+#define QRNG_METHOD      "ReadBytes"
+
+// Optional batched method: ReadBytesBatch(at lengths, t timeout_ms) returns
+// (i status, aay blocks) with one block per length, so many small requests
+// cost one message each way instead of one per request
+#define QRNG_METHOD_BATCH "ReadBytesBatch"
+
+// Connect to the bus at a D-Bus address such as
+// "tcp:host=rng.example,port=4711", or to the user bus if address is NULL.
+// TCP buses authenticate with ANONYMOUS, as EXTERNAL needs a Unix socket.
+int qrng_bus_open(const char *address, sd_bus **ret);
+
+// Read exactly len bytes with a single synchronous ReadBytes call.
+// Returns 0 on success or a negative errno value.
+int qrng_read(sd_bus *bus, void *buf, size_t len, uint64_t timeout_ms);
+
+// Like qrng_read, but fill iovcnt scattered buffers in order with a single
+// ReadBytes call for their total length. The payload is copied once, from
+// the reply message straight into the iovecs, so callers filling their own
+// arrays need no bounce buffer.
+int qrng_readv(sd_bus *bus, const struct iovec *iov, int iovcnt, uint64_t timeout_ms);
+
+// Payload bytes qrng_read/qrng_readv have copied out of reply messages
+uint64_t qrng_bytes_copied(void);
+
+// Whether the service advertises QRNG_METHOD_BATCH, checked by
+// introspecting its object. Returns 1 or 0, or a negative errno value if
+// the service could not be asked.
+int qrng_has_batch(sd_bus *bus);
+
+// Buffered entropy pool refilled in the background by its own thread and
+// bus connection, so readers never wait for a D-Bus round trip unless the
+// pool has run dry.
+typedef struct qrng_pool qrng_pool_t;
+
+typedef struct {
+    size_t capacity;       // Bytes held by the pool
+    size_t refill_bytes;   // Bytes requested per ReadBytes refill call
+    size_t low_watermark;  // Refill starts when the level drops below this
+    uint64_t timeout_ms;   // Timeout passed to ReadBytes
+    int power_save;        // Let the level drop to what readers take in a few refill
+                           // latencies (at least capacity / 8), then refill all the
+                           // room in one call; the refill thread gets timer slack
+    const char *address;   // Bus address as for qrng_bus_open, NULL = user bus
+} qrng_pool_config_t;
+
+typedef struct {
+    uint64_t refills;        // Successful ReadBytes refill calls
+    uint64_t refill_errors;  // Failed refill calls
+    uint64_t bytes_in;       // Bytes fetched from the service
+    uint64_t bytes_out;      // Bytes handed to readers
+    uint64_t reader_waits;   // Reads that had to wait for a refill
+    size_t level;            // Bytes currently buffered
+    uint64_t wakeups;        // Times the refill thread woke up
+    uint64_t refill_p50_usec; // Refill call latency, from the refill thread's sketch
+    uint64_t refill_p99_usec;
+} qrng_pool_stats_t;
+
+// Fill in defaults for any zero fields of config.
+void qrng_pool_config_defaults(qrng_pool_config_t *config);
+
+int qrng_pool_new(const qrng_pool_config_t *config, qrng_pool_t **ret);
+void qrng_pool_free(qrng_pool_t *pool);
+
+// Copy len bytes out of the pool, waiting for refills if needed.
+// Returns 0 on success or a negative errno value if the pool is empty and
+// the last refill failed.
+int qrng_pool_read(qrng_pool_t *pool, void *buf, size_t len);
+
+// Copy up to len bytes without waiting; returns the number of bytes copied.
+size_t qrng_pool_try_read(qrng_pool_t *pool, void *buf, size_t len);
+
+void qrng_pool_get_stats(qrng_pool_t *pool, qrng_pool_stats_t *stats);
+
+// Token bucket: tokens accrue at rate per second up to burst.
+typedef struct {
+    double tokens;
+    double rate;
+    double burst;
+    uint64_t last_usec;
+} qrng_bucket_t;
+
+void qrng_bucket_init(qrng_bucket_t *bucket, double rate, double burst, uint64_t now_usec);
+
+// Take n tokens if available; returns 1 on success, 0 if not enough.
+int qrng_bucket_take(qrng_bucket_t *bucket, double n, uint64_t now_usec);
+
+// Microseconds until n tokens are available (0 if they already are).
+uint64_t qrng_bucket_wait_usec(qrng_bucket_t *bucket, double n, uint64_t now_usec);
+
+// Streaming quantile sketch for latencies in microseconds: log-linear
+// buckets, 16 per power of two up to 2^40 us, so any quantile is within
+// about 3% of the true value in a fixed 4.7 KiB. Sketches merge by adding
+// counts. One thread may add to a sketch while others merge it into their
+// own or read quantiles: the writer updates each counter with a relaxed
+// atomic store and readers use relaxed loads, so neither takes a lock (a
+// reader may see an add that is half done, which skews it by one value).
+#define QRNG_SKETCH_SUB  16
+#define QRNG_SKETCH_BINS (QRNG_SKETCH_SUB + 36 * QRNG_SKETCH_SUB)
+
+typedef struct {
+    uint64_t counts[QRNG_SKETCH_BINS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} qrng_sketch_t;
+
+void qrng_sketch_add(qrng_sketch_t *sketch, uint64_t value);
+void qrng_sketch_reset(qrng_sketch_t *sketch);
+
+// Add src's values to dst; src may be written by another thread meanwhile
+void qrng_sketch_merge(qrng_sketch_t *dst, const qrng_sketch_t *src);
+
+uint64_t qrng_sketch_quantile(const qrng_sketch_t *sketch, double q);
+
+// Sliding window of sketches for live percentiles: QRNG_WINDOW_SLOTS
+// sketches each cover a slot of window_usec / QRNG_WINDOW_SLOTS, and the
+// oldest is reused as time moves on. A snapshot covers the last window
+// (less up to one slot). Same threading rules as a single sketch.
+#define QRNG_WINDOW_SLOTS 4
+
+typedef struct {
+    qrng_sketch_t slots[QRNG_WINDOW_SLOTS];
+    uint64_t epochs[QRNG_WINDOW_SLOTS];   // now / slot_usec each slot was last used for
+    uint64_t slot_usec;
+} qrng_window_t;
+
+void qrng_window_init(qrng_window_t *window, uint64_t window_usec);
+void qrng_window_add(qrng_window_t *window, uint64_t value, uint64_t now_usec);
+
+// Merge the slots still inside the window into out, which is reset first
+void qrng_window_snapshot(const qrng_window_t *window, uint64_t now_usec, qrng_sketch_t *out);
+
+// Buffers for copies of entropy, in power-of-two size classes from 64 B to
+// 4 MiB. Freed buffers are wiped and kept in a per-thread cache (overflow
+// goes to a shared depot), so the next buffer of that class is usually
+// still in cache and costs no malloc or page faults. Classes up to 4 KiB
+// are carved from 64 KiB slabs that are never returned to malloc. Larger
+// requests go to malloc directly but are still wiped on free.
+//
+// qrng_buf_free must be given the length the buffer was allocated with.
+void *qrng_buf_alloc(size_t len);
+void qrng_buf_free(void *buf, size_t len);
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t thread_hits;    // Served from the calling thread's cache
+    uint64_t depot_hits;     // Served from the shared depot
+    uint64_t large;          // Above the largest class, straight to malloc
+    uint64_t released;       // Cached buffers given back to malloc over the caps
+    uint64_t reserved_bytes; // Bytes currently held from malloc for size classes
+    size_t depot_bytes;      // Bytes currently cached in the depot
+} qrng_buf_stats_t;
+
+void qrng_buf_get_stats(qrng_buf_stats_t *stats);
+
+// Resource limits of the cgroup (v2) the process runs in. Inside a
+// container the host's CPU count and memory say little about what the
+// process may use, so defaults are fitted to these instead. Limits set on
+// any ancestor cgroup count; the tightest one wins.
+typedef struct {
+    unsigned cpus_online;     // CPUs in the affinity mask
+    double cpu_quota;         // cpu.max quota / period in CPUs, 0 = no quota
+    uint64_t memory_max;      // memory.max, or memory.high if lower, 0 = no limit
+    char cpu_cgroup[512];     // Directory of the cgroup with that quota, for cpu.stat
+} qrng_limits_t;
+
+// Read on first use and kept; never NULL, all zero outside a cgroup v2
+const qrng_limits_t *qrng_limits(void);
+
+// Threads worth running: the quota rounded up, within the affinity mask
+unsigned qrng_limits_cpus(const qrng_limits_t *limits);
+
+// Bytes to plan for in buffers, caches and windows: a quarter of the
+// memory limit, leaving the rest for the process itself, page cache and
+// whatever else shares the cgroup. UINT64_MAX without a limit.
+uint64_t qrng_limits_memory_budget(const qrng_limits_t *limits);
+
+// Throttling counters of the cgroup holding the CPU quota (cpu.stat)
+typedef struct {
+    uint64_t usage_usec;
+    uint64_t nr_periods;
+    uint64_t nr_throttled;
+    uint64_t throttled_usec;
+} qrng_cpu_stat_t;
+
+// Returns 0, -ENOENT if there is no quota, or another negative errno value
+int qrng_cpu_stat(const qrng_limits_t *limits, qrng_cpu_stat_t *stat);
+
+// CLOCK_MONOTONIC in microseconds
+uint64_t qrng_now_usec(void);
+
+// Incremented in every child after fork(). Callers keeping their own copies
+// of pool output (e.g. thread-local caches) must drop them when it changes,
+// otherwise parent and child would hand out the same bytes.
+unsigned qrng_fork_generation(void);
+
+#endif
@@ -5,34 +5,207 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
 #include <errno.h>
 
-// Function declarations
-void print_octets(const uint8_t *octets, size_t len, int should_log);
+#include "conn-pool.h"
+#include "flight-recorder.h"
+#include "modes.h"
+#include "probes.h"
+#include "qrng.h"
+#include "sink.h"
+
+// Options without a short form
+enum {
+    OPT_FEED_KERNEL = 256,
+    OPT_RANDOM_DEVICE,
+    OPT_RANDOM_PROC,
+    OPT_FEED_INTERVAL,
+    OPT_DAEMON,
+    OPT_CONNECT,
+    OPT_TENANT,
+    OPT_QUANTUM,
+    OPT_MAX_REQUEST,
+    OPT_MAX_OUTSTANDING,
+    OPT_SMALL_THRESHOLD,
+    OPT_SMALL_WINDOW,
+    OPT_MAX_RATE,
+    OPT_INTERVAL,
+    OPT_CONNECTIONS,
+    OPT_FAIL_FAST,
+    OPT_RCVBUF,
+    OPT_SNDBUF,
+    OPT_MAX_QUEUED_WRITES,
+    OPT_OUTPUT,
+    OPT_SINK_BUFFER,
+    OPT_WRITE_FILE,
+    OPT_RESUME,
+    OPT_SYNC_BYTES,
+    OPT_TRACE,
+    OPT_BATCH,
+    OPT_ADDRESS,
+    OPT_KEEPALIVE,
+    OPT_CONTAINER,
+    OPT_VERIFY_FILE,
+    OPT_PROXY,
+    OPT_PROXY_BUFFER,
+    OPT_FLIGHT_RECORDS,
+    OPT_FLIGHT_DUMP,
+    OPT_FLIGHT_LATENCY,
+    OPT_FLIGHT_ERRORS,
+    OPT_FLIGHT_STALL,
+    OPT_POWER_SAVE,
+};
+
+#define FEED_DEFAULT_BATCH    4096
+#define DAEMON_DEFAULT_WINDOW 16
+#define DAEMON_DEFAULT_MAX_REQUEST (64 * 1024 * 1024)
+#define DAEMON_DEFAULT_MAX_OUTSTANDING (256 * 1024 * 1024)
+#define DAEMON_MAX_TENANTS    64
+#define MAX_SINKS             8
+#define SINK_DEFAULT_BUFFER   (4 * 1024 * 1024)
+#define JOB_DEFAULT_SYNC      (64 * 1024 * 1024)
+#define PROXY_DEFAULT_BUFFER  (4 * 1024 * 1024)
+#define PROXY_DEFAULT_REFILL  (256 * 1024)
+#define PROXY_DEFAULT_WINDOW  4
+#define MAX_BATCH             1024
+#define MIN_FITTED_BUFFER     (64 * 1024)  // Floor for buffers fitted to a memory limit
+#define POWER_SAVE_SLACK_NS   (20 * 1000 * 1000)  // Timer slack with --power-save
 
 // Structure to track request state
-typedef struct {
+typedef struct request_context {
     int request_id;
     uint32_t expected_bytes;
     int log_to_stdout;
     int total_iterations;
+    int count;                  // Requests covered, from request_id on
+    uint64_t submit_usec;
+    uint32_t in_flight;         // Requests in flight when it was sent
+    uint64_t reply_usec;
+    struct request_context *next;  // On the resend list
 } request_context_t;
 
 // Global counters for async operations
 static int completed_requests = 0;
 static int failed_requests = 0;
+static uint64_t completed_bytes = 0;
+static qrng_sketch_t interval_latency;
+
+// Requests per ReadBytesBatch call (1 = single ReadBytes calls), and
+// requests handed back for resending after the service turned out not to
+// have the batched method. Resent requests keep their ids, so ids stay
+// unique among the requests in flight.
+static int batch_size = 1;
+static request_context_t *resend_head = NULL;
+static request_context_t *resend_tail = NULL;
+static int returned_requests = 0;
+
+// Outputs every reply is teed to, and the first error one of them reported
+static sink_set_t *sinks = NULL;
+static int sink_error = 0;
+
+// Per-call trace for capacity modelling (see bench/capacity-sim.py)
+static FILE *trace_file = NULL;
+
+static void trace_call(uint64_t issue_usec, size_t bytes, int status) {
+    if (trace_file) {
+        fprintf(trace_file, "%lu,%lu,%zu,%d\n", issue_usec, qrng_now_usec(), bytes, status);
+    }
+}
+
+// Last requests, dumped when something looks wrong (see flight-recorder.h)
+static flight_recorder_t *flight = NULL;
+
+static void flight_call(const request_context_t *ctx, int request_id, int status,
+                        uint64_t done_usec) {
+    flight_record_t rec = {
+        .start_usec = ctx->submit_usec,
+        .issue_usec = ctx->submit_usec,
+        .reply_usec = ctx->reply_usec,
+        .done_usec = done_usec,
+        .bytes = ctx->expected_bytes,
+        .status = status,
+        .in_flight = ctx->in_flight,
+        .id = (uint32_t)request_id,
+    };
+    flight_record(flight, &rec);
+}
+
+// Account for one block of a reply; fails if it has the wrong size
+static int handle_block(request_context_t *ctx, int request_id, const uint8_t *octets, size_t len) {
+    if (len != ctx->expected_bytes) {
+        fprintf(stderr, "Received %zu bytes, expected %u bytes (request %d)\n",
+                len, ctx->expected_bytes, request_id);
+        return -EIO;
+    }
+    QRNG_PROBE3(parse, request_id, len, ctx);
+
+    if (sinks) {
+        int ret = sink_set_publish(sinks, octets, len);
+        if (ret < 0 && sink_error == 0) {
+            sink_error = ret;
+        }
+    }
 
-// Callback function for async D-Bus method calls
+    // Log the result
+    if (ctx->total_iterations == 1) {
+        print_octets(octets, len, ctx->log_to_stdout);
+    } else if (ctx->log_to_stdout) {
+        printf("Request %d: received %zu bytes\n", request_id, len);
+    }
+    QRNG_PROBE3(output, request_id, len, ctx);
+
+    completed_requests++;
+    completed_bytes += len;
+    uint64_t now = qrng_now_usec();
+    qrng_sketch_add(&interval_latency, now - ctx->submit_usec);
+    trace_call(ctx->submit_usec, len, 0);
+    flight_call(ctx, request_id, 0, now);
+    return 0;
+}
+
+// Callback function for async D-Bus method calls. A context covers count
+// consecutive requests; more than one means a ReadBytesBatch call.
 static int async_callback(sd_bus_message *reply, void *userdata, sd_bus_error *ret_error) {
     request_context_t *ctx = (request_context_t *)userdata;
-    int ret;
+    const void *ptr;
+    size_t octets_len;
+    int done = 0;
+    int ret = -EIO;
+
+    ctx->reply_usec = qrng_now_usec();
+
+    // A service without the batched method: send these requests again as
+    // single calls, and every later one too
+    if (ctx->count > 1 && reply && sd_bus_message_is_method_error(reply, SD_BUS_ERROR_UNKNOWN_METHOD)) {
+        if (batch_size > 1) {
+            fprintf(stderr, "Service has no %s, falling back to %s\n", QRNG_METHOD_BATCH, QRNG_METHOD);
+            batch_size = 1;
+        }
+        ctx->next = NULL;
+        if (resend_tail) {
+            resend_tail->next = ctx;
+        } else {
+            resend_head = ctx;
+        }
+        resend_tail = ctx;
+        returned_requests += ctx->count;
+        return 0;
+    }
 
     if (ret_error && sd_bus_error_is_set(ret_error)) {
         fprintf(stderr, "Failed to issue method call (request %d): %s\n", 
                 ctx->request_id, ret_error->message);
-        failed_requests++;
-        free(ctx);
-        return 0;
+        ret = -sd_bus_error_get_errno(ret_error);
+        goto fail;
+    }
+
+    if (sd_bus_message_is_method_error(reply, NULL)) {
+        fprintf(stderr, "Failed to issue method call (request %d): %s\n",
+                ctx->request_id, sd_bus_message_get_error(reply)->message);
+        ret = -sd_bus_message_get_errno(reply);
+        goto fail;
     }
 
     // Parse the reply message
@@ -41,51 +214,106 @@ static int async_callback(sd_bus_message *reply, void *userdata, sd_bus_error *r
     if (ret < 0) {
         fprintf(stderr, "Failed to parse reply message (request %d): %s\n", 
                 ctx->request_id, strerror(-ret));
-        failed_requests++;
-        free(ctx);
-        return 0;
+        goto fail;
     }
 
     if (status != 0) {
         fprintf(stderr, "Method call returned error status (request %d): %d\n", 
                 ctx->request_id, status);
-        failed_requests++;
+        ret = -EIO;
+        goto fail;
+    }
+
+    if (ctx->count == 1) {
+        // Parse the octets array
+        ret = sd_bus_message_read_array(reply, 'y', &ptr, &octets_len);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to read array (request %d): %s\n", 
+                    ctx->request_id, strerror(-ret));
+            goto fail;
+        }
+        ret = handle_block(ctx, ctx->request_id, ptr, octets_len);
+        if (ret < 0) {
+            goto fail;
+        }
         free(ctx);
         return 0;
     }
 
-    // Parse the octets array
-    const void *ptr;
-    size_t octets_len;
-    ret = sd_bus_message_read_array(reply, 'y', &ptr, &octets_len);
+    // One block per request, in order
+    // done counts the blocks handled, so on failure the rest are failed
+    ret = sd_bus_message_enter_container(reply, 'a', "ay");
+    while (ret >= 0 && done < ctx->count) {
+        ret = sd_bus_message_read_array(reply, 'y', &ptr, &octets_len);
+        if (ret == 0) {
+            ret = -EBADMSG;  // Fewer blocks than requests
+        }
+        if (ret < 0) {
+            break;
+        }
+        ret = handle_block(ctx, ctx->request_id + done, ptr, octets_len);
+        if (ret < 0) {
+            goto fail;
+        }
+        done++;
+    }
     if (ret < 0) {
-        fprintf(stderr, "Failed to read array (request %d): %s\n", 
-                ctx->request_id, strerror(-ret));
-        failed_requests++;
-        free(ctx);
-        return 0;
+        fprintf(stderr, "Failed to read block %d of batch (request %d): %s\n",
+                done, ctx->request_id, strerror(-ret));
+        goto fail;
     }
+    free(ctx);
+    return 0;
 
-    if (octets_len != ctx->expected_bytes) {
-        fprintf(stderr, "Received %zu bytes, expected %u bytes (request %d)\n", 
-                octets_len, ctx->expected_bytes, ctx->request_id);
+fail:
+    ret = ret < 0 ? ret : -EIO;
+    for (; done < ctx->count; done++) {
         failed_requests++;
-        free(ctx);
-        return 0;
+        trace_call(ctx->submit_usec, ctx->expected_bytes, -1);
+        QRNG_PROBE3(error, ctx->request_id + done, -ret, ctx);
+        flight_call(ctx, ctx->request_id + done, ret, qrng_now_usec());
     }
+    free(ctx);
+    return 0;
+}
 
-    const uint8_t *octets = ptr;
-    
-    // Log the result
-    if (ctx->total_iterations == 1) {
-        print_octets(octets, octets_len, ctx->log_to_stdout);
-    } else if (ctx->log_to_stdout) {
-        printf("Request %d: received %zu bytes\n", ctx->request_id, octets_len);
+// Interval report state for the async loop
+typedef struct {
+    uint64_t start_usec;
+    uint64_t last_usec;
+    int last_completed;
+    int last_failed;
+    uint64_t last_bytes;
+    uint64_t throttled_usec;
+    unsigned connections;
+} interval_report_t;
+
+static void print_interval_report(interval_report_t *r, uint64_t now, int in_flight,
+                                  conn_pool_t *pool) {
+    conn_pool_stats_t stats;
+    double secs = (now - r->last_usec) / 1e6;
+    int calls = completed_requests - r->last_completed;
+
+    printf("[%6.1f-%6.1f s] %.1f calls/s, %.1f bytes/s, %d failed, %d in flight, "
+           "throttled %.0f%%, latency p50 %.3f ms p99 %.3f ms\n",
+           (r->last_usec - r->start_usec) / 1e6, (now - r->start_usec) / 1e6,
+           calls / secs, (completed_bytes - r->last_bytes) / secs,
+           failed_requests - r->last_failed, in_flight, 100.0 * r->throttled_usec / (now - r->last_usec),
+           qrng_sketch_quantile(&interval_latency, 0.5) / 1000.0,
+           qrng_sketch_quantile(&interval_latency, 0.99) / 1000.0);
+    conn_pool_get_stats(pool, &stats);
+    if (stats.healthy < r->connections || stats.queued > 0 || !stats.service_up) {
+        printf("             %u/%u connections up, service %s, %zu calls waiting\n",
+               stats.healthy, r->connections, stats.service_up ? "up" : "gone", stats.queued);
     }
+    fflush(stdout);
 
-    completed_requests++;
-    free(ctx);
-    return 0;
+    r->last_usec = now;
+    r->last_completed = completed_requests;
+    r->last_failed = failed_requests;
+    r->last_bytes = completed_bytes;
+    r->throttled_usec = 0;
+    qrng_sketch_reset(&interval_latency);
 }
 
 // Function to print usage information
@@ -99,6 +327,162 @@ void print_usage(const char *program_name) {
     printf("  -l, --log               Log output to stdout (default: enabled)\n");
     printf("  -q, --quiet             Disable logging to stdout\n");
     printf("  -h, --help              Show this help message\n");
+    printf("      --max-rate BYTES[:CALLS]  Cap requests at BYTES/sec and CALLS/sec (0 = no cap)\n");
+    printf("      --interval SEC      Print throughput and latency every SEC seconds\n");
+    printf("      --address ADDRESS   D-Bus address of the service's bus instead of the user bus,\n");
+    printf("                          e.g. tcp:host=rng.example,port=4711\n");
+    printf("      --keepalive SEC     TCP keepalive idle time on TCP buses (default: 30)\n");
+    printf("      --connections NUM   Spread concurrent calls over NUM bus connections, reissuing\n");
+    printf("                          calls and reconnecting when one drops (default: 1)\n");
+    printf("      --fail-fast         Fail calls at once while the service has no owner instead\n");
+    printf("                          of waiting for it to come back\n");
+    printf("      --rcvbuf BYTES      Socket receive buffer (default: 0 = fit the largest reply,\n");
+    printf("                          -1 = kernel default)\n");
+    printf("      --sndbuf BYTES      Socket send buffer (default: 0 = kernel default)\n");
+    printf("      --max-queued-writes NUM  Outbound messages queued per connection before it\n");
+    printf("                          takes no more calls (default: 64)\n");
+    printf("      --output SINK       Tee every reply to SINK (repeatable, up to %d): -, file:PATH,\n",
+           MAX_SINKS);
+    printf("                          digest:sha256, unix:PATH or tcp:HOST:PORT\n");
+    printf("      --sink-buffer BYTES Bytes queued per output before fetching waits for it\n");
+    printf("                          (default: %d)\n", SINK_DEFAULT_BUFFER);
+    printf("      --batch NUM         Carry up to NUM requests per ReadBytesBatch call when the\n");
+    printf("                          service has it, else fall back to ReadBytes (default: 1)\n");
+    printf("      --trace PATH        Append issue and reply times of every call to PATH, as\n");
+    printf("                          input for bench/capacity-sim.py\n");
+    printf("\nFlight recorder (plain fetches and daemon mode):\n");
+    printf("      --flight-records NUM  Keep the last NUM requests in memory (default: %d,\n",
+           FLIGHT_DEFAULT_RECORDS);
+    printf("                          0 = off); SIGUSR2 dumps them\n");
+    printf("      --flight-dump PREFIX  Write dumps to PREFIX.PID.SEQ (default: %s in\n",
+           FLIGHT_DEFAULT_NAME);
+    printf("                          $XDG_RUNTIME_DIR, or in /tmp without it)\n");
+    printf("      --flight-latency MS   Dump when a request takes longer than MS\n");
+    printf("      --flight-errors NUM[/MS]  Dump when NUM requests fail within MS (default: 1000)\n");
+    printf("      --flight-stall MS     Dump when nothing finishes for MS with requests in flight\n");
+    printf("                          Triggered dumps are at least 10 s apart\n");
+    printf("\nFile generation:\n");
+    printf("      --write-file PATH   Write -n chunks of -b bytes to PATH, -c in flight, journaling\n");
+    printf("                          finished chunks in PATH.journal\n");
+    printf("      --resume            Continue an interrupted --write-file job, fetching only the\n");
+    printf("                          chunks its journal does not list\n");
+    printf("      --sync-bytes BYTES  Sync the file and journal after this many new bytes (also\n");
+    printf("                          once a second; default: %d)\n", JOB_DEFAULT_SYNC);
+    printf("      --container         Write PATH as an indexed container with a CRC32C and fetch\n");
+    printf("                          metadata per chunk\n");
+    printf("      --verify-file PATH  Check every chunk of a container, -c threads (default: one\n");
+    printf("                          per CPU, within the cgroup's quota)\n");
+    printf("\nKernel entropy feeding:\n");
+    printf("      --feed-kernel       Inject bytes into the kernel pool on demand until interrupted;\n");
+    printf("                          -b sets the largest batch (default: %d)\n", FEED_DEFAULT_BATCH);
+    printf("      --random-device PATH  Entropy sink (default: /dev/random); a plain file or FIFO\n");
+    printf("                          receives raw bytes instead of RNDADDENTROPY\n");
+    printf("      --random-proc DIR   Where to read entropy_avail/poolsize (default: /proc/sys/kernel/random)\n");
+    printf("      --feed-interval MS  Longest wait between demand checks (default: 1000)\n");
+    printf("\nDaemon mode:\n");
+    printf("      --daemon SOCKET     Serve local clients on a Unix socket; -c sets the upstream\n");
+    printf("                          window (default: %d), SIGUSR1 prints per-tenant stats\n",
+           DAEMON_DEFAULT_WINDOW);
+    printf("      --tenant UID[:WEIGHT[:QUOTA[:SLO_MS]]]\n");
+    printf("                          Fair-share weight, bytes/sec quota and latency SLO for a uid\n");
+    printf("      --quantum BYTES     DRR quantum and largest upstream chunk (default: 65536)\n");
+    printf("      --max-request BYTES Largest request a client may make (default: %d)\n",
+           DAEMON_DEFAULT_MAX_REQUEST);
+    printf("      --max-outstanding BYTES  Response bytes a uid may hold at once, beyond which\n");
+    printf("                          requests fail with -ENOBUFS (default: %d)\n",
+           DAEMON_DEFAULT_MAX_OUTSTANDING);
+    printf("      --small-threshold BYTES  Requests up to this size use a separate connection\n");
+    printf("                          and window (default: 4096, 0 = single lane)\n");
+    printf("      --small-window NUM  In-flight calls on the small-request lane (default: 4)\n");
+    printf("      --connect SOCKET    Send -n requests of -b bytes to a daemon, -c pipelined\n");
+    printf("\nProxy mode:\n");
+    printf("      --proxy NAME        Serve ReadBytes at the service's object path under NAME on\n");
+    printf("                          the user bus, from a buffer refilled with -b byte calls\n");
+    printf("                          (default: %d), -c in flight (default: %d); upstream is\n",
+           PROXY_DEFAULT_REFILL, PROXY_DEFAULT_WINDOW);
+    printf("                          --address, which must be another bus to serve as %s\n",
+           QRNG_SERVICE);
+    printf("      --proxy-buffer BYTES  Prefetch buffer (default: %d); --max-request applies\n",
+           PROXY_DEFAULT_BUFFER);
+    printf("\nPower:\n");
+    printf("      --power-save        Let timers of the event loops coalesce (%d ms slack) and\n",
+           POWER_SAVE_SLACK_NS / 1000000);
+    printf("                          have the proxy refill late, in calls of up to half its\n");
+    printf("                          buffer, paced to the rate clients consume\n");
+}
+
+// Per-output bytes, throughput, queueing and fetch stalls at exit
+static void print_sink_report(sink_set_t *set, uint64_t wall_usec) {
+    for (unsigned i = 0; i < sink_set_count(set); i++) {
+        sink_stats_t stats;
+        sink_set_get_stats(set, i, &stats);
+        printf("Output %s: %lu bytes, %.1f MiB/s while writing, %.1f MiB/s overall, "
+               "queue max %.1f KiB, fetch stalled %.1f ms",
+               stats.spec, stats.bytes,
+               stats.busy_usec ? stats.bytes / (stats.busy_usec / 1e6) / (1024 * 1024) : 0.0,
+               wall_usec ? stats.bytes / (wall_usec / 1e6) / (1024 * 1024) : 0.0,
+               stats.queue_max / 1024.0, stats.stalled_usec / 1000.0);
+        if (stats.digest[0]) {
+            printf(", sha256 %s", stats.digest);
+        }
+        if (stats.error < 0) {
+            printf(", failed: %s", strerror(-stats.error));
+        }
+        printf("\n");
+    }
+}
+
+// A default cut down to fit limit, but not below floor
+static uint64_t fit_default(uint64_t def, uint64_t limit, uint64_t floor) {
+    if (limit >= def) {
+        return def;
+    }
+    return limit > floor ? limit : floor;
+}
+
+static void print_cgroup_limits(const qrng_limits_t *limits) {
+    if (limits->cpu_quota == 0 && limits->memory_max == 0) {
+        return;
+    }
+    printf("cgroup limits:");
+    if (limits->cpu_quota > 0) {
+        printf(" cpu.max %.2f CPUs (%u threads of %u CPUs)", limits->cpu_quota,
+               qrng_limits_cpus(limits), limits->cpus_online);
+    }
+    if (limits->memory_max > 0) {
+        printf("%s memory %.1f MiB (buffers sized for %.1f MiB)", limits->cpu_quota > 0 ? "," : "",
+               limits->memory_max / (1024.0 * 1024),
+               qrng_limits_memory_budget(limits) / (1024.0 * 1024));
+    }
+    printf("\n");
+}
+
+void print_process_load(const char *indent, uint64_t since_usec) {
+    struct rusage usage;
+    double secs = (qrng_now_usec() - since_usec) / 1e6;
+
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                 (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    printf("%sprocess: %.1f wakeups/s, %.2f ms CPU/s (%.2f s CPU in %.1f s)\n", indent,
+           secs > 0 ? (usage.ru_nvcsw + usage.ru_nivcsw) / secs : 0.0,
+           secs > 0 ? cpu * 1000 / secs : 0.0, cpu, secs);
+}
+
+void print_cpu_throttling(const char *indent, const qrng_cpu_stat_t *start) {
+    const qrng_limits_t *limits = qrng_limits();
+    qrng_cpu_stat_t now;
+
+    if (qrng_cpu_stat(limits, &now) < 0) {
+        return;
+    }
+    uint64_t periods = now.nr_periods - start->nr_periods;
+    uint64_t throttled = now.nr_throttled - start->nr_throttled;
+    printf("%scgroup: %.2f s CPU used, throttled in %lu of %lu periods (%.1f%%) for %.1f ms "
+           "of its %.2f CPU quota\n",
+           indent, (now.usage_usec - start->usage_usec) / 1e6, throttled, periods,
+           periods ? 100.0 * throttled / periods : 0.0,
+           (now.throttled_usec - start->throttled_usec) / 1000.0, limits->cpu_quota);
 }
 
 // Function to print the octets in hexadecimal format
@@ -116,6 +500,7 @@ int main(int argc, char *argv[]) {
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *reply = NULL;
     sd_bus *bus = NULL;
+    conn_pool_t *pool = NULL;
     int ret;
 
     // Default values
@@ -124,6 +509,39 @@ int main(int argc, char *argv[]) {
     int concurrent = 1;
     uint64_t timeout_ms = 0;
     int log_to_stdout = 1;
+    int bytes_set = 0;
+    int feed_kernel = 0;
+    int power_save = 0;
+    uint64_t start_usec = qrng_now_usec();
+    kernel_feed_options_t feed_opts = {
+        .device = "/dev/random",
+        .proc_dir = "/proc/sys/kernel/random",
+        .interval_ms = 1000,
+    };
+    int concurrent_set = 0;
+    double max_bytes_rate = 0;
+    double max_calls_rate = 0;
+    double interval_sec = 0;
+    conn_pool_config_t pool_config = { .connections = 1 };
+    const char *sink_specs[MAX_SINKS];
+    unsigned n_sinks = 0;
+    size_t sink_buffer = 0;
+    uint64_t sinks_start = 0;
+    file_job_options_t job_opts = {0};
+    const char *connect_path = NULL;
+    const char *trace_path = NULL;
+    const char *verify_path = NULL;
+    proxy_options_t proxy_opts = {0};
+    flight_config_t flight_config = {
+        .records = FLIGHT_DEFAULT_RECORDS,
+    };
+    static tenant_config_t tenants[DAEMON_MAX_TENANTS];
+    daemon_options_t daemon_opts = {
+        .quantum = 64 * 1024,
+        .small_threshold = 4096,
+        .small_window = 4,
+        .tenants = tenants,
+    };
 
     // Command line option parsing
     static struct option long_options[] = {
@@ -134,6 +552,44 @@ int main(int argc, char *argv[]) {
         {"log",        no_argument,       0, 'l'},
         {"quiet",      no_argument,       0, 'q'},
         {"help",       no_argument,       0, 'h'},
+        {"feed-kernel",   no_argument,       0, OPT_FEED_KERNEL},
+        {"random-device", required_argument, 0, OPT_RANDOM_DEVICE},
+        {"random-proc",   required_argument, 0, OPT_RANDOM_PROC},
+        {"feed-interval", required_argument, 0, OPT_FEED_INTERVAL},
+        {"daemon",        required_argument, 0, OPT_DAEMON},
+        {"connect",       required_argument, 0, OPT_CONNECT},
+        {"tenant",        required_argument, 0, OPT_TENANT},
+        {"quantum",       required_argument, 0, OPT_QUANTUM},
+        {"max-request",   required_argument, 0, OPT_MAX_REQUEST},
+        {"max-outstanding", required_argument, 0, OPT_MAX_OUTSTANDING},
+        {"small-threshold", required_argument, 0, OPT_SMALL_THRESHOLD},
+        {"small-window",  required_argument, 0, OPT_SMALL_WINDOW},
+        {"max-rate",      required_argument, 0, OPT_MAX_RATE},
+        {"interval",      required_argument, 0, OPT_INTERVAL},
+        {"connections",   required_argument, 0, OPT_CONNECTIONS},
+        {"fail-fast",     no_argument,       0, OPT_FAIL_FAST},
+        {"rcvbuf",        required_argument, 0, OPT_RCVBUF},
+        {"sndbuf",        required_argument, 0, OPT_SNDBUF},
+        {"max-queued-writes", required_argument, 0, OPT_MAX_QUEUED_WRITES},
+        {"output",        required_argument, 0, OPT_OUTPUT},
+        {"sink-buffer",   required_argument, 0, OPT_SINK_BUFFER},
+        {"write-file",    required_argument, 0, OPT_WRITE_FILE},
+        {"resume",        no_argument,       0, OPT_RESUME},
+        {"sync-bytes",    required_argument, 0, OPT_SYNC_BYTES},
+        {"trace",         required_argument, 0, OPT_TRACE},
+        {"batch",         required_argument, 0, OPT_BATCH},
+        {"address",       required_argument, 0, OPT_ADDRESS},
+        {"keepalive",     required_argument, 0, OPT_KEEPALIVE},
+        {"container",     no_argument,       0, OPT_CONTAINER},
+        {"verify-file",   required_argument, 0, OPT_VERIFY_FILE},
+        {"proxy",         required_argument, 0, OPT_PROXY},
+        {"proxy-buffer",  required_argument, 0, OPT_PROXY_BUFFER},
+        {"flight-records", required_argument, 0, OPT_FLIGHT_RECORDS},
+        {"flight-dump",   required_argument, 0, OPT_FLIGHT_DUMP},
+        {"flight-latency", required_argument, 0, OPT_FLIGHT_LATENCY},
+        {"flight-errors", required_argument, 0, OPT_FLIGHT_ERRORS},
+        {"flight-stall",  required_argument, 0, OPT_FLIGHT_STALL},
+        {"power-save",    no_argument,       0, OPT_POWER_SAVE},
         {0, 0, 0, 0}
     };
 
@@ -153,6 +609,7 @@ int main(int argc, char *argv[]) {
                     fprintf(stderr, "Error: bytes must be positive\n");
                     return EXIT_FAILURE;
                 }
+                bytes_set = 1;
                 break;
             case 'c':
                 concurrent = atoi(optarg);
@@ -160,6 +617,7 @@ int main(int argc, char *argv[]) {
                     fprintf(stderr, "Error: concurrent must be positive\n");
                     return EXIT_FAILURE;
                 }
+                concurrent_set = 1;
                 break;
             case 't':
                 timeout_ms = (uint64_t)atoll(optarg);
@@ -173,6 +631,213 @@ int main(int argc, char *argv[]) {
             case 'h':
                 print_usage(argv[0]);
                 return EXIT_SUCCESS;
+            case OPT_FEED_KERNEL:
+                feed_kernel = 1;
+                break;
+            case OPT_RANDOM_DEVICE:
+                feed_opts.device = optarg;
+                break;
+            case OPT_RANDOM_PROC:
+                feed_opts.proc_dir = optarg;
+                break;
+            case OPT_FEED_INTERVAL:
+                feed_opts.interval_ms = (uint64_t)atoll(optarg);
+                if (feed_opts.interval_ms == 0) {
+                    fprintf(stderr, "Error: feed interval must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_DAEMON:
+                daemon_opts.socket_path = optarg;
+                break;
+            case OPT_CONNECT:
+                connect_path = optarg;
+                break;
+            case OPT_TENANT:
+                if (daemon_opts.n_tenants == DAEMON_MAX_TENANTS) {
+                    fprintf(stderr, "Error: at most %d tenants\n", DAEMON_MAX_TENANTS);
+                    return EXIT_FAILURE;
+                }
+                if (daemon_parse_tenant(optarg, &tenants[daemon_opts.n_tenants]) < 0) {
+                    fprintf(stderr, "Error: invalid tenant '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                daemon_opts.n_tenants++;
+                break;
+            case OPT_QUANTUM:
+                daemon_opts.quantum = (uint32_t)atoi(optarg);
+                if (daemon_opts.quantum == 0) {
+                    fprintf(stderr, "Error: quantum must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_MAX_REQUEST:
+                daemon_opts.max_request = (uint32_t)atoi(optarg);
+                if (daemon_opts.max_request == 0) {
+                    fprintf(stderr, "Error: max request must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_MAX_OUTSTANDING:
+                daemon_opts.max_outstanding = (uint64_t)atoll(optarg);
+                if (daemon_opts.max_outstanding == 0) {
+                    fprintf(stderr, "Error: max outstanding must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_SMALL_THRESHOLD:
+                daemon_opts.small_threshold = (uint32_t)atoi(optarg);
+                break;
+            case OPT_MAX_RATE: {
+                char *end;
+                max_bytes_rate = strtod(optarg, &end);
+                if (*end == ':') {
+                    max_calls_rate = strtod(end + 1, &end);
+                }
+                if (*end != '\0' || max_bytes_rate < 0 || max_calls_rate < 0) {
+                    fprintf(stderr, "Error: invalid max rate '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case OPT_INTERVAL:
+                interval_sec = atof(optarg);
+                if (interval_sec <= 0) {
+                    fprintf(stderr, "Error: interval must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_CONNECTIONS:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: connections must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                pool_config.connections = (unsigned)atoi(optarg);
+                break;
+            case OPT_FAIL_FAST:
+                pool_config.fail_fast = 1;
+                break;
+            case OPT_RCVBUF:
+                pool_config.rcvbuf = atol(optarg);
+                break;
+            case OPT_SNDBUF:
+                pool_config.sndbuf = atol(optarg);
+                break;
+            case OPT_MAX_QUEUED_WRITES:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: max queued writes must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                pool_config.max_queued_write = (unsigned)atoi(optarg);
+                break;
+            case OPT_OUTPUT:
+                if (n_sinks == MAX_SINKS) {
+                    fprintf(stderr, "Error: at most %d outputs\n", MAX_SINKS);
+                    return EXIT_FAILURE;
+                }
+                sink_specs[n_sinks++] = optarg;
+                break;
+            case OPT_SINK_BUFFER:
+                sink_buffer = (size_t)atoll(optarg);
+                if (sink_buffer == 0) {
+                    fprintf(stderr, "Error: sink buffer must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_WRITE_FILE:
+                job_opts.path = optarg;
+                break;
+            case OPT_RESUME:
+                job_opts.resume = 1;
+                break;
+            case OPT_CONTAINER:
+                job_opts.container = 1;
+                break;
+            case OPT_VERIFY_FILE:
+                verify_path = optarg;
+                break;
+            case OPT_PROXY:
+                proxy_opts.name = optarg;
+                break;
+            case OPT_POWER_SAVE:
+                power_save = 1;
+                break;
+            case OPT_PROXY_BUFFER:
+                proxy_opts.buffer = (uint32_t)atoll(optarg);
+                if (proxy_opts.buffer == 0) {
+                    fprintf(stderr, "Error: proxy buffer must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_FLIGHT_RECORDS:
+                flight_config.records = (uint32_t)atoi(optarg);
+                break;
+            case OPT_FLIGHT_DUMP:
+                flight_config.dump_prefix = optarg;
+                break;
+            case OPT_FLIGHT_LATENCY:
+                flight_config.latency_usec = (uint64_t)(atof(optarg) * 1000);
+                if (flight_config.latency_usec == 0) {
+                    fprintf(stderr, "Error: flight latency must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_FLIGHT_ERRORS: {
+                char *end;
+                long burst = strtol(optarg, &end, 10);
+                double window_ms = 1000;
+                if (*end == '/') {
+                    window_ms = strtod(end + 1, &end);
+                }
+                if (*end != '\0' || burst <= 0 || window_ms <= 0) {
+                    fprintf(stderr, "Error: invalid flight errors '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                flight_config.error_burst = (uint32_t)burst;
+                flight_config.error_window_usec = (uint64_t)(window_ms * 1000);
+                break;
+            }
+            case OPT_FLIGHT_STALL:
+                flight_config.stall_usec = (uint64_t)(atof(optarg) * 1000);
+                if (flight_config.stall_usec == 0) {
+                    fprintf(stderr, "Error: flight stall must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_SYNC_BYTES:
+                job_opts.sync_bytes = (uint64_t)atoll(optarg);
+                if (job_opts.sync_bytes == 0) {
+                    fprintf(stderr, "Error: sync bytes must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_TRACE:
+                trace_path = optarg;
+                break;
+            case OPT_ADDRESS:
+                pool_config.address = optarg;
+                break;
+            case OPT_KEEPALIVE:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: keepalive must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                pool_config.keepalive_s = (unsigned)atoi(optarg);
+                break;
+            case OPT_BATCH:
+                batch_size = atoi(optarg);
+                if (batch_size <= 0 || batch_size > MAX_BATCH) {
+                    fprintf(stderr, "Error: batch must be between 1 and %d\n", MAX_BATCH);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_SMALL_WINDOW:
+                daemon_opts.small_window = (uint32_t)atoi(optarg);
+                if (daemon_opts.small_window == 0) {
+                    fprintf(stderr, "Error: small window must be positive\n");
+                    return EXIT_FAILURE;
+                }
+                break;
             case '?':
                 print_usage(argv[0]);
                 return EXIT_FAILURE;
@@ -181,12 +846,156 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Connect to the session bus
-    ret = sd_bus_open_user(&bus);
+    if ((job_opts.resume || job_opts.container) && !job_opts.path) {
+        fprintf(stderr, "Error: --resume and --container need --write-file\n");
+        return EXIT_FAILURE;
+    }
+    if ((n_sinks > 0 || trace_path) &&
+        (connect_path || feed_kernel || daemon_opts.socket_path || job_opts.path || verify_path ||
+         proxy_opts.name)) {
+        fprintf(stderr, "Error: --output and --trace apply only to plain fetches\n");
+        return EXIT_FAILURE;
+    }
+
+    // Defaults are fitted to the cgroup's CPU quota and memory limit;
+    // values given on the command line are used as they are
+    const qrng_limits_t *limits = qrng_limits();
+    uint64_t budget = qrng_limits_memory_budget(limits);
+    qrng_cpu_stat_t cpu_start;
+    qrng_cpu_stat(limits, &cpu_start);
+    if (log_to_stdout) {
+        print_cgroup_limits(limits);
+    }
+
+    // Threads started from here on inherit the slack
+    if (power_save) {
+        prctl(PR_SET_TIMERSLACK, POWER_SAVE_SLACK_NS, 0, 0, 0);
+        proxy_opts.power_save = 1;
+    }
+    if (!sink_buffer) {
+        sink_buffer = fit_default(SINK_DEFAULT_BUFFER, budget / 4 / (n_sinks ? n_sinks : 1),
+                                  MIN_FITTED_BUFFER);
+    }
+    if (!job_opts.sync_bytes) {
+        // Unsynced writes sit in the cgroup's page cache
+        job_opts.sync_bytes = fit_default(JOB_DEFAULT_SYNC, budget / 2, num_bytes);
+    }
+    if (!daemon_opts.max_request) {
+        // Responses are allocated when requests arrive, so a few clients
+        // asking for the largest size at once must fit
+        daemon_opts.max_request = (uint32_t)fit_default(DAEMON_DEFAULT_MAX_REQUEST, budget / 8,
+                                                        daemon_opts.quantum);
+    }
+    if (!daemon_opts.max_outstanding) {
+        // Per uid, so any one tenant can always have its largest request
+        daemon_opts.max_outstanding = fit_default(DAEMON_DEFAULT_MAX_OUTSTANDING, budget / 2,
+                                                  daemon_opts.max_request);
+    }
+    if ((uint64_t)concurrent * num_bytes > budget) {
+        fprintf(stderr, "Warning: %d calls of %u bytes in flight may need more than a quarter "
+                "of the cgroup's %.1f MiB memory limit\n",
+                concurrent, num_bytes, limits->memory_max / (1024.0 * 1024));
+    }
+
+    // Verifying a container needs no bus at all
+    if (verify_path) {
+        unsigned threads = concurrent_set ? (unsigned)concurrent : qrng_limits_cpus(limits);
+        ret = run_file_verify(verify_path, threads, log_to_stdout);
+        return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // The daemon client talks to the daemon only, not to the bus
+    if (connect_path) {
+        ret = run_daemon_client(connect_path, iterations, num_bytes, concurrent, log_to_stdout);
+        return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // Long-running modes manage their own bus connections
+    if (feed_kernel) {
+        feed_opts.max_batch = bytes_set ? num_bytes : FEED_DEFAULT_BATCH;
+        feed_opts.timeout_ms = timeout_ms;
+        feed_opts.address = pool_config.address;
+        feed_opts.log_to_stdout = log_to_stdout;
+        ret = run_kernel_feed(&feed_opts);
+        goto cleanup;
+    }
+
+    if (daemon_opts.socket_path) {
+        // Window times quantum is the most the daemon has in flight upstream
+        daemon_opts.window = concurrent_set ? (uint32_t)concurrent
+                             : (uint32_t)fit_default(DAEMON_DEFAULT_WINDOW,
+                                                     budget / 4 / daemon_opts.quantum, 1);
+        daemon_opts.pool = pool_config;
+        daemon_opts.pool.timeout_ms = timeout_ms;
+        daemon_opts.log_to_stdout = log_to_stdout;
+        daemon_opts.flight = flight_config;
+        ret = run_daemon(&daemon_opts);
+        goto cleanup;
+    }
+
+    if (proxy_opts.name) {
+        // Serving the service's own name on the bus we fetch from would
+        // have the proxy call itself
+        if (strcmp(proxy_opts.name, QRNG_SERVICE) == 0 && !pool_config.address) {
+            fprintf(stderr, "Error: --proxy %s needs --address for the upstream bus\n",
+                    QRNG_SERVICE);
+            return EXIT_FAILURE;
+        }
+        proxy_opts.refill = bytes_set ? num_bytes : PROXY_DEFAULT_REFILL;
+        proxy_opts.window = concurrent_set ? (uint32_t)concurrent : PROXY_DEFAULT_WINDOW;
+        if (!proxy_opts.buffer) {
+            proxy_opts.buffer = (uint32_t)fit_default(PROXY_DEFAULT_BUFFER, budget / 4,
+                                                      2 * (uint64_t)proxy_opts.refill);
+        }
+        proxy_opts.max_request = daemon_opts.max_request;
+        if (proxy_opts.refill == 0 || proxy_opts.buffer < 2 * (uint64_t)proxy_opts.refill) {
+            fprintf(stderr, "Error: proxy buffer must hold at least two refills of -b bytes\n");
+            return EXIT_FAILURE;
+        }
+        proxy_opts.pool = pool_config;
+        proxy_opts.pool.timeout_ms = timeout_ms;
+        proxy_opts.log_to_stdout = log_to_stdout;
+        ret = run_proxy(&proxy_opts);
+        goto cleanup;
+    }
+
+    if (job_opts.path) {
+        job_opts.num_chunks = (uint64_t)iterations;
+        job_opts.chunk_size = num_bytes;
+        job_opts.concurrent = (uint32_t)concurrent;
+        job_opts.pool = pool_config;
+        job_opts.pool.timeout_ms = timeout_ms;
+        job_opts.log_to_stdout = log_to_stdout;
+        ret = run_file_job(&job_opts);
+        goto cleanup;
+    }
+
+    if (n_sinks > 0) {
+        ret = sink_set_new(sink_specs, n_sinks, sink_buffer, &sinks);
+        if (ret < 0) {
+            goto cleanup;
+        }
+        sinks_start = qrng_now_usec();
+    }
+
+    if (trace_path) {
+        trace_file = fopen(trace_path, "a");
+        if (!trace_file) {
+            ret = -errno;
+            fprintf(stderr, "Failed to open trace %s: %s\n", trace_path, strerror(errno));
+            goto cleanup;
+        }
+        // The run's configuration heads its records
+        fprintf(trace_file, "# bytes=%u concurrent=%d connections=%u\n",
+                num_bytes, concurrent, pool_config.connections);
+    }
+
+    ret = flight_new(&flight_config, &flight);
     if (ret < 0) {
-        fprintf(stderr, "Failed to connect to user bus: %s\n", strerror(-ret));
+        fprintf(stderr, "Failed to create flight recorder: %s\n", strerror(-ret));
         goto cleanup;
     }
+    flight_handle_signals();
 
     if (log_to_stdout) {
         printf("Starting %d iterations, %u bytes per call, %d concurrent requests, timeout: %lu ms\n", 
@@ -197,9 +1006,25 @@ int main(int argc, char *argv[]) {
     completed_requests = 0;
     failed_requests = 0;
 
-    // Use synchronous calls if concurrent is 1, otherwise use async
-    if (concurrent == 1) {
-        // Original synchronous implementation
+    // Use synchronous calls if concurrent is 1, otherwise use async. Rate
+    // limiting, interval reports and batching need the event loop, so they
+    // always take the async path.
+    int rate_limited = max_bytes_rate > 0 || max_calls_rate > 0;
+    // A batch never waits for more slots than there are
+    if (batch_size > concurrent) {
+        batch_size = concurrent;
+    }
+    if (concurrent == 1 && !rate_limited && interval_sec == 0 && batch_size == 1) {
+        // Connect to the session bus (or the one at --address)
+        ret = qrng_bus_open(pool_config.address, &bus);
+        QRNG_PROBE2(connect, 0, ret);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to connect to bus: %s\n", strerror(-ret));
+            goto cleanup;
+        }
+
+        // Original synchronous implementation, with no tag or connection
+        // index in its probes
         for (int i = 0; i < iterations; i++) {
             // Clear any previous error/reply
             sd_bus_error_free(&error);
@@ -213,12 +1038,14 @@ int main(int argc, char *argv[]) {
             }
 
             // Make a method call
+            uint64_t issue_usec = qrng_now_usec();
+            QRNG_PROBE3(submit, i + 1, num_bytes, 0);
             ret = sd_bus_call_method(
                 bus,
-                "lv.lumii.trng",                         // Service to contact
-                "/lv/lumii/trng/SourceXorAggregator",    // Object path
-                "lv.lumii.trng.Rng",                     // Interface name
-                "ReadBytes",                             // Method name
+                QRNG_SERVICE,                            // Service to contact
+                QRNG_OBJECT_PATH,                        // Object path
+                QRNG_INTERFACE,                          // Interface name
+                QRNG_METHOD,                             // Method name
                 &error,                                  // Location to store errors
                 &reply,                                  // Reply message
                 "tt",                                    // Input signature: 't' for uint64
@@ -229,20 +1056,26 @@ int main(int argc, char *argv[]) {
             if (ret < 0) {
                 fprintf(stderr, "Failed to issue method call (iteration %d): %s\n", 
                         i + 1, error.message);
+                QRNG_PROBE3(error, i + 1, -ret, 0);
                 goto cleanup;
             }
+            uint64_t cookie = 0;
+            sd_bus_message_get_reply_cookie(reply, &cookie);
+            QRNG_PROBE4(reply, 0, num_bytes, cookie, 0);
 
             // Parse the reply message
             uint32_t status;
             ret = sd_bus_message_read(reply, "i", &status);
             if (ret < 0) {
                 fprintf(stderr, "Failed to parse reply message: %s\n", strerror(-ret));
+                QRNG_PROBE3(error, i + 1, -ret, 0);
                 goto cleanup;
             }
 
             if (status != 0) {
                 fprintf(stderr, "Failed to issue method call (iteration %d): %s\n", 
                         i + 1, error.message);
+                QRNG_PROBE3(error, i + 1, EIO, 0);
                 goto cleanup;
             }
 
@@ -253,21 +1086,45 @@ int main(int argc, char *argv[]) {
             if (ret < 0) {
                 fprintf(stderr, "Failed to read array (iteration %d): %s\n", 
                         i + 1, strerror(-ret));
+                QRNG_PROBE3(error, i + 1, -ret, 0);
                 goto cleanup;
             }
 
             if (octets_len != num_bytes) {
                 fprintf(stderr, "Received %zu bytes, expected %u bytes\n", octets_len, num_bytes);
+                QRNG_PROBE3(error, i + 1, EIO, 0);
                 ret = -1;
                 goto cleanup;
             }
+            QRNG_PROBE3(parse, i + 1, octets_len, 0);
             
+            trace_call(issue_usec, octets_len, 0);
+            uint64_t reply_usec = qrng_now_usec();
+            flight_record_t rec = {
+                .start_usec = issue_usec,
+                .issue_usec = issue_usec,
+                .reply_usec = reply_usec,
+                .done_usec = reply_usec,
+                .bytes = num_bytes,
+                .id = (uint32_t)(i + 1),
+            };
+            flight_record(flight, &rec);
+            flight_poll(flight, reply_usec, 0);
+
             const uint8_t *octets = ptr;
+            if (sinks) {
+                ret = sink_set_publish(sinks, octets, octets_len);
+                if (ret < 0) {
+                    fprintf(stderr, "Failed to write to output: %s\n", strerror(-ret));
+                    goto cleanup;
+                }
+            }
             if (iterations == 1) {
                 print_octets(octets, octets_len, log_to_stdout);
             } else if (log_to_stdout) {
                 printf("received %zu bytes\n", octets_len);
             }
+            QRNG_PROBE3(output, i + 1, octets_len, 0);
         }
 
         if (log_to_stdout) {
@@ -275,12 +1132,91 @@ int main(int argc, char *argv[]) {
         }
     } else {
         // Async implementation for concurrent requests
+        pool_config.timeout_ms = timeout_ms;
+        ret = conn_pool_new(&pool_config, &pool);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to connect to bus: %s\n", strerror(-ret));
+            goto cleanup;
+        }
+
+        int batch_requested = batch_size;
+        if (batch_size > 1) {
+            sd_bus *probe = NULL;
+            ret = qrng_bus_open(pool_config.address, &probe);
+            if (ret >= 0) {
+                ret = qrng_has_batch(probe);
+            }
+            sd_bus_flush_close_unref(probe);
+            if (ret <= 0) {
+                fprintf(stderr, "Service has no %s, using %s\n", QRNG_METHOD_BATCH, QRNG_METHOD);
+                batch_size = 1;
+            }
+        }
+
         int requests_sent = 0;
         int in_flight = 0;
+        uint64_t now = qrng_now_usec();
+        interval_report_t report = { .start_usec = now, .last_usec = now,
+                                     .connections = pool_config.connections };
+        uint64_t interval_usec = (uint64_t)(interval_sec * 1e6);
+
+        // Token buckets release requests from the event loop: when one runs
+        // dry the loop waits on the bus with a timeout until the next token
+        // is due instead of sleeping. Bursts are kept to a tenth of a second
+        // (but at least one batch) so the load stays close to the target.
+        // Each request of a batch counts as a call.
+        qrng_bucket_t bytes_bucket, calls_bucket;
+        if (max_bytes_rate > 0) {
+            double batch_bytes = (double)num_bytes * batch_size;
+            double burst = max_bytes_rate / 10 > batch_bytes ? max_bytes_rate / 10 : batch_bytes;
+            qrng_bucket_init(&bytes_bucket, max_bytes_rate, burst, now);
+        }
+        if (max_calls_rate > 0) {
+            qrng_bucket_init(&calls_bucket, max_calls_rate,
+                             max_calls_rate / 10 > batch_size ? max_calls_rate / 10 : batch_size, now);
+        }
+        uint64_t throttled_since = 0;
+
+        while (requests_sent < iterations || returned_requests > 0 || in_flight > 0) {
+            uint64_t release_wait = UINT64_MAX;
+
+            // Send returned requests, then new ones, up to the concurrency
+            // limit, a whole batch at a time
+            while ((requests_sent < iterations || returned_requests > 0) && in_flight < concurrent) {
+                int left = resend_head ? resend_head->count : iterations - requests_sent;
+                int count = left < batch_size ? left : batch_size;
+                if (concurrent - in_flight < count) {
+                    break;
+                }
+                now = qrng_now_usec();
+                if (rate_limited) {
+                    uint64_t wait = 0;
+                    if (max_bytes_rate > 0) {
+                        wait = qrng_bucket_wait_usec(&bytes_bucket, (double)num_bytes * count, now);
+                    }
+                    if (max_calls_rate > 0) {
+                        uint64_t calls_wait = qrng_bucket_wait_usec(&calls_bucket, count, now);
+                        wait = calls_wait > wait ? calls_wait : wait;
+                    }
+                    if (wait > 0) {
+                        release_wait = wait;
+                        if (!throttled_since) {
+                            throttled_since = now;
+                        }
+                        break;
+                    }
+                    if (max_bytes_rate > 0) {
+                        qrng_bucket_take(&bytes_bucket, (double)num_bytes * count, now);
+                    }
+                    if (max_calls_rate > 0) {
+                        qrng_bucket_take(&calls_bucket, count, now);
+                    }
+                    if (throttled_since) {
+                        report.throttled_usec += now - throttled_since;
+                        throttled_since = 0;
+                    }
+                }
 
-        while (requests_sent < iterations || in_flight > 0) {
-            // Send new requests up to the concurrency limit
-            while (requests_sent < iterations && in_flight < concurrent) {
                 request_context_t *ctx = malloc(sizeof(request_context_t));
                 if (!ctx) {
                     fprintf(stderr, "Failed to allocate memory for request context\n");
@@ -288,60 +1224,101 @@ int main(int argc, char *argv[]) {
                     goto cleanup;
                 }
 
-                ctx->request_id = requests_sent + 1;
+                ctx->request_id = resend_head ? resend_head->request_id : requests_sent + 1;
                 ctx->expected_bytes = num_bytes;
                 ctx->log_to_stdout = log_to_stdout;
                 ctx->total_iterations = iterations;
+                ctx->count = count;
+                ctx->submit_usec = now;
+                ctx->in_flight = (uint32_t)in_flight;
 
-                sd_bus_slot *slot = NULL;
-                ret = sd_bus_call_method_async(
-                    bus,
-                    &slot,
-                    "lv.lumii.trng",                         // Service to contact
-                    "/lv/lumii/trng/SourceXorAggregator",    // Object path
-                    "lv.lumii.trng.Rng",                     // Interface name
-                    "ReadBytes",                             // Method name
-                    async_callback,                          // Callback function
-                    ctx,                                     // User data
-                    "tt",                                    // Input signature
-                    num_bytes,                               // Input argument
-                    timeout_ms                               // timeout in ms
-                );
+                // Before the pool call, which fires the send probe
+                for (int i = 0; i < count; i++) {
+                    QRNG_PROBE3(submit, ctx->request_id + i, num_bytes, ctx);
+                }
+                if (count == 1) {
+                    ret = conn_pool_read_async(pool, num_bytes, async_callback, ctx);
+                } else {
+                    uint64_t lengths[MAX_BATCH];
+                    for (int i = 0; i < count; i++) {
+                        lengths[i] = num_bytes;
+                    }
+                    ret = conn_pool_read_batch_async(pool, lengths, count, async_callback, ctx);
+                }
 
                 if (ret < 0) {
                     fprintf(stderr, "Failed to issue async method call (request %d): %s\n", 
                             ctx->request_id, strerror(-ret));
+                    for (int i = 0; i < count; i++) {
+                        QRNG_PROBE3(error, ctx->request_id + i, -ret, ctx);
+                    }
                     free(ctx);
                     goto cleanup;
                 }
 
-                requests_sent++;
-                in_flight++;
+                if (resend_head) {
+                    request_context_t *returned = resend_head;
+                    returned->request_id += count;
+                    returned->count -= count;
+                    returned_requests -= count;
+                    if (returned->count == 0) {
+                        resend_head = returned->next;
+                        if (!resend_head) {
+                            resend_tail = NULL;
+                        }
+                        free(returned);
+                    }
+                } else {
+                    requests_sent += count;
+                }
+                in_flight += count;
 
                 if (log_to_stdout && iterations > 1) {
-                    printf("Sent request %d/%d\n", requests_sent, iterations);
+                    printf("Sent request %d/%d\n", ctx->request_id + count - 1, iterations);
                 }
             }
 
             // Process events
-            ret = sd_bus_process(bus, NULL);
+            ret = conn_pool_process(pool);
             if (ret < 0) {
                 fprintf(stderr, "Failed to process bus: %s\n", strerror(-ret));
                 goto cleanup;
             }
+            if (sink_error < 0) {
+                fprintf(stderr, "Failed to write to output: %s\n", strerror(-sink_error));
+                ret = sink_error;
+                goto cleanup;
+            }
 
-            // Update in-flight counter
+            // Update in-flight counter; returned requests wait on the resend
+            // list
             int total_processed = completed_requests + failed_requests;
-            in_flight = requests_sent - total_processed;
+            in_flight = requests_sent - returned_requests - total_processed;
+
+            now = qrng_now_usec();
+            if (interval_usec && now - report.last_usec >= interval_usec) {
+                if (throttled_since) {
+                    report.throttled_usec += now - throttled_since;
+                    throttled_since = now;
+                }
+                print_interval_report(&report, now, in_flight, pool);
+            }
+            uint64_t stall_wait = flight_poll(flight, now, (uint32_t)in_flight);
 
             // If we have pending events, continue processing
             if (ret > 0) {
                 continue;
             }
 
-            // Wait for events if we still have requests in flight
-            if (in_flight > 0) {
-                ret = sd_bus_wait(bus, (uint64_t) -1);
+            // Wait for replies, the next token release, the next report or
+            // the flight recorder's stall deadline, whichever comes first
+            uint64_t wait = release_wait < stall_wait ? release_wait : stall_wait;
+            if (interval_usec) {
+                uint64_t until_report = report.last_usec + interval_usec - now;
+                wait = until_report < wait ? until_report : wait;
+            }
+            if (in_flight > 0 || wait != UINT64_MAX) {
+                ret = conn_pool_wait(pool, wait);
                 if (ret < 0) {
                     fprintf(stderr, "Failed to wait on bus: %s\n", strerror(-ret));
                     goto cleanup;
@@ -349,6 +1326,41 @@ int main(int argc, char *argv[]) {
             }
         }
 
+        if (interval_usec && report.last_usec < qrng_now_usec()) {
+            print_interval_report(&report, qrng_now_usec(), 0, pool);
+        }
+
+        conn_pool_stats_t stats;
+        conn_pool_get_stats(pool, &stats);
+        if (stats.disconnects > 0) {
+            printf("Connections: %lu disconnects, %lu reconnects (%lu attempts failed), "
+                   "%lu calls reissued, recovery avg %.1f ms max %.1f ms\n",
+                   stats.disconnects, stats.reconnects, stats.reconnect_failures, stats.reissued,
+                   stats.recoveries ? stats.recovery_usec_total / 1000.0 / stats.recoveries : 0.0,
+                   stats.recovery_usec_max / 1000.0);
+        }
+        if (log_to_stdout || interval_usec) {
+            printf("Transport: rcvbuf %d, sndbuf %d, read queue max %lu, write queue max %lu "
+                   "(limited %lu times), %.2f wakeups per call\n",
+                   stats.rcvbuf, stats.sndbuf, stats.rqueue_max, stats.wqueue_max,
+                   stats.write_limited, stats.calls ? (double)stats.wakeups / stats.calls : 0.0);
+            if (batch_requested > 1) {
+                printf("Batching: %lu bus calls for %d requests (%.1f requests per call)\n",
+                       stats.calls, iterations, stats.calls ? (double)iterations / stats.calls : 0.0);
+            }
+        }
+        if (stats.service_outages > 0) {
+            printf("Service: %lu restarts, recovery avg %.1f ms max %.1f ms "
+                   "(first reply avg %.1f ms max %.1f ms after the new owner appeared)\n",
+                   stats.service_outages,
+                   stats.service_recoveries
+                       ? stats.service_recovery_usec_total / 1000.0 / stats.service_recoveries : 0.0,
+                   stats.service_recovery_usec_max / 1000.0,
+                   stats.service_recoveries
+                       ? stats.resume_usec_total / 1000.0 / stats.service_recoveries : 0.0,
+                   stats.resume_usec_max / 1000.0);
+        }
+
         if (log_to_stdout) {
             printf("Completed %d requests (%d successful, %d failed)\n", 
                    iterations, completed_requests, failed_requests);
@@ -356,15 +1368,42 @@ int main(int argc, char *argv[]) {
 
         if (failed_requests > 0) {
             ret = -1;
-            goto cleanup;
+        }
+    }
+
+    if (sinks) {
+        int sink_ret = sink_set_close(sinks);
+        print_sink_report(sinks, qrng_now_usec() - sinks_start);
+        if (sink_ret < 0) {
+            fprintf(stderr, "Failed to write to output: %s\n", strerror(-sink_ret));
+            ret = sink_ret;
         }
     }
 
 cleanup:
+    // The daemon and proxy reports carry this themselves
+    if (log_to_stdout && feed_kernel) {
+        print_process_load("", start_usec);
+    }
+    if (log_to_stdout && !daemon_opts.socket_path && !proxy_opts.name) {
+        print_cpu_throttling("", &cpu_start);
+    }
+
     // Free resources
     sd_bus_error_free(&error);
     sd_bus_message_unref(reply);
     sd_bus_unref(bus);
+    conn_pool_free(pool);
+    sink_set_free(sinks);
+    while (resend_head) {
+        request_context_t *returned = resend_head;
+        resend_head = returned->next;
+        free(returned);
+    }
+    if (trace_file) {
+        fclose(trace_file);
+    }
+    flight_free(flight);
 
     return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+
+#include "sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "qrng.h"
+
+#define SINK_QUEUE_SLOTS 1024
+
+typedef enum {
+    SINK_FD,
+    SINK_SOCKET,
+    SINK_DIGEST,
+} sink_kind_t;
+
+// One reply, shared by every sink queue that holds it
+typedef struct {
+    unsigned refs;
+    size_t len;
+    uint8_t data[];
+} sink_block_t;
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buf[64];
+    size_t buf_len;
+} sha256_t;
+
+typedef struct {
+    sink_set_t *set;
+    sink_kind_t kind;
+    int fd;
+    sha256_t sha;
+
+    // Queue of block references, guarded by the set's lock
+    sink_block_t *queue[SINK_QUEUE_SLOTS];
+    unsigned head;
+    unsigned count;
+    size_t queued_bytes;
+
+    pthread_t thread;
+    int thread_running;
+    sink_stats_t stats;
+} sink_t;
+
+struct sink_set {
+    pthread_mutex_t lock;
+    pthread_cond_t data_ready;  // Signalled when a block is queued or on close
+    pthread_cond_t space_ready; // Signalled when a writer frees queue space
+    size_t queue_bytes;
+    int closing;
+    int closed;
+    unsigned n_sinks;
+    sink_t *sinks;
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_init(sha256_t *s) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(s->state, iv, sizeof(iv));
+    s->length = 0;
+    s->buf_len = 0;
+}
+
+static void sha256_block(sha256_t *s, const uint8_t *p) {
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = s->state[0], b = s->state[1], c = s->state[2], d = s->state[3];
+    uint32_t e = s->state[4], f = s->state[5], g = s->state[6], h = s->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256_k[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s->state[0] += a;
+    s->state[1] += b;
+    s->state[2] += c;
+    s->state[3] += d;
+    s->state[4] += e;
+    s->state[5] += f;
+    s->state[6] += g;
+    s->state[7] += h;
+    explicit_bzero(w, sizeof(w));
+}
+
+static void sha256_update(sha256_t *s, const uint8_t *p, size_t len) {
+    s->length += len;
+    if (s->buf_len > 0) {
+        size_t n = 64 - s->buf_len < len ? 64 - s->buf_len : len;
+        memcpy(s->buf + s->buf_len, p, n);
+        s->buf_len += n;
+        p += n;
+        len -= n;
+        if (s->buf_len < 64) {
+            return;
+        }
+        sha256_block(s, s->buf);
+        s->buf_len = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        sha256_block(s, p);
+    }
+    memcpy(s->buf, p, len);
+    s->buf_len = len;
+}
+
+static void sha256_final(sha256_t *s, char hex[65]) {
+    uint64_t bits = s->length * 8;
+    uint8_t pad[72] = {0x80};
+    size_t pad_len = (s->buf_len < 56 ? 56 : 120) - s->buf_len;
+
+    for (int i = 0; i < 8; i++) {
+        pad[pad_len + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256_update(s, pad, pad_len + 8);
+    for (int i = 0; i < 8; i++) {
+        snprintf(hex + 8 * i, 9, "%08x", s->state[i]);
+    }
+    explicit_bzero(s, sizeof(*s));
+}
+
+static void block_release(sink_block_t *block) {
+    if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        qrng_buf_free(block, sizeof(*block) + block->len);
+    }
+}
+
+static int write_all(sink_t *sink, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = sink->kind == SINK_SOCKET ? send(sink->fd, p, len, MSG_NOSIGNAL)
+                                              : write(sink->fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *writer_thread(void *userdata) {
+    sink_t *sink = userdata;
+    sink_set_t *set = sink->set;
+
+    pthread_mutex_lock(&set->lock);
+    for (;;) {
+        while (sink->count == 0 && !set->closing) {
+            pthread_cond_wait(&set->data_ready, &set->lock);
+        }
+        if (sink->count == 0) {
+            break;
+        }
+        sink_block_t *block = sink->queue[sink->head];
+        int failed = sink->stats.error < 0;
+        pthread_mutex_unlock(&set->lock);
+
+        // A failed sink keeps draining so the producer never waits on it
+        int ret = 0;
+        uint64_t start = qrng_now_usec();
+        if (!failed && sink->kind == SINK_DIGEST) {
+            sha256_update(&sink->sha, block->data, block->len);
+        } else if (!failed) {
+            ret = write_all(sink, block->data, block->len);
+        }
+        uint64_t busy = qrng_now_usec() - start;
+
+        pthread_mutex_lock(&set->lock);
+        if (ret < 0) {
+            sink->stats.error = ret;
+        } else if (!failed) {
+            sink->stats.bytes += block->len;
+            sink->stats.busy_usec += busy;
+        }
+        sink->head = (sink->head + 1) % SINK_QUEUE_SLOTS;
+        sink->count--;
+        sink->queued_bytes -= block->len;
+        pthread_cond_broadcast(&set->space_ready);
+        pthread_mutex_unlock(&set->lock);
+
+        // The last reference wipes the block; keep that out of the lock
+        block_release(block);
+        pthread_mutex_lock(&set->lock);
+    }
+    pthread_mutex_unlock(&set->lock);
+    return NULL;
+}
+
+static int connect_socket(const char *spec) {
+    int fd;
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(spec + 5) >= sizeof(addr.sun_path)) {
+            return -ENAMETOOLONG;
+        }
+        strcpy(addr.sun_path, spec + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -errno;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            int ret = -errno;
+            close(fd);
+            return ret;
+        }
+        return fd;
+    }
+
+    // tcp:HOST:PORT, split at the last colon so bracketless IPv6 hosts work
+    char *host = strdup(spec + 4);
+    if (!host) {
+        return -ENOMEM;
+    }
+    char *port = strrchr(host, ':');
+    if (!port) {
+        free(host);
+        return -EINVAL;
+    }
+    *port++ = '\0';
+
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    int gai = getaddrinfo(host, port, &hints, &res);
+    free(host);
+    if (gai != 0) {
+        return gai == EAI_SYSTEM ? -errno : -EHOSTUNREACH;
+    }
+    fd = -ECONNREFUSED;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        int s = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (s < 0) {
+            fd = -errno;
+            continue;
+        }
+        if (connect(s, ai->ai_addr, ai->ai_addrlen) == 0) {
+            fd = s;
+            break;
+        }
+        fd = -errno;
+        close(s);
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int sink_open(sink_t *sink, const char *spec) {
+    sink->stats.spec = spec;
+
+    if (strcmp(spec, "-") == 0 || strcmp(spec, "stdout") == 0) {
+        // The payload keeps the real stdout; everything printed goes to stderr
+        fflush(stdout);
+        sink->kind = SINK_FD;
+        sink->fd = dup(STDOUT_FILENO);
+        if (sink->fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            return -errno;
+        }
+        return 0;
+    }
+    if (strcmp(spec, "digest:sha256") == 0) {
+        sink->kind = SINK_DIGEST;
+        sha256_init(&sink->sha);
+        return 0;
+    }
+    if (strncmp(spec, "digest:", 7) == 0) {
+        return -EINVAL;
+    }
+    if (strncmp(spec, "unix:", 5) == 0 || strncmp(spec, "tcp:", 4) == 0) {
+        sink->kind = SINK_SOCKET;
+        sink->fd = connect_socket(spec);
+        return sink->fd < 0 ? sink->fd : 0;
+    }
+
+    const char *path = strncmp(spec, "file:", 5) == 0 ? spec + 5 : spec;
+    sink->kind = SINK_FD;
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    return sink->fd < 0 ? -errno : 0;
+}
+
+int sink_set_new(const char *const *specs, unsigned n, size_t queue_bytes, sink_set_t **ret) {
+    sigset_t block_pipe, old_mask;
+    int r = 0;
+
+    sink_set_t *set = calloc(1, sizeof(*set));
+    if (!set) {
+        return -ENOMEM;
+    }
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_cond_init(&set->data_ready, NULL);
+    pthread_cond_init(&set->space_ready, NULL);
+    set->queue_bytes = queue_bytes;
+    set->sinks = calloc(n, sizeof(*set->sinks));
+    if (!set->sinks) {
+        free(set);
+        return -ENOMEM;
+    }
+    set->n_sinks = n;
+    for (unsigned i = 0; i < n; i++) {
+        set->sinks[i].set = set;
+        set->sinks[i].fd = -1;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+        r = sink_open(&set->sinks[i], specs[i]);
+        if (r < 0) {
+            fprintf(stderr, "Failed to open sink %s: %s\n", specs[i], strerror(-r));
+            goto fail;
+        }
+    }
+
+    // Writers inherit a mask with SIGPIPE blocked, so a closed pipe or
+    // socket fails the write with EPIPE instead of killing the process
+    sigemptyset(&block_pipe);
+    sigaddset(&block_pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &block_pipe, &old_mask);
+    for (unsigned i = 0; i < n; i++) {
+        r = -pthread_create(&set->sinks[i].thread, NULL, writer_thread, &set->sinks[i]);
+        if (r < 0) {
+            break;
+        }
+        set->sinks[i].thread_running = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (r < 0) {
+        fprintf(stderr, "Failed to start sink writer: %s\n", strerror(-r));
+        goto fail;
+    }
+
+    *ret = set;
+    return 0;
+
+fail:
+    sink_set_free(set);
+    return r;
+}
+
+int sink_set_publish(sink_set_t *set, const void *data, size_t len) {
+    sink_block_t *block = qrng_buf_alloc(sizeof(*block) + len);
+    int ret = 0;
+
+    if (!block) {
+        return -ENOMEM;
+    }
+    memcpy(block->data, data, len);
+    block->len = len;
+    block->refs = set->n_sinks;
+
+    pthread_mutex_lock(&set->lock);
+    for (unsigned i = 0; i < set->n_sinks; i++) {
+        sink_t *sink = &set->sinks[i];
+
+        if (sink->count > 0 &&
+            (sink->count == SINK_QUEUE_SLOTS || sink->queued_bytes + len > set->queue_bytes)) {
+            uint64_t start = qrng_now_usec();
+            while (sink->count > 0 && (sink->count == SINK_QUEUE_SLOTS ||
+                                       sink->queued_bytes + len > set->queue_bytes)) {
+                pthread_cond_wait(&set->space_ready, &set->lock);
+            }
+            sink->stats.stalled_usec += qrng_now_usec() - start;
+        }
+        if (sink->stats.error < 0 && ret == 0) {
+            ret = sink->stats.error;
+        }
+
+        sink->queue[(sink->head + sink->count) % SINK_QUEUE_SLOTS] = block;
+        sink->count++;
+        sink->queued_bytes += len;
+        if (sink->queued_bytes > sink->stats.queue_max) {
+            sink->stats.queue_max = sink->queued_bytes;
+        }
+    }
+    pthread_cond_broadcast(&set->data_ready);
+    pthread_mutex_unlock(&set->lock);
+    return ret;
+}
+
+int sink_set_close(sink_set_t *set) {
+    int ret = 0;
+
+    if (set->closed) {
+        goto out;
+    }
+    pthread_mutex_lock(&set->lock);
+    set->closing = 1;
+    pthread_cond_broadcast(&set->data_ready);
+    pthread_mutex_unlock(&set->lock);
+
+    for (unsigned i = 0; i < set->n_sinks; i++) {
+        sink_t *sink = &set->sinks[i];
+        if (sink->thread_running) {
+            pthread_join(sink->thread, NULL);
+            sink->thread_running = 0;
+        }
+        if (sink->kind == SINK_DIGEST) {
+            sha256_final(&sink->sha, sink->stats.digest);
+        }
+        if (sink->fd >= 0 && close(sink->fd) < 0 && sink->stats.error == 0) {
+            sink->stats.error = -errno;
+        }
+        sink->fd = -1;
+    }
+    set->closed = 1;
+
+out:
+    for (unsigned i = 0; i < set->n_sinks; i++) {
+        if (set->sinks[i].stats.error < 0) {
+            ret = set->sinks[i].stats.error;
+            break;
+        }
+    }
+    return ret;
+}
+
+unsigned sink_set_count(sink_set_t *set) {
+    return set->n_sinks;
+}
+
+void sink_set_get_stats(sink_set_t *set, unsigned index, sink_stats_t *stats) {
+    pthread_mutex_lock(&set->lock);
+    *stats = set->sinks[index].stats;
+    pthread_mutex_unlock(&set->lock);
+}
+
+void sink_set_free(sink_set_t *set) {
+    if (!set) {
+        return;
+    }
+    sink_set_close(set);
+    pthread_mutex_destroy(&set->lock);
+    pthread_cond_destroy(&set->data_ready);
+    pthread_cond_destroy(&set->space_ready);
+    free(set->sinks);
+    free(set);
+}
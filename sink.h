@@ -0,0 +1,49 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fan-out of reply payloads to several outputs. Each reply is copied once
+// into a reference-counted block that every sink's queue points to; each
+// sink has its own writer thread and a queue bounded in bytes. When a
+// sink's queue is full the producer waits for it, so a slow sink slows the
+// fetch down instead of forcing extra buffering or copies.
+//
+// Sink specs:
+//   -, stdout        raw bytes to standard output (other output moves to stderr)
+//   file:PATH, PATH  raw bytes to a file, truncated first
+//   digest:sha256    SHA-256 of the stream, reported at the end
+//   unix:PATH        raw bytes to a Unix stream socket
+//   tcp:HOST:PORT    raw bytes to a TCP socket
+typedef struct sink_set sink_set_t;
+
+typedef struct {
+    const char *spec;
+    uint64_t bytes;          // Bytes written (or hashed)
+    uint64_t busy_usec;      // Time spent writing
+    uint64_t stalled_usec;   // Time the producer waited on this sink's full queue
+    size_t queue_max;        // Deepest queue seen, in bytes
+    int error;               // Negative errno of the first failure, 0 if none
+    char digest[65];         // Hex digest for digest sinks, once closed
+} sink_stats_t;
+
+// Open n sinks, each buffering at most queue_bytes (a larger single block
+// is still accepted into an empty queue).
+int sink_set_new(const char *const *specs, unsigned n, size_t queue_bytes, sink_set_t **ret);
+
+// Queue len bytes for every sink, waiting while any queue is full. Returns
+// 0, or the negative errno of a sink that has failed.
+int sink_set_publish(sink_set_t *set, const void *data, size_t len);
+
+// Wait for the queues to drain and stop the writers. Returns 0 or the
+// first sink error.
+int sink_set_close(sink_set_t *set);
+
+unsigned sink_set_count(sink_set_t *set);
+void sink_set_get_stats(sink_set_t *set, unsigned index, sink_stats_t *stats);
+
+// Closes the set first if sink_set_close was not called.
+void sink_set_free(sink_set_t *set);
+
+#endif